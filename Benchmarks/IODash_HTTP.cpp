@@ -27,77 +27,92 @@ const char http_reply[] = "HTTP/1.0 200 OK\r\n"
 			  "Content-Length: 0\r\n"
 			  "\r\n";
 
-int main() {
+// Usage: IODash_Benchmark_HTTP [threads]
+int main(int argc, char **argv) {
 	signal(SIGPIPE, SIG_IGN);
 
-	Socket<AddressFamily::IPv4, SocketType::Stream> socket1;
-
-	socket1.create();
-	socket1.bind({"127.0.0.1:8082"});
-	socket1.listen();
-
-	std::cout << "listening on: " << to_string(socket_cast<AddressFamily::Any, SocketType::Datagram>(socket1).local_address()) << "\n";
+	size_t nr_threads = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1;
 
 	struct user_data {
-		bool is_listening_socket = false;
 		uint32_t write_pos = 0;
 	};
 
 #ifdef __linux__
-    EventLoop<EventBackend::EPoll, user_data> event_loop;
+    EventLoopGroup<EventBackend::EPoll, user_data> event_loops(nr_threads);
 #else
-    EventLoop<EventBackend::Poll, user_data> event_loop;
+    EventLoopGroup<EventBackend::Poll, user_data> event_loops(nr_threads);
 #endif
-	event_loop.add(socket1, EventType::In, {true});
 
 //	int fd = open("/dev/null", O_RDWR);
 //	dup2(fd, STDOUT_FILENO);
 
-	event_loop.on_event(EventType::In|EventType::Out, [](auto& event_loop, File& so, EventType ev, auto& userdata){
-		auto &cur_socket = socket_cast<AddressFamily::IPv4, SocketType::Stream>(so);
-
-		try {
-			if (userdata.is_listening_socket) {
-				auto client_socket = cur_socket.accept();
-				if (client_socket) {
-//					auto rmt_addr = client_socket.remote_address();
-//					std::cout << rmt_addr.to_string();
-//					printf("New %s client: %s\n",
-//					       rmt_addr.family() == AddressFamily::IPv4 ? "IPv4" : "IPv6",
-//					       rmt_addr.to_string().c_str());
-					event_loop.add(client_socket, EventType::In | EventType::Out);
+	// One SO_REUSEPORT listener per loop. The listener has its own handler, clients go through the loop wide one.
+	event_loops.listen<AddressFamily::IPv4>({"127.0.0.1:8082"}, [](auto& event_loop, auto& socket1, size_t idx){
+		if (!idx)
+			std::cout << "listening on: " << to_string(socket_cast<AddressFamily::Any, SocketType::Datagram>(socket1).local_address()) << "\n";
+
+		event_loop.add(socket1, EventType::In, {}, [](auto& event_loop, File& so, EventType, auto&){
+			auto &cur_socket = socket_cast<AddressFamily::IPv4, SocketType::Stream>(so);
+
+			// The loop owns the client fd, no refcount per connection. Non-blocking: it's edge-triggered below.
+#ifdef SOCK_NONBLOCK
+			auto client_socket = cur_socket.accept_fd(SOCK_NONBLOCK);
+#else
+			auto client_socket = cur_socket.accept_fd();
+			if (client_socket)
+				::fcntl(client_socket.fd(), F_SETFL, ::fcntl(client_socket.fd(), F_GETFL) | O_NONBLOCK);
+#endif
+			if (client_socket) {
+//				auto rmt_addr = client_socket.remote_address();
+//				std::cout << rmt_addr.to_string();
+//				printf("New %s client: %s\n",
+//				       rmt_addr.family() == AddressFamily::IPv4 ? "IPv4" : "IPv6",
+//				       rmt_addr.to_string().c_str());
+				std::error_code ec;
+				event_loop.add(std::move(client_socket), EventType::In | EventType::Out | EventType::EdgeTriggered, {}, ec);
+			}
+		});
+
+		event_loop.on_event(EventType::In|EventType::Out, [](auto& event_loop, File& so, EventType ev, auto& userdata){
+			auto &cur_socket = socket_cast<AddressFamily::IPv4, SocketType::Stream>(so);
+
+			// No exceptions on the hot path: a reset peer makes shutdown() fail all the time
+			std::error_code ec;
+
+			// Edge-triggered: In and Out may arrive together and won't be repeated, so read until EAGAIN
+			if (ev & EventType::In) {
+				char buf[1024];
+				ssize_t rc;
+
+				while ((rc = cur_socket.recv(buf, 1024)) > 0) {
+//				std::cout << "Read " << rc << " bytes from client "
+//					  << cur_socket.remote_address().to_string() << "\n";
+//				auto rmt_addr = cur_socket.remote_address();
+//				std::cout << rmt_addr.to_string();
+
 				}
-			} else {
-				if (ev & EventType::In) {
-					char buf[1024];
-					auto rc = cur_socket.recv(buf, 1024);
-					if (rc > 0) {
-//					std::cout << "Read " << rc << " bytes from client "
-//						  << cur_socket.remote_address().to_string() << "\n";
-//					auto rmt_addr = cur_socket.remote_address();
-//					std::cout << rmt_addr.to_string();
-
-					} else {
-						event_loop.del(cur_socket);
-					}
-				} else if (ev & EventType::Out) {
-					ssize_t rc = cur_socket.send(http_reply+userdata.write_pos, sizeof(http_reply)-1-userdata.write_pos);
-
-					if (rc > 0) {
-						userdata.write_pos += rc;
-						if (userdata.write_pos == sizeof(http_reply) - 1) {
-							cur_socket.shutdown();
-							event_loop.del(cur_socket);
-						}
-					} else {
-						cur_socket.shutdown();
-						event_loop.del(cur_socket);
-					}
+
+				if (rc == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+					event_loop.del(cur_socket, ec);
+					return;
 				}
 			}
-		} catch (...) {
 
-		}
+			if (ev & EventType::Out) {
+				ssize_t rc = cur_socket.send(http_reply+userdata.write_pos, sizeof(http_reply)-1-userdata.write_pos);
+
+				if (rc > 0) {
+					userdata.write_pos += rc;
+					if (userdata.write_pos == sizeof(http_reply) - 1) {
+						cur_socket.shutdown(SHUT_RDWR, ec);
+						event_loop.del(cur_socket, ec);
+					}
+				} else {
+					cur_socket.shutdown(SHUT_RDWR, ec);
+					event_loop.del(cur_socket, ec);
+				}
+			}
+		});
 	});
 
 
@@ -122,5 +137,5 @@ int main() {
 //		}
 //	});
 
-	event_loop.run();
+	event_loops.run();
 }
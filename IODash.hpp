@@ -13,7 +13,14 @@
 #pragma once
 
 #include "IODash/EventLoop.hpp"
+#include "IODash/EventLoopGroup.hpp"
+#include "IODash/ComputePool.hpp"
+#include "IODash/ConnectionPool.hpp"
+#include "IODash/Coroutine.hpp"
 #include "IODash/File.hpp"
+#include "IODash/BufferedFile.hpp"
+#include "IODash/DirectIO.hpp"
+#include "IODash/FileDescriptor.hpp"
 #include "IODash/Socket.hpp"
 #include "IODash/Serial.hpp"
 #include "IODash/Timer.hpp"
@@ -0,0 +1,297 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <optional>
+#include <string_view>
+#include <system_error>
+
+#include <cstring>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "File.hpp"
+
+namespace IODash {
+
+	// Buffered reads over any File: a regular file, a pipe, a serial port... Records are returned as string_views
+	// into the buffer, valid until the next call. The buffer is reused: consumed bytes are dropped by moving the
+	// unread tail to the front when the end is reached, and it only grows for a record longer than itself.
+	class BufferedReader {
+	protected:
+		File file_;
+		std::vector<char> buf_;
+		size_t begin_ = 0, end_ = 0;
+
+		// Regular files: offset the next read starts at, and how far the kernel was asked to read ahead. -1 otherwise.
+		off_t offset_ = -1;
+		off_t ahead_until_ = 0;
+		size_t read_ahead_ = 0;
+
+		void __read_ahead() noexcept {
+#ifdef POSIX_FADV_WILLNEED
+			if (!read_ahead_ || offset_ < 0)
+				return;
+
+			// Keeps the window after the one being read in flight, the disk works while we parse
+			while (ahead_until_ < offset_ + (off_t)read_ahead_) {
+				::posix_fadvise(file_.fd(), ahead_until_, read_ahead_, POSIX_FADV_WILLNEED);
+				ahead_until_ += read_ahead_;
+			}
+#endif
+		}
+
+		// Reads more after end_, making room first. Returns what read() returned.
+		ssize_t __fill() {
+			if (begin_ == end_) {
+				begin_ = end_ = 0;
+			} else if (end_ == buf_.size()) {
+				if (begin_) {
+					memmove(buf_.data(), buf_.data() + begin_, end_ - begin_);
+					end_ -= begin_;
+					begin_ = 0;
+				} else {
+					buf_.resize(buf_.size() * 2);
+				}
+			}
+
+			ssize_t rc;
+			do {
+				rc = file_.read(buf_.data() + end_, buf_.size() - end_);
+			} while (rc < 0 && errno == EINTR);
+
+			if (rc > 0) {
+				end_ += rc;
+				if (offset_ >= 0) {
+					offset_ += rc;
+					__read_ahead();
+				}
+			}
+
+			return rc;
+		}
+
+	public:
+		// __sequential: tells the kernel (posix_fadvise) the file will be read sequentially, so it reads ahead more
+		BufferedReader(const File& __file, size_t __buffer_size = 65536, bool __sequential = true) :
+			file_(__file), buf_(__buffer_size ? __buffer_size : 1) {
+			off_t pos = ::lseek(file_.fd(), 0, SEEK_CUR);
+			struct stat stbuf;
+
+			if (pos >= 0 && !::fstat(file_.fd(), &stbuf) && S_ISREG(stbuf.st_mode)) {
+				offset_ = ahead_until_ = pos;
+#ifdef POSIX_FADV_SEQUENTIAL
+				if (__sequential)
+					::posix_fadvise(file_.fd(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+			}
+		}
+
+		// For large sequential scans of regular files: keeps __window bytes past the read position requested
+		// from the disk (POSIX_FADV_WILLNEED), so the next chunk is in the page cache by the time it's needed.
+		// 0 turns it off.
+		void set_read_ahead(size_t __window) noexcept {
+			read_ahead_ = __window;
+			__read_ahead();
+		}
+
+		const File& file() const noexcept {
+			return file_;
+		}
+
+		// Bytes buffered but not consumed yet
+		std::string_view peek() const noexcept {
+			return {buf_.data() + begin_, end_ - begin_};
+		}
+
+		// The next record ending with __delim, without it. At EOF, the unterminated rest if there is some.
+		// Nothing if there's no complete record: EOF, or EAGAIN on a non-blocking file, which keeps the
+		// partial record for the next call. Throws on other read errors.
+		std::optional<std::string_view> read_until(char __delim) {
+			// Relative to begin_, which __fill() may move
+			size_t scanned = 0;
+
+			while (true) {
+				auto *p = (char *)memchr(buf_.data() + begin_ + scanned, __delim, end_ - begin_ - scanned);
+
+				if (p) {
+					std::string_view ret(buf_.data() + begin_, p - (buf_.data() + begin_));
+					begin_ += ret.size() + 1;
+					return ret;
+				}
+
+				scanned = end_ - begin_;
+
+				ssize_t rc = __fill();
+
+				if (rc == 0) {
+					if (begin_ == end_)
+						return {};
+
+					std::string_view ret(buf_.data() + begin_, end_ - begin_);
+					begin_ = end_;
+					return ret;
+				}
+
+				if (rc < 0) {
+					if (errno == EAGAIN || errno == EWOULDBLOCK)
+						return {};
+
+					throw std::system_error(errno, std::system_category(), "failed to read");
+				}
+			}
+		}
+
+		// A line without its "\n" or "\r\n"
+		std::optional<std::string_view> read_line() {
+			auto ret = read_until('\n');
+
+			if (ret && !ret->empty() && ret->back() == '\r')
+				ret->remove_suffix(1);
+
+			return ret;
+		}
+
+		// Same as File::read(), but only calls read() when the buffer is empty. Large reads bypass the buffer.
+		ssize_t read(void *__buf, size_t __len) {
+			if (begin_ == end_) {
+				if (__len >= buf_.size()) {
+					ssize_t rc = file_.read(__buf, __len);
+					if (rc > 0 && offset_ >= 0) {
+						offset_ += rc;
+						__read_ahead();
+					}
+					return rc;
+				}
+
+				ssize_t rc = __fill();
+				if (rc <= 0)
+					return rc;
+			}
+
+			size_t n = std::min(__len, end_ - begin_);
+			memcpy(__buf, buf_.data() + begin_, n);
+			begin_ += n;
+			return n;
+		}
+
+		// Same as File::getc()
+		int getc() {
+			if (begin_ == end_) {
+				ssize_t rc = __fill();
+				if (rc <= 0)
+					return rc;
+			}
+
+			return (uint8_t)buf_[begin_++];
+		}
+	};
+
+	// Buffered writes over any File, written out when the buffer is full, on flush() and on destruction.
+	class BufferedWriter {
+	protected:
+		File file_;
+		std::vector<char> buf_;
+		size_t used_ = 0;
+
+	public:
+		BufferedWriter(const File& __file, size_t __buffer_size = 65536) : file_(__file), buf_(__buffer_size ? __buffer_size : 1) {
+
+		}
+
+		BufferedWriter(const BufferedWriter&) = delete;
+		BufferedWriter& operator=(const BufferedWriter&) = delete;
+
+		// What's buffered goes along. The moved-from writer is left empty, only for destruction or assignment.
+		BufferedWriter(BufferedWriter&& o) noexcept : file_(std::move(o.file_)), buf_(std::move(o.buf_)), used_(std::exchange(o.used_, 0)) {
+
+		}
+
+		// Flushes what this one buffered first, like the destructor would. Whatever that couldn't write is lost.
+		BufferedWriter& operator=(BufferedWriter&& o) {
+			if (this != &o) {
+				flush();
+				file_ = std::move(o.file_);
+				buf_ = std::move(o.buf_);
+				used_ = std::exchange(o.used_, 0);
+			}
+
+			return *this;
+		}
+
+		~BufferedWriter() {
+			flush();
+		}
+
+		const File& file() const noexcept {
+			return file_;
+		}
+
+		size_t buffered() const noexcept {
+			return used_;
+		}
+
+		// Writes out everything buffered. On failure (errno set, e.g. EAGAIN) returns false and keeps what's left.
+		bool flush() {
+			size_t written = 0;
+
+			while (written < used_) {
+				ssize_t rc = file_.write(buf_.data() + written, used_ - written);
+
+				if (rc > 0) {
+					written += rc;
+				} else if (rc < 0 && errno == EINTR) {
+					continue;
+				} else {
+					memmove(buf_.data(), buf_.data() + written, used_ - written);
+					used_ -= written;
+					return false;
+				}
+			}
+
+			used_ = 0;
+			return true;
+		}
+
+		// Returns false if a flush this needed failed, nothing of __buf is taken then.
+		// Writes bigger than the buffer go straight to the file after flushing it.
+		bool write(const void *__buf, size_t __len) {
+			if (used_ + __len > buf_.size()) {
+				if (!flush())
+					return false;
+
+				if (__len >= buf_.size())
+					return file_.write_all(__buf, __len) == (ssize_t)__len;
+			}
+
+			memcpy(buf_.data() + used_, __buf, __len);
+			used_ += __len;
+			return true;
+		}
+
+		bool write(std::string_view __str) {
+			return write(__str.data(), __str.size());
+		}
+
+		bool putc(uint8_t __c) {
+			if (used_ == buf_.size() && !flush())
+				return false;
+
+			buf_[used_++] = (char)__c;
+			return true;
+		}
+	};
+
+}
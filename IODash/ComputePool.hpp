@@ -0,0 +1,223 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <exception>
+#include <type_traits>
+#include <atomic>
+#include <system_error>
+
+// Not EventLoop.hpp: the loop uses a ComputePool for blocking file I/O, and is only needed as a template argument here
+#include "File.hpp"
+
+namespace IODash {
+
+	// Work-stealing thread pool for CPU heavy jobs that shouldn't block an event loop.
+	// Each worker owns a deque: it takes its own jobs from the back and steals from the front of the others.
+	class ComputePool {
+	protected:
+		struct Worker {
+			std::mutex lock;
+			std::deque<std::function<void()>> jobs;
+		};
+
+		std::vector<std::unique_ptr<Worker>> workers;
+		std::vector<std::thread> threads;
+
+		// Only taken to sleep, or to wake a sleeping worker up. Jobs are counted without it.
+		std::mutex sleep_lock;
+		std::condition_variable sleep_cv;
+		std::atomic<size_t> pending{0};
+		std::atomic<size_t> sleeping{0};
+		bool stopping = false;
+
+		std::atomic<size_t> next_worker{0};
+
+		static inline thread_local ComputePool *current_pool = nullptr;
+		static inline thread_local size_t current_worker = 0;
+
+		bool __pop(size_t __idx, std::function<void()>& __job) {
+			auto &w = *workers[__idx];
+			std::lock_guard<std::mutex> lg(w.lock);
+
+			if (w.jobs.empty())
+				return false;
+
+			__job = std::move(w.jobs.back());
+			w.jobs.pop_back();
+			return true;
+		}
+
+		bool __steal(size_t __idx, std::function<void()>& __job) {
+			for (size_t i=1; i<workers.size(); i++) {
+				auto &w = *workers[(__idx + i) % workers.size()];
+				std::lock_guard<std::mutex> lg(w.lock);
+
+				if (!w.jobs.empty()) {
+					__job = std::move(w.jobs.front());
+					w.jobs.pop_front();
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		void __work(size_t __idx) {
+			current_pool = this;
+			current_worker = __idx;
+
+			std::function<void()> job;
+
+			while (true) {
+				if (__pop(__idx, job) || __steal(__idx, job)) {
+					pending.fetch_sub(1);
+
+					job();
+					job = nullptr;
+					continue;
+				}
+
+				// Announced before pending is checked, and submit() counts before it checks sleeping (both seq_cst),
+				// so either we see the job or it sees us and notifies under the lock
+				std::unique_lock<std::mutex> lk(sleep_lock);
+				sleeping.fetch_add(1);
+				sleep_cv.wait(lk, [this]{ return stopping || pending.load(); });
+				sleeping.fetch_sub(1);
+
+				if (stopping && !pending.load())
+					return;
+			}
+		}
+
+	public:
+		ComputePool(size_t __nr_workers = std::thread::hardware_concurrency()) {
+			if (!__nr_workers)
+				__nr_workers = 1;
+
+			for (size_t i=0; i<__nr_workers; i++)
+				workers.emplace_back(std::make_unique<Worker>());
+
+			for (size_t i=0; i<__nr_workers; i++)
+				threads.emplace_back([this, i](){ __work(i); });
+		}
+
+		ComputePool(const ComputePool&) = delete;
+		ComputePool& operator=(const ComputePool&) = delete;
+
+		// Runs every job already submitted, then joins the workers
+		~ComputePool() {
+			{
+				std::lock_guard<std::mutex> lg(sleep_lock);
+				stopping = true;
+			}
+
+			sleep_cv.notify_all();
+
+			for (auto &it : threads)
+				it.join();
+		}
+
+		size_t size() const noexcept {
+			return workers.size();
+		}
+
+		// Thread safe. Like std::thread, an exception escaping __job terminates the process.
+		void submit(std::function<void()> __job) {
+			// Jobs submitted from a worker stay on it, the rest are spread round robin
+			size_t idx = current_pool == this ? current_worker : next_worker.fetch_add(1, std::memory_order_relaxed) % workers.size();
+
+			// Counted first, so a worker can't take the job before it's counted
+			pending.fetch_add(1);
+
+			{
+				std::lock_guard<std::mutex> lg(workers[idx]->lock);
+				workers[idx]->jobs.push_back(std::move(__job));
+			}
+
+			if (sleeping.load()) {
+				// Empty critical section: a worker between its check and wait() holds the lock, so it can't miss this
+				{ std::lock_guard<std::mutex> lg(sleep_lock); }
+				sleep_cv.notify_one();
+			}
+		}
+
+		// Runs __work() on the pool, then __completion(EventLoop&, R, std::exception_ptr) on __loop's thread, R being
+		// what __work returns (left out if void). If __work throws, the completion gets the exception and a value
+		// initialized R, nothing is thrown on the loop's thread. __loop must outlive the job.
+		template<typename EL, typename W, typename C>
+		void submit(EL& __loop, W&& __work, C&& __completion) {
+			using R = std::invoke_result_t<std::decay_t<W>>;
+
+			struct State {
+				std::decay_t<W> work;
+				std::decay_t<C> completion;
+				std::conditional_t<std::is_void_v<R>, bool, R> result{};
+				std::exception_ptr error;
+			};
+
+			auto state = std::make_shared<State>(State{std::forward<W>(__work), std::forward<C>(__completion), {}, nullptr});
+
+			submit([&__loop, state](){
+				try {
+					if constexpr (std::is_void_v<R>)
+						state->work();
+					else
+						state->result = state->work();
+				} catch (...) {
+					state->error = std::current_exception();
+				}
+
+				__loop.post([state](auto& __l){
+					if constexpr (std::is_void_v<R>)
+						state->completion(__l, state->error);
+					else
+						state->completion(__l, std::move(state->result), state->error);
+				});
+			});
+		}
+
+		// Same, but for a job on behalf of a watched object: __completion(EventLoop&, File&, UD&, R, std::exception_ptr) only runs
+		// if __target is still watched by the same registration, so its UD& is valid. Otherwise the result is dropped.
+		template<typename EL, typename W, typename C>
+		void submit(EL& __loop, const File& __target, W&& __work, C&& __completion) {
+			using R = std::invoke_result_t<std::decay_t<W>>;
+
+			uint64_t token = __loop.token(__target);
+			if (!token)
+				throw std::system_error(ENOENT, std::system_category(), "ComputePool::submit");
+
+			if constexpr (std::is_void_v<R>) {
+				submit(__loop, std::forward<W>(__work), [token, completion = std::forward<C>(__completion)](auto& __l, std::exception_ptr __error) mutable {
+					__l.with_token(token, [&](File& __file, auto& __ud){
+						completion(__l, __file, __ud, __error);
+					});
+				});
+			} else {
+				submit(__loop, std::forward<W>(__work), [token, completion = std::forward<C>(__completion)](auto& __l, R&& __result, std::exception_ptr __error) mutable {
+					__l.with_token(token, [&](File& __file, auto& __ud){
+						completion(__l, __file, __ud, std::move(__result), __error);
+					});
+				});
+			}
+		}
+	};
+
+}
@@ -0,0 +1,333 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#pragma once
+
+#include <list>
+#include <string>
+#include <vector>
+#include <memory>
+#include <iterator>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <system_error>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "Socket.hpp"
+#include "SocketAddress.hpp"
+
+namespace IODash {
+
+	// Outbound stream connections kept open per destination and reused, so requests don't pay a handshake (and leave
+	// a TIME_WAIT socket behind) each. One per loop, only used from its thread: nothing is locked. EL: the loop type.
+	// Idle connections are watched by the loop: one that becomes readable (peer closed, or stray data) is evicted.
+	template<typename EL, AddressFamily AF>
+	class ConnectionPool {
+	public:
+		using Connection = Socket<AF, SocketType::Stream>;
+		using Handler = std::function<void(EL&, Connection, std::error_code)>;
+
+		struct Options {
+			// Connections per destination: idle, in use and connecting
+			size_t max_per_destination = 64;
+			size_t max_idle_per_destination = 16;
+			// Idle connections are closed after this long unused, 0: never
+			uint64_t idle_timeout_ms = 60000;
+			uint64_t connect_timeout_ms = 5000;
+			// How long acquire() waits for a destination at its cap, 0: forever
+			uint64_t wait_timeout_ms = 5000;
+		};
+
+	protected:
+		struct Idle {
+			Connection socket;
+			uint64_t timer;
+		};
+
+		struct Waiter {
+			Handler handler;
+			uint64_t timer;
+		};
+
+		struct Destination {
+			SocketAddress<AF> address;
+			// Most recently released last, reused first, so the others can time out
+			std::vector<Idle> idle;
+			std::list<Waiter> waiters;
+			size_t open = 0;
+		};
+
+		EL& loop_;
+		Options options_;
+		// Nodes never move, Destination* held by callbacks stay valid
+		std::unordered_map<std::string, Destination> destinations_;
+		// Connects in flight can't be cancelled, their completions check this
+		std::shared_ptr<char> alive_ = std::make_shared<char>();
+
+		// Address and port only, sockaddr padding may hold anything
+		static std::string __key(const SocketAddress<AF>& __addr) {
+			const sockaddr *sa = __addr.raw();
+
+			switch (sa->sa_family) {
+				case AF_INET: {
+					auto *in = (const sockaddr_in *)sa;
+					return std::string((const char *)&in->sin_addr, sizeof(in->sin_addr)) + std::string((const char *)&in->sin_port, sizeof(in->sin_port));
+				}
+				case AF_INET6: {
+					auto *in6 = (const sockaddr_in6 *)sa;
+					return std::string((const char *)&in6->sin6_addr, sizeof(in6->sin6_addr)) + std::string((const char *)&in6->sin6_port, sizeof(in6->sin6_port)) +
+					       std::string((const char *)&in6->sin6_scope_id, sizeof(in6->sin6_scope_id));
+				}
+				default:
+					return std::string((const char *)sa, __addr.size());
+			}
+		}
+
+		Destination& __destination(const SocketAddress<AF>& __addr) {
+			auto it = destinations_.try_emplace(__key(__addr));
+
+			if (it.second)
+				it.first->second.address = __addr;
+
+			return it.first->second;
+		}
+
+		// No EOF or stray data queued, which the loop may not have dispatched yet
+		static bool __usable(const Connection& __socket) noexcept {
+			char c;
+			ssize_t rc = ::recv(__socket.fd(), &c, 1, MSG_PEEK | MSG_DONTWAIT);
+			return rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+		}
+
+		void __connect(Destination& __d, Handler __handler) {
+			Connection s;
+			std::error_code ec;
+
+			s.create(ec);
+			if (ec) {
+				__handler(loop_, Connection(), ec);
+				return;
+			}
+
+			__d.open++;
+
+			std::weak_ptr<char> alive = alive_;
+
+			loop_.async_connect(s, __d.address, options_.connect_timeout_ms, [this, alive, dp = &__d, s, handler = std::move(__handler)](auto&, std::error_code __ec) mutable {
+				if (alive.expired())
+					return;
+
+				if (__ec) {
+					dp->open--;
+					handler(loop_, Connection(), __ec);
+					__serve_waiter(*dp);
+				} else {
+					handler(loop_, std::move(s), __ec);
+				}
+			});
+		}
+
+		// A slot freed up: the longest waiting acquire() gets a new connection
+		void __serve_waiter(Destination& __d) {
+			if (__d.waiters.empty() || __d.open >= options_.max_per_destination)
+				return;
+
+			Waiter w = std::move(__d.waiters.front());
+			__d.waiters.pop_front();
+
+			if (w.timer)
+				loop_.cancel_timer(w.timer);
+
+			__connect(__d, std::move(w.handler));
+		}
+
+		void __evict(Destination& __d, int __fd, bool __timer_fired) {
+			auto it = std::find_if(__d.idle.begin(), __d.idle.end(), [__fd](const Idle& __i){
+				return __i.socket.fd() == __fd;
+			});
+
+			if (it == __d.idle.end())
+				return;
+
+			if (!__timer_fired && it->timer)
+				loop_.cancel_timer(it->timer);
+
+			loop_.del(it->socket);
+			__d.idle.erase(it);
+			__d.open--;
+
+			__serve_waiter(__d);
+		}
+
+	public:
+		explicit ConnectionPool(EL& __loop, const Options& __options = Options()) : loop_(__loop), options_(__options) {
+
+		}
+
+		ConnectionPool(const ConnectionPool&) = delete;
+		ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+		// Idle connections are closed, pending acquire()s are dropped without being called
+		~ConnectionPool() {
+			clear();
+
+			for (auto &it : destinations_) {
+				for (auto &w : it.second.waiters) {
+					if (w.timer)
+						loop_.cancel_timer(w.timer);
+				}
+			}
+		}
+
+		// __handler(EL&, Connection, std::error_code) gets an idle connection to __addr, a new one, or the first
+		// released once the destination is at its cap (ETIMEDOUT after wait_timeout_ms). Reusing an idle one costs
+		// no wait, __handler is called before this returns then. Hand the connection back with release().
+		void acquire(const SocketAddress<AF>& __addr, Handler __handler) {
+			Destination& d = __destination(__addr);
+
+			while (!d.idle.empty()) {
+				Idle i = std::move(d.idle.back());
+				d.idle.pop_back();
+
+				if (i.timer)
+					loop_.cancel_timer(i.timer);
+
+				loop_.del(i.socket);
+
+				if (__usable(i.socket)) {
+					__handler(loop_, std::move(i.socket), std::error_code());
+					return;
+				}
+
+				d.open--;
+			}
+
+			if (d.open < options_.max_per_destination) {
+				__connect(d, std::move(__handler));
+				return;
+			}
+
+			d.waiters.push_back({std::move(__handler), 0});
+
+			if (options_.wait_timeout_ms) {
+				auto it = std::prev(d.waiters.end());
+
+				it->timer = loop_.add_timer(options_.wait_timeout_ms, [this, dp = &d, it](auto&){
+					Handler handler = std::move(it->handler);
+					dp->waiters.erase(it);
+					handler(loop_, Connection(), std::error_code(ETIMEDOUT, std::system_category()));
+				});
+			}
+		}
+
+		// Gives back a connection from acquire() to __addr. __reusable: false if the protocol state is unknown (an
+		// error, a response not fully read...), it's closed then. Don't keep copies of a reusable one.
+		void release(const SocketAddress<AF>& __addr, Connection __socket, bool __reusable = true) {
+			auto dit = destinations_.find(__key(__addr));
+			if (dit == destinations_.end())
+				return;
+
+			Destination& d = dit->second;
+
+			if (loop_.token(__socket))
+				loop_.del(__socket);
+
+			if (!__reusable || !__usable(__socket)) {
+				d.open--;
+				__serve_waiter(d);
+				return;
+			}
+
+			if (!d.waiters.empty()) {
+				Waiter w = std::move(d.waiters.front());
+				d.waiters.pop_front();
+
+				if (w.timer)
+					loop_.cancel_timer(w.timer);
+
+				w.handler(loop_, std::move(__socket), std::error_code());
+				return;
+			}
+
+			if (d.idle.size() >= options_.max_idle_per_destination) {
+				d.open--;
+				return;
+			}
+
+			int fd = __socket.fd();
+
+			loop_.add(__socket, EventType::In, {}, [this, dp = &d](auto&, File& __file, EventType, auto&){
+				__evict(*dp, __file.fd(), false);
+			});
+
+			uint64_t timer = 0;
+
+			if (options_.idle_timeout_ms) {
+				timer = loop_.add_timer(options_.idle_timeout_ms, [this, dp = &d, fd](auto&){
+					__evict(*dp, fd, true);
+				});
+			}
+
+			d.idle.push_back({std::move(__socket), timer});
+		}
+
+		// Opens connections to __addr until it has __count (capped by max_per_destination), kept idle once connected.
+		// At most max_idle_per_destination of them stay.
+		void prewarm(const SocketAddress<AF>& __addr, size_t __count) {
+			Destination& d = __destination(__addr);
+			size_t target = std::min(__count, options_.max_per_destination);
+
+			for (size_t n = d.open; n < target; n++) {
+				__connect(d, [this, addr = d.address](EL&, Connection __socket, std::error_code __ec){
+					if (!__ec)
+						release(addr, std::move(__socket));
+				});
+			}
+		}
+
+		// Closes all idle connections
+		void clear() {
+			for (auto &it : destinations_) {
+				auto &d = it.second;
+
+				for (auto &i : d.idle) {
+					if (i.timer)
+						loop_.cancel_timer(i.timer);
+
+					loop_.del(i.socket);
+				}
+
+				d.open -= d.idle.size();
+				d.idle.clear();
+			}
+		}
+
+		// Idle, in use and connecting
+		size_t open_count(const SocketAddress<AF>& __addr) const {
+			auto it = destinations_.find(__key(__addr));
+			return it == destinations_.end() ? 0 : it->second.open;
+		}
+
+		size_t idle_count(const SocketAddress<AF>& __addr) const {
+			auto it = destinations_.find(__key(__addr));
+			return it == destinations_.end() ? 0 : it->second.idle.size();
+		}
+
+		const Options& options() const noexcept {
+			return options_;
+		}
+	};
+
+}
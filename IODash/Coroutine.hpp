@@ -0,0 +1,470 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#pragma once
+
+#if __cplusplus >= 202002L && __has_include(<coroutine>)
+
+#include <coroutine>
+#include <exception>
+#include <new>
+
+#include <cerrno>
+
+#include "EventLoop.hpp"
+#include "Socket.hpp"
+#include "Timer.hpp"
+
+namespace IODash {
+
+	// Size bucketed free lists for coroutine frames, one per thread. A connection's frame is recycled
+	// for the next connection, so a warmed up loop doesn't allocate per coroutine.
+	class FramePool {
+	protected:
+		static constexpr size_t granularity = 64;
+		static constexpr size_t max_size = 4096;
+
+		struct FreeNode {
+			FreeNode *next;
+		};
+
+		FreeNode *buckets[max_size / granularity] = {};
+
+	public:
+		static FramePool& local() noexcept {
+			static thread_local FramePool pool;
+			return pool;
+		}
+
+		~FramePool() {
+			for (auto &it : buckets) {
+				while (it) {
+					FreeNode *next = it->next;
+					::operator delete(it);
+					it = next;
+				}
+			}
+		}
+
+		void *allocate(size_t __size) {
+			if (__size > max_size)
+				return ::operator new(__size);
+
+			size_t idx = (__size - 1) / granularity;
+
+			if (buckets[idx]) {
+				FreeNode *n = buckets[idx];
+				buckets[idx] = n->next;
+				return n;
+			}
+
+			return ::operator new((idx + 1) * granularity);
+		}
+
+		void deallocate(void *__p, size_t __size) noexcept {
+			if (__size > max_size) {
+				::operator delete(__p);
+				return;
+			}
+
+			size_t idx = (__size - 1) / granularity;
+			auto *n = static_cast<FreeNode *>(__p);
+			n->next = buckets[idx];
+			buckets[idx] = n;
+		}
+	};
+
+	// Fire-and-forget coroutine. Runs until its first suspension when called and frees itself when done.
+	// Like std::thread, an exception escaping it terminates the process.
+	class Task {
+	public:
+		struct promise_type {
+			Task get_return_object() noexcept {
+				return {};
+			}
+
+			std::suspend_never initial_suspend() noexcept {
+				return {};
+			}
+
+			std::suspend_never final_suspend() noexcept {
+				return {};
+			}
+
+			void return_void() noexcept {
+
+			}
+
+			void unhandled_exception() noexcept {
+				std::terminate();
+			}
+
+			static void *operator new(size_t __size) {
+				return FramePool::local().allocate(__size);
+			}
+
+			static void operator delete(void *__p, size_t __size) noexcept {
+				FramePool::local().deallocate(__p, __size);
+			}
+		};
+	};
+
+	// Waits for readiness through a OneShot registration with a per-fd handler. The object is added to the loop
+	// on first use and stays watched (disarmed) afterwards, del() it when done. __attempt() returns true when
+	// the operation completed, false to wait again. The handler points to the awaiter, which lives in the coroutine
+	// frame: it's removed before resuming, the frame may be gone once resume() returns.
+	template<typename EL, typename D>
+	class FdAwaiter {
+	protected:
+		EL& loop;
+		File& file;
+		std::coroutine_handle<> handle;
+
+		void __wait(EventType __events) {
+			typename EL::Handler handler = [this](auto&, File&, EventType, auto&){
+				if (static_cast<D *>(this)->__attempt()) {
+					loop.on_event(file, nullptr);
+					handle.resume();
+				} else {
+					loop.rearm(file);
+				}
+			};
+
+			if (loop.token(file)) {
+				loop.on_event(file, handler);
+				loop.modify(file, __events | EventType::OneShot);
+			} else {
+				loop.add(file, __events | EventType::OneShot, {}, handler);
+			}
+		}
+
+	public:
+		FdAwaiter(EL& __loop, File& __file) : loop(__loop), file(__file) {
+
+		}
+	};
+
+	template<typename EL, typename S>
+	class RecvAwaiter : public FdAwaiter<EL, RecvAwaiter<EL, S>> {
+	protected:
+		friend class FdAwaiter<EL, RecvAwaiter<EL, S>>;
+
+		void *buf;
+		size_t len;
+		ssize_t rc = -1;
+		int err = 0;
+
+		bool __attempt() {
+			rc = static_cast<S&>(this->file).recv(buf, len, MSG_DONTWAIT);
+			err = errno;
+			return rc >= 0 || (err != EAGAIN && err != EWOULDBLOCK);
+		}
+
+	public:
+		RecvAwaiter(EL& __loop, S& __socket, void *__buf, size_t __len) :
+			FdAwaiter<EL, RecvAwaiter<EL, S>>(__loop, __socket), buf(__buf), len(__len) {
+
+		}
+
+		bool await_ready() {
+			return __attempt();
+		}
+
+		void await_suspend(std::coroutine_handle<> __handle) {
+			this->handle = __handle;
+			this->__wait(EventType::In);
+		}
+
+		// Same as Socket::recv(): bytes received, 0 on EOF, -1 with errno set
+		ssize_t await_resume() noexcept {
+			errno = err;
+			return rc;
+		}
+	};
+
+	template<typename EL, typename S>
+	class SendAwaiter : public FdAwaiter<EL, SendAwaiter<EL, S>> {
+	protected:
+		friend class FdAwaiter<EL, SendAwaiter<EL, S>>;
+
+		const uint8_t *buf;
+		size_t len;
+		size_t sent = 0;
+		int err = 0;
+
+		bool __attempt() {
+			while (sent < len) {
+				ssize_t rc = static_cast<S&>(this->file).send(buf + sent, len - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+				if (rc < 0) {
+					err = errno;
+					return err != EAGAIN && err != EWOULDBLOCK;
+				}
+
+				sent += rc;
+			}
+
+			err = 0;
+			return true;
+		}
+
+	public:
+		SendAwaiter(EL& __loop, S& __socket, const void *__buf, size_t __len) :
+			FdAwaiter<EL, SendAwaiter<EL, S>>(__loop, __socket), buf((const uint8_t *)__buf), len(__len) {
+
+		}
+
+		bool await_ready() {
+			return __attempt();
+		}
+
+		void await_suspend(std::coroutine_handle<> __handle) {
+			this->handle = __handle;
+			this->__wait(EventType::Out);
+		}
+
+		// Sends everything: __len, or -1 with errno set
+		ssize_t await_resume() noexcept {
+			errno = err;
+			return err ? -1 : (ssize_t)sent;
+		}
+	};
+
+	template<typename EL, typename S>
+	class AcceptAwaiter : public FdAwaiter<EL, AcceptAwaiter<EL, S>> {
+	protected:
+		friend class FdAwaiter<EL, AcceptAwaiter<EL, S>>;
+
+		S result;
+		int err = 0;
+
+		bool __attempt() {
+			result = static_cast<S&>(this->file).accept();
+			err = errno;
+			return result.fd() >= 0 || (err != EAGAIN && err != EWOULDBLOCK);
+		}
+
+	public:
+		AcceptAwaiter(EL& __loop, S& __listener) : FdAwaiter<EL, AcceptAwaiter<EL, S>>(__loop, __listener) {
+
+		}
+
+		bool await_ready() {
+			return __attempt();
+		}
+
+		void await_suspend(std::coroutine_handle<> __handle) {
+			this->handle = __handle;
+			this->__wait(EventType::In);
+		}
+
+		// Same as Socket::accept(): an invalid socket with errno set on failure
+		S await_resume() noexcept {
+			errno = err;
+			return result;
+		}
+	};
+
+	// For pipes, ttys, eventfds... which must be non-blocking: unlike recv(), read() has no per-call flag.
+	// Regular files are always ready, use EventLoop::async_pread() for them.
+	template<typename EL>
+	class ReadAwaiter : public FdAwaiter<EL, ReadAwaiter<EL>> {
+	protected:
+		friend class FdAwaiter<EL, ReadAwaiter<EL>>;
+
+		void *buf;
+		size_t len;
+		ssize_t rc = -1;
+		int err = 0;
+
+		bool __attempt() {
+			rc = this->file.read(buf, len);
+			err = errno;
+			return rc >= 0 || (err != EAGAIN && err != EWOULDBLOCK);
+		}
+
+	public:
+		ReadAwaiter(EL& __loop, File& __file, void *__buf, size_t __len) :
+			FdAwaiter<EL, ReadAwaiter<EL>>(__loop, __file), buf(__buf), len(__len) {
+
+		}
+
+		bool await_ready() {
+			return __attempt();
+		}
+
+		void await_suspend(std::coroutine_handle<> __handle) {
+			this->handle = __handle;
+			this->__wait(EventType::In);
+		}
+
+		// Same as File::read(): bytes read, 0 on EOF, -1 with errno set
+		ssize_t await_resume() noexcept {
+			errno = err;
+			return rc;
+		}
+	};
+
+	template<typename EL>
+	class WriteAwaiter : public FdAwaiter<EL, WriteAwaiter<EL>> {
+	protected:
+		friend class FdAwaiter<EL, WriteAwaiter<EL>>;
+
+		const uint8_t *buf;
+		size_t len;
+		size_t written = 0;
+		int err = 0;
+
+		bool __attempt() {
+			while (written < len) {
+				ssize_t rc = this->file.write(buf + written, len - written);
+
+				if (rc < 0) {
+					err = errno;
+					if (err == EINTR)
+						continue;
+					return err != EAGAIN && err != EWOULDBLOCK;
+				}
+
+				written += rc;
+			}
+
+			err = 0;
+			return true;
+		}
+
+	public:
+		WriteAwaiter(EL& __loop, File& __file, const void *__buf, size_t __len) :
+			FdAwaiter<EL, WriteAwaiter<EL>>(__loop, __file), buf((const uint8_t *)__buf), len(__len) {
+
+		}
+
+		bool await_ready() {
+			return __attempt();
+		}
+
+		void await_suspend(std::coroutine_handle<> __handle) {
+			this->handle = __handle;
+			this->__wait(EventType::Out);
+		}
+
+		// Writes everything: __len, or -1 with errno set
+		ssize_t await_resume() noexcept {
+			errno = err;
+			return err ? -1 : (ssize_t)written;
+		}
+	};
+
+#ifdef __linux__
+	template<typename EL>
+	class TimerAwaiter : public FdAwaiter<EL, TimerAwaiter<EL>> {
+	protected:
+		friend class FdAwaiter<EL, TimerAwaiter<EL>>;
+
+		uint64_t expirations = 0;
+
+		bool __attempt() {
+			auto rc = static_cast<Timer&>(this->file).read();
+			expirations = rc ? *rc : 0;
+			return true;
+		}
+
+	public:
+		TimerAwaiter(EL& __loop, Timer& __timer) : FdAwaiter<EL, TimerAwaiter<EL>>(__loop, __timer) {
+
+		}
+
+		bool await_ready() noexcept {
+			return false;
+		}
+
+		void await_suspend(std::coroutine_handle<> __handle) {
+			this->handle = __handle;
+			this->__wait(EventType::In);
+		}
+
+		// Number of expirations since the last read
+		uint64_t await_resume() noexcept {
+			return expirations;
+		}
+	};
+#endif
+
+	template<typename EL>
+	class SleepAwaiter {
+	protected:
+		EL& loop;
+		uint64_t delay_ms;
+
+	public:
+		SleepAwaiter(EL& __loop, uint64_t __delay_ms) : loop(__loop), delay_ms(__delay_ms) {
+
+		}
+
+		bool await_ready() noexcept {
+			return false;
+		}
+
+		void await_suspend(std::coroutine_handle<> __handle) {
+			loop.add_timer(delay_ms, [__handle](auto&){
+				__handle.resume();
+			});
+		}
+
+		void await_resume() noexcept {
+
+		}
+	};
+
+	// co_await async_recv(loop, socket, buf, len), and friends. The socket doesn't need to be non-blocking,
+	// a listener passed to async_accept() does.
+	template<typename EL, AddressFamily AF, SocketType ST>
+	RecvAwaiter<EL, Socket<AF, ST>> async_recv(EL& __loop, Socket<AF, ST>& __socket, void *__buf, size_t __len) {
+		return {__loop, __socket, __buf, __len};
+	}
+
+	template<typename EL, AddressFamily AF, SocketType ST>
+	SendAwaiter<EL, Socket<AF, ST>> async_send(EL& __loop, Socket<AF, ST>& __socket, const void *__buf, size_t __len) {
+		return {__loop, __socket, __buf, __len};
+	}
+
+	template<typename EL, AddressFamily AF, SocketType ST>
+	AcceptAwaiter<EL, Socket<AF, ST>> async_accept(EL& __loop, Socket<AF, ST>& __listener) {
+		return {__loop, __listener};
+	}
+
+	template<typename EL>
+	ReadAwaiter<EL> async_read(EL& __loop, File& __file, void *__buf, size_t __len) {
+		return {__loop, __file, __buf, __len};
+	}
+
+	template<typename EL>
+	WriteAwaiter<EL> async_write(EL& __loop, File& __file, const void *__buf, size_t __len) {
+		return {__loop, __file, __buf, __len};
+	}
+
+#ifdef __linux__
+	template<typename EL>
+	TimerAwaiter<EL> async_wait(EL& __loop, Timer& __timer) {
+		return {__loop, __timer};
+	}
+#endif
+
+	// Uses the loop's timer wheel, no fd involved
+	template<typename EL>
+	SleepAwaiter<EL> async_sleep(EL& __loop, uint64_t __delay_ms) {
+		return {__loop, __delay_ms};
+	}
+
+}
+
+#endif
@@ -0,0 +1,475 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <new>
+#include <system_error>
+#include <algorithm>
+#include <utility>
+
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+
+#include "File.hpp"
+
+namespace IODash {
+
+	// What O_DIRECT requires of one file, and a request size that keeps the device busy
+	struct DirectIOAlignment {
+		// Buffer address alignment
+		size_t memory = 4096;
+		// File offset and length alignment, i.e. the logical block size
+		size_t offset = 4096;
+		// Recommended bytes per request, a multiple of offset
+		size_t chunk = 1 << 20;
+
+		// statx(STATX_DIOALIGN) where available (Linux 6.1+), else the logical block size of a block device,
+		// else st_blksize, which is a multiple of it on common file systems.
+		static DirectIOAlignment query(const File& __file) noexcept {
+			DirectIOAlignment ret;
+			struct stat stbuf;
+
+			if (::fstat(__file.fd(), &stbuf))
+				return ret;
+
+			bool known = false;
+			size_t optimal = 0;
+
+#ifdef STATX_DIOALIGN
+			struct statx stx;
+			if (!::statx(__file.fd(), "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) && (stx.stx_mask & STATX_DIOALIGN) && stx.stx_dio_offset_align) {
+				ret.memory = stx.stx_dio_mem_align;
+				ret.offset = stx.stx_dio_offset_align;
+				known = true;
+			}
+#endif
+
+#ifdef __linux__
+			if (S_ISBLK(stbuf.st_mode)) {
+				// BLKSSZGET and BLKIOOPT, <linux/fs.h> clashes with glibc's headers
+				int sector_size = 0;
+				if (!known && !::ioctl(__file.fd(), _IO(0x12, 104), &sector_size) && sector_size > 0) {
+					ret.memory = ret.offset = sector_size;
+					known = true;
+				}
+
+				unsigned int io_opt = 0;
+				if (!::ioctl(__file.fd(), _IO(0x12, 121), &io_opt))
+					optimal = io_opt;
+			}
+#endif
+
+			if (!known && stbuf.st_blksize > 0)
+				ret.memory = ret.offset = stbuf.st_blksize;
+
+			// posix_memalign() wants at least a pointer's alignment
+			ret.memory = std::max(ret.memory, sizeof(void *));
+
+			// Big requests amortize the per request cost, O_DIRECT gets no help from kernel read-ahead or write-back
+			size_t chunk = std::max<size_t>(1 << 20, optimal);
+			ret.chunk = (chunk + ret.offset - 1) / ret.offset * ret.offset;
+
+			return ret;
+		}
+	};
+
+	// Fixed size buffers aligned for O_DIRECT, recycled instead of freed. Not thread safe, must outlive its buffers.
+	class AlignedBufferPool {
+	public:
+		// Goes back to its pool when destroyed
+		class Buffer {
+		protected:
+			friend class AlignedBufferPool;
+
+			AlignedBufferPool *pool_ = nullptr;
+			uint8_t *data_ = nullptr;
+
+			Buffer(AlignedBufferPool *__pool, void *__data) noexcept : pool_(__pool), data_((uint8_t *)__data) {
+
+			}
+
+		public:
+			Buffer() noexcept = default;
+
+			Buffer(const Buffer&) = delete;
+			Buffer& operator=(const Buffer&) = delete;
+
+			Buffer(Buffer&& o) noexcept : pool_(o.pool_), data_(std::exchange(o.data_, nullptr)) {
+
+			}
+
+			Buffer& operator=(Buffer&& o) noexcept {
+				if (this != &o) {
+					release();
+					pool_ = o.pool_;
+					data_ = std::exchange(o.data_, nullptr);
+				}
+
+				return *this;
+			}
+
+			~Buffer() {
+				release();
+			}
+
+			void release() noexcept {
+				if (data_)
+					pool_->free_.push_back(data_);
+
+				data_ = nullptr;
+			}
+
+			uint8_t *data() const noexcept {
+				return data_;
+			}
+
+			size_t size() const noexcept {
+				return data_ ? pool_->size_ : 0;
+			}
+
+			explicit operator bool() const noexcept {
+				return data_;
+			}
+		};
+
+	protected:
+		size_t size_, alignment_;
+		std::vector<void *> free_;
+
+	public:
+		AlignedBufferPool(size_t __buffer_size, size_t __alignment = 4096) : size_(__buffer_size), alignment_(__alignment) {
+
+		}
+
+		// Buffers of the recommended chunk size
+		explicit AlignedBufferPool(const DirectIOAlignment& __alignment) : AlignedBufferPool(__alignment.chunk, __alignment.memory) {
+
+		}
+
+		AlignedBufferPool(const AlignedBufferPool&) = delete;
+		AlignedBufferPool& operator=(const AlignedBufferPool&) = delete;
+
+		~AlignedBufferPool() {
+			for (auto it : free_)
+				::free(it);
+		}
+
+		size_t buffer_size() const noexcept {
+			return size_;
+		}
+
+		Buffer acquire() {
+			void *p;
+
+			if (!free_.empty()) {
+				p = free_.back();
+				free_.pop_back();
+			} else if (::posix_memalign(&p, alignment_, size_)) {
+				throw std::bad_alloc();
+			}
+
+			return {this, p};
+		}
+	};
+
+#ifdef O_DIRECT
+	// A File opened with O_DIRECT: reads and writes bypass the page cache, e.g. so a capture stream doesn't evict
+	// data other services need. read_at()/write_at() take any buffer, length and offset. Aligned requests go
+	// straight to the device, the rest through an aligned bounce buffer. File's own pread()/pwrite() are the raw
+	// O_DIRECT calls, and File::close() (through a File&) doesn't write out what append() staged.
+	class DirectFile : public File {
+	protected:
+		DirectIOAlignment alignment_;
+		// Bounce and staging buffers, chunk sized. Created on first use.
+		std::unique_ptr<AlignedBufferPool> pool_;
+
+		// append(): data not written out yet, starting at append_offset_ (block aligned)
+		AlignedBufferPool::Buffer stage_;
+		size_t staged_ = 0;
+		off_t append_offset_ = 0;
+		bool stage_dirty_ = false;
+
+		AlignedBufferPool& __pool() {
+			if (!pool_)
+				pool_ = std::make_unique<AlignedBufferPool>(alignment_);
+
+			return *pool_;
+		}
+
+		size_t __round_down(size_t __n) const noexcept {
+			return __n / alignment_.offset * alignment_.offset;
+		}
+
+		size_t __round_up(size_t __n) const noexcept {
+			return __round_down(__n + alignment_.offset - 1);
+		}
+
+		bool __aligned(const void *__buf, size_t __len, off_t __offset) const noexcept {
+			return !((uintptr_t)__buf % alignment_.memory) && !(__len % alignment_.offset) && !(__offset % alignment_.offset);
+		}
+
+		// Reads a block into __buf, zero filling past EOF
+		bool __read_block(uint8_t *__buf, off_t __offset) {
+			ssize_t rc = File::pread(__buf, alignment_.offset, __offset);
+			if (rc < 0)
+				return false;
+
+			memset(__buf + rc, 0, alignment_.offset - rc);
+			return true;
+		}
+
+		bool __write_fully(const void *__buf, size_t __len, off_t __offset) {
+			size_t written = 0;
+
+			while (written < __len) {
+				ssize_t rc = File::pwrite((const uint8_t *)__buf + written, __len - written, __offset + written);
+
+				if (rc > 0)
+					written += rc;
+				else if (rc == 0 || errno != EINTR)
+					return false;
+			}
+
+			return true;
+		}
+
+	public:
+		DirectFile() = default;
+
+		DirectFile(const DirectFile&) = delete;
+		DirectFile& operator=(const DirectFile&) = delete;
+
+		// Writes out what append() staged. A failure is swallowed, close(std::error_code&) reports it.
+		~DirectFile() {
+			if (fd_ >= 0)
+				flush();
+		}
+
+		// O_DIRECT and O_CLOEXEC are added to __flags. append() starts at the end of the file.
+		void open(const std::string& __path, int __flags = O_RDWR | O_CREAT, mode_t __mode = 0644) {
+			std::error_code ec;
+			open(__path, __flags, __mode, ec);
+			if (ec)
+				throw std::system_error(ec, "failed to open");
+		}
+
+		// Throws std::bad_alloc if the buffer for a partial last block can't be allocated, errors are reported in __ec
+		void open(const std::string& __path, int __flags, mode_t __mode, std::error_code& __ec) {
+			close();
+
+			fd_ = ::open(__path.c_str(), __flags | O_DIRECT | O_CLOEXEC, __mode);
+			if (fd_ < 0) {
+				__ec.assign(errno, std::system_category());
+				return;
+			}
+
+			if (!__adopt(__ec))
+				return;
+
+			alignment_ = DirectIOAlignment::query(*this);
+
+			struct stat stbuf = stat(__ec);
+			if (__ec)
+				return;
+
+			append_offset_ = __round_down(stbuf.st_size);
+			staged_ = stbuf.st_size - append_offset_;
+
+			// The partial last block is kept staged, it's rewritten as it fills up
+			if (staged_) {
+				stage_ = __pool().acquire();
+				if (!__read_block(stage_.data(), append_offset_))
+					__ec.assign(errno, std::system_category());
+			}
+		}
+
+		const DirectIOAlignment& alignment() const noexcept {
+			return alignment_;
+		}
+
+		// A chunk sized aligned buffer: requests from it at aligned offsets skip the bounce buffer
+		AlignedBufferPool::Buffer buffer() {
+			return __pool().acquire();
+		}
+
+		// Reads __len bytes at __offset, fewer only at EOF. -1 with errno set if nothing was read.
+		ssize_t read_at(void *__buf, size_t __len, off_t __offset) {
+			if (__aligned(__buf, __len, __offset))
+				return File::pread(__buf, __len, __offset);
+
+			auto bounce = __pool().acquire();
+			size_t done = 0;
+
+			while (done < __len) {
+				off_t pos = __offset + done;
+				off_t start = __round_down(pos);
+				size_t skip = pos - start;
+				size_t want = std::min(bounce.size(), __round_up(skip + __len - done));
+
+				ssize_t rc = File::pread(bounce.data(), want, start);
+				if (rc < 0) {
+					if (errno == EINTR)
+						continue;
+					return done ? (ssize_t)done : -1;
+				}
+
+				if ((size_t)rc <= skip)
+					break;
+
+				size_t n = std::min((size_t)rc - skip, __len - done);
+				memcpy((uint8_t *)__buf + done, bounce.data() + skip, n);
+				done += n;
+
+				if ((size_t)rc < want)
+					break;
+			}
+
+			return done;
+		}
+
+		// Writes all of __buf at __offset. Partial blocks at either end are read, merged and written back, and the
+		// file is cut back to __offset + __len if that padding extended it. Returns __len, or -1 with errno set.
+		ssize_t write_at(const void *__buf, size_t __len, off_t __offset) {
+			if (__aligned(__buf, __len, __offset))
+				return __write_fully(__buf, __len, __offset) ? (ssize_t)__len : -1;
+
+			struct stat stbuf;
+			if (::fstat(fd_, &stbuf))
+				return -1;
+
+			auto bounce = __pool().acquire();
+			size_t done = 0;
+
+			while (done < __len) {
+				off_t pos = __offset + done;
+				off_t start = __round_down(pos);
+				size_t skip = pos - start;
+				size_t n = std::min(bounce.size() - skip, __len - done);
+				size_t span = __round_up(skip + n);
+
+				if (skip && !__read_block(bounce.data(), start))
+					return -1;
+
+				size_t last = span - alignment_.offset;
+				if ((skip + n) % alignment_.offset && !(skip && !last) && !__read_block(bounce.data() + last, start + last))
+					return -1;
+
+				memcpy(bounce.data() + skip, (const uint8_t *)__buf + done, n);
+
+				if (!__write_fully(bounce.data(), span, start))
+					return -1;
+
+				done += n;
+			}
+
+			off_t end = __offset + __len;
+			if (end > stbuf.st_size && end % alignment_.offset && ::ftruncate(fd_, end))
+				return -1;
+
+			return __len;
+		}
+
+		// Sequential writes, e.g. a capture file: data is staged in an aligned buffer and written out a chunk at a time.
+		// Don't mix with write_at(). Returns __len, or -1 with errno set.
+		ssize_t append(const void *__buf, size_t __len) {
+			if (!stage_)
+				stage_ = __pool().acquire();
+
+			size_t done = 0;
+
+			while (done < __len) {
+				size_t n = std::min(stage_.size() - staged_, __len - done);
+				memcpy(stage_.data() + staged_, (const uint8_t *)__buf + done, n);
+				staged_ += n;
+				done += n;
+				stage_dirty_ = true;
+
+				if (staged_ == stage_.size()) {
+					if (!__write_fully(stage_.data(), staged_, append_offset_))
+						return -1;
+
+					append_offset_ += staged_;
+					staged_ = 0;
+					stage_dirty_ = false;
+				}
+			}
+
+			return __len;
+		}
+
+		// Writes out the staged partial chunk, padded to a block, and sets the file's size to what was appended.
+		// The last partial block stays staged for the next append(). Returns false with errno set on failure.
+		bool flush() {
+			if (!stage_dirty_)
+				return true;
+
+			size_t span = __round_up(staged_);
+			memset(stage_.data() + staged_, 0, span - staged_);
+
+			if (!__write_fully(stage_.data(), span, append_offset_))
+				return false;
+
+			if (span != staged_ && ::ftruncate(fd_, append_offset_ + staged_))
+				return false;
+
+			// Keep only the partial block
+			size_t full = __round_down(staged_);
+			if (full) {
+				memmove(stage_.data(), stage_.data() + full, staged_ - full);
+				append_offset_ += full;
+				staged_ -= full;
+			}
+
+			stage_dirty_ = false;
+			return true;
+		}
+
+		void flush(std::error_code& __ec) noexcept {
+			if (flush())
+				__ec.clear();
+			else
+				__ec.assign(errno, std::system_category());
+		}
+
+		// Writes out what append() staged and closes the fd, also if that fails
+		void close(std::error_code& __ec) noexcept {
+			__ec.clear();
+
+			if (fd_ >= 0)
+				flush(__ec);
+
+			File::close();
+			stage_.release();
+			staged_ = 0;
+			stage_dirty_ = false;
+		}
+
+		// Like the destructor, a failed flush is swallowed
+		void close() noexcept {
+			std::error_code ec;
+			close(ec);
+		}
+	};
+#endif
+
+}
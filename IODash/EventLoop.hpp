@@ -13,17 +13,30 @@
 #pragma once
 
 #include <unordered_map>
+#include <deque>
 #include <functional>
+#include <memory>
+#include <optional>
+#include <type_traits>
+#include <atomic>
 
 #include <poll.h>
 
+#include <sys/uio.h>
+
 #ifdef __linux__
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #endif
 
 #include <portable-endian.h>
 
 #include "Socket.hpp"
+#include "FileDescriptor.hpp"
+#include "IoUring.hpp"
+#include "MPSCQueue.hpp"
+#include "TimerWheel.hpp"
+#include "ComputePool.hpp"
 
 namespace IODash {
 
@@ -32,6 +45,7 @@ namespace IODash {
 		Poll = 1,
 #ifdef __linux__
 		EPoll = 2,
+		IoUring = 4,
 #endif
 #ifdef __FreeBSD__ // TODO: Other BSDs
 		Kqueue = 3
@@ -43,7 +57,18 @@ namespace IODash {
 
 		In = 0x1, Out = 0x2, Error = 0x4, Hangup = 0x8,
 
-		All = In | Out | Error | Hangup
+		All = In | Out | Error | Hangup,
+
+		// Peer shut down its writing half (EPOLLRDHUP). Opt-in, not part of All: it comes along with In, which a
+		// handler registered for All wouldn't match anymore.
+		ReadHangup = 0x10,
+
+		// Trigger modes, only meaningful for add() and modify(). Level-triggered if neither is set.
+		// OneShot registrations are disabled after one event until rearm() or modify().
+		// Edge-triggered falls back to level-triggered on the poll backend.
+		EdgeTriggered = 0x40, OneShot = 0x80,
+
+		TriggerMask = EdgeTriggered | OneShot
 	};
 
 
@@ -88,279 +113,2365 @@ namespace IODash {
 		return x;
 	}
 
-	template<EventBackend EB, typename UD = int>
+	// H: optional handler type called directly for every event, e.g. a struct with
+	// operator()(EventLoop&, File&, EventType, UD&). Inlined, no type erasure involved.
+	template<EventBackend EB, typename UD = int, typename H = void>
 	class EventLoop {
+	public:
+		using Handler = std::function<void(EventLoop&, File&, EventType, UD&)>;
+
+		// MSG_ZEROCOPY sends of one socket still referenced by the kernel, see send_zerocopy()
+		struct ZeroCopy {
+			struct Pending {
+				uint32_t id;
+				std::function<void(EventLoop&, bool, std::error_code)> release;
+			};
+
+			// The kernel's per-socket counter: ids are given to successful sends in order, starting at 0
+			uint32_t next_id = 0;
+			// False if SO_ZEROCOPY is unsupported, sends are plain copies then
+			bool supported = true;
+			std::deque<Pending> pending;
+			// First error queued by something other than a send (an ICMP error...), see zerocopy_error()
+			std::error_code error;
+		};
+
+		// How the loop holds a watched fd
+		enum class Hold : uint8_t {
+			// FdView: someone else's, never closed by the loop
+			View,
+			// UniqueFd: closed by del() and the loop's destructor
+			Unique,
+			// File: the loop keeps a reference in shared_files, closed when the last one is gone
+			Shared
+		};
+
+		// One per fd number, so only what every event needs lives here. The rest is kept on the side: the File of
+		// Shared objects in shared_files, zerocopy state in zerocopy_state, deferred changes in dirty_fds.
+		struct Slot {
+			// Per-registration handler, takes precedence over everything else
+			Handler handler;
+			UD user_data{};
+			uint32_t generation = 0;
+			// Index into the backend's own table, if it keeps one (Poll's pollfd array). io_uring's poll flags.
+			uint32_t backend_index = 0;
+			EventType events = EventType::None;
+			Hold hold = Hold::View;
+			bool active = false;
+			// False while a OneShot registration waits for rearm(), or an io_uring poll is not in flight
+			bool armed = false;
+			// Registered by the loop itself, hidden from for_each_watched() and watched_count()
+			bool internal = false;
+			// Has an entry in zerocopy_state, created by the first send_zerocopy()
+			bool zerocopy = false;
+			// Whether the backend knows the fd, false while an add() is deferred
+			bool lower_added = false;
+			// In dirty_fds, and whether a OneShot must be rearmed even if its events didn't change
+			bool dirty = false;
+			bool rearm_pending = false;
+		};
+
 	private:
 
 	protected:
-		std::unordered_map<int, std::tuple<File, EventType, UD>> watched_fds;
-		std::function<void(EventLoop&, File&, EventType, UD&)> event_handlers[(uint8_t)EventType::All+1];
+		// Slot table indexed by fd. Pages never move, so File& and UD& handed to handlers stay valid while it grows.
+		static constexpr unsigned slot_page_shift = 10;
+		static constexpr uint32_t slot_page_mask = (1U << slot_page_shift) - 1;
+		// Keeps tokens clear of the bits backends use for their own tagging
+		static constexpr uint32_t generation_mask = 0x1fffffff;
+		// Every event bit, ReadHangup included
+		static constexpr EventType event_mask = EventType::All | EventType::ReadHangup;
+
+		std::vector<std::unique_ptr<Slot[]>> watched_fds;
+		size_t watched_count_ = 0;
+		// Same pages as watched_fds, only allocated for pages that have Shared objects
+		std::vector<std::unique_ptr<File[]>> shared_files;
+		std::unordered_map<int, ZeroCopy> zerocopy_state;
+
+		Handler event_handlers[(uint8_t)event_mask+1];
+		// For every event combination, bit i is set if event_handlers[i] exists and should be called
+		uint32_t event_handler_masks[(uint8_t)event_mask+1] = {0};
+
+		Slot *dispatching_slot = nullptr;
+		// The per-fd handler running now, moved out of dispatching_slot
+		Handler *dispatching_handler = nullptr;
+		bool handler_replaced = false;
+
+		// post() mailbox. The eventfd (a pipe elsewhere) is only written when the loop isn't already woken up.
+		MPSCQueue<std::function<void(EventLoop&)>> posted;
+		std::atomic<bool> wakeup_pending{false};
+		File wakeup_rd, wakeup_wr;
+
+		struct NoHandler {};
+		std::conditional_t<std::is_void_v<H>, NoHandler, std::optional<H>> static_handler;
 
 		std::function<void(EventLoop&)> handler_post_events;
 		std::function<void(EventLoop&)> handler_idle;
 
-		bool run_ = false;
-
-		virtual void __lower_add(int __fd, EventType __events) {
+		TimerWheel<EventLoop&> timers;
 
+		// See set_deferred_changes()
+		bool deferred_changes = false;
+		// What the backend knew about each fd before its first deferred change
+		struct DirtyFd {
+			int fd;
+			EventType lower_events;
+			uint32_t lower_generation;
 		};
+		std::vector<DirtyFd> dirty_fds;
+		std::vector<File> pending_close;
+		std::vector<UniqueFd> pending_close_fds;
+		// See on_change_error()
+		std::function<void(EventLoop&, File&, UD&, std::error_code)> handler_change_error;
+
+		// Upper bound of a single wait, so the idle handler still gets called regularly
+		static constexpr int max_wait_ms = 5000;
+
+		// Set by stop(), consumed by the run() it stops. Never set by run() itself, so a stop() that comes before
+		// run() started isn't lost: that run() returns right away.
+		std::atomic<bool> stop_requested{false};
+
+		// Checked once per iteration, the RMW only happens when a stop is pending
+		bool __stopping() noexcept {
+			return stop_requested.load(std::memory_order_relaxed) && stop_requested.exchange(false, std::memory_order_acq_rel);
+		}
 
-		virtual void __lower_mod(int __fd, EventType __events) {
+		// Regular file I/O that can't complete right away runs here, created on first use.
+		// Declared last: it's joined first on destruction, while post() still works.
+		size_t blocking_threads = 4;
+		std::vector<std::function<void(EventLoop&)>> completed;
+		std::unique_ptr<ComputePool> blocking_pool;
 
+		// __token is what the backend hands to the kernel: generation << 32 | fd
+		virtual std::error_code __lower_add(int /* __fd */, EventType /* __events */, uint64_t /* __token */) {
+			return {};
 		};
 
-		virtual void __lower_del(int __fd) {
+		virtual std::error_code __lower_mod(int /* __fd */, EventType /* __events */, uint64_t /* __token */) {
+			return {};
+		};
 
+		virtual std::error_code __lower_del(int /* __fd */, uint64_t /* __token */) {
+			return {};
 		};
 
-		void __call_event_handler(int __fd, EventType __ev) {
-			auto it = watched_fds.find(__fd);
+		// Called before the change is made to __s: until then the backend knows what the slot says
+		void __mark_dirty(int __fd, Slot& __s) {
+			if (!__s.dirty) {
+				__s.dirty = true;
+				dirty_fds.push_back({__fd, __s.events, __s.generation});
+			}
+		}
+
+		// Tells the backend the net result of the deferred add/modify/del calls. Backends call this before every
+		// wait, and before registering pre-existing objects so none of them is seen twice.
+		void __flush_changes() {
+			// Registrations the backend refused, dropped once everything else is applied
+			std::vector<std::pair<uint64_t, std::error_code>> failed;
 
-			if (it != watched_fds.end()) {
-				for (uint8_t i=0; i<=EventType::All; i++) {
-					if ((i & __ev) == __ev) {
-						if (event_handlers[i]) {
-							event_handlers[i](*this, std::get<0>(it->second), __ev,
-									  std::get<2>(it->second));
-						}
+			for (size_t i=0; i<dirty_fds.size(); i++) {
+				int fd = dirty_fds[i].fd;
+				Slot &s = *__slot(fd);
+
+				s.dirty = false;
+
+				// Deleted, or deleted and added again
+				std::error_code ec;
+
+				if (s.lower_added && (!s.active || dirty_fds[i].lower_generation != s.generation)) {
+					ec = __lower_del(fd, __token(fd, dirty_fds[i].lower_generation));
+					s.lower_added = false;
+				}
+
+				if (s.active) {
+					if (!s.lower_added) {
+						if (!(ec = __lower_add(fd, s.events, __token(fd, s.generation))))
+							s.lower_added = true;
+					} else if (dirty_fds[i].lower_events != s.events || s.rearm_pending || !s.armed) {
+						ec = __lower_mod(fd, s.events, __token(fd, s.generation));
+					} else {
+						continue;
 					}
 				}
+
+				if (!s.active)
+					continue;
+
+				if (ec) {
+					failed.emplace_back(__token(fd, s.generation), ec);
+					continue;
+				}
+
+				s.rearm_pending = false;
+				s.armed = true;
+			}
+
+			dirty_fds.clear();
+
+			for (auto &it : pending_close)
+				it.close();
+			pending_close.clear();
+			pending_close_fds.clear();
+
+			// The change was made long before, the caller is gone. Rather than leaving a slot the backend doesn't
+			// watch, it's reported to on_change_error() and deleted, as if del() was called.
+			for (auto &it : failed) {
+				Slot *s = __slot_from_token(it.first);
+				if (!s)
+					continue;
+
+				File view;
+				File &file = __file((int)(uint32_t)it.first, *s, view);
+				if (handler_change_error)
+					handler_change_error(*this, file, s->user_data, it.second);
+
+				if (token(file) == it.first)
+					del(file);
 			}
 		}
 
-	public:
-		virtual void run() = 0;
+		int __wait_timeout() const noexcept {
+			if (!completed.empty())
+				return 0;
 
-		void stop() {
-			run_ = false;
+			int rc = timers.timeout_ms();
+			return rc < 0 || rc > max_wait_ms ? max_wait_ms : rc;
 		}
 
-		void add(const File& __target, EventType __events = EventType::All, const UD& __user_data = {}) {
-			__lower_add(__target.fd(), __events);
-			watched_fds.insert({__target.fd(), {__target, __events, __user_data}});
+		// Fires due timers and calls the post events or idle handler, depending on whether anything happened
+		void __after_wait(bool __had_events) {
+			if (!completed.empty()) {
+				// Handlers may start more I/O that completes inline, that goes to the next iteration
+				auto batch = std::move(completed);
+				completed.clear();
+
+				for (auto &it : batch)
+					it(*this);
+
+				__had_events = true;
+			}
+
+			size_t fired = timers.advance(*this);
+
+			if (__had_events) {
+				if (handler_post_events)
+					handler_post_events(*this);
+			} else if (!fired) {
+				if (handler_idle)
+					handler_idle(*this);
+			}
 		}
 
-		void modify(const File& __target, EventType __events, const UD& __user_data) {
-			__lower_mod(__target.fd(), __events);
-			auto &it = watched_fds[__target.fd()];
-			std::get<1>(it) = __events;
-			std::get<2>(it) = __user_data;
+		Slot *__slot(int __fd) noexcept {
+			size_t page = (size_t)__fd >> slot_page_shift;
+
+			if (__fd < 0 || page >= watched_fds.size() || !watched_fds[page])
+				return nullptr;
+
+			return &watched_fds[page][__fd & slot_page_mask];
 		}
 
-		void modify(const File& __target, EventType __events) {
-			__lower_mod(__target.fd(), __events);
-			auto &it = watched_fds[__target.fd()];
-			std::get<1>(it) = __events;
+		Slot& __slot_alloc(int __fd) {
+			size_t page = (size_t)__fd >> slot_page_shift;
+
+			if (page >= watched_fds.size())
+				watched_fds.resize(page + 1);
+
+			if (!watched_fds[page])
+				watched_fds[page].reset(new Slot[slot_page_mask + 1]);
+
+			return watched_fds[page][__fd & slot_page_mask];
 		}
 
-		void del(const File& __target) {
-			__lower_del(__target.fd());
-			watched_fds.erase(__target.fd());
+		File& __shared_file_alloc(int __fd) {
+			size_t page = (size_t)__fd >> slot_page_shift;
+
+			if (page >= shared_files.size())
+				shared_files.resize(page + 1);
+
+			if (!shared_files[page])
+				shared_files[page].reset(new File[slot_page_mask + 1]);
+
+			return shared_files[page][__fd & slot_page_mask];
 		}
 
-		const std::unordered_map<int, std::tuple<File, EventType, UD>>& watched_objects() const {
-			return watched_fds;
+		// Only for Shared slots
+		File& __shared_file(int __fd) noexcept {
+			return shared_files[(size_t)__fd >> slot_page_shift][__fd & slot_page_mask];
 		}
 
-		template <typename T>
-		void on_event(EventType __events, const T& __func) {
-			event_handlers[__events] = __func;
+		// What handlers get: the loop's own reference to a Shared object, otherwise __view (a File without a
+		// control block) set to the fd. Either way nothing is refcounted.
+		File& __file(int __fd, Slot& __s, File& __view) noexcept {
+			if (__s.hold == Hold::Shared)
+				return __shared_file(__fd);
+
+			__view.fd() = __fd;
+			return __view;
 		}
 
-		void on_post_events(const std::function<void(EventLoop&)>& __func) {
-			handler_post_events = __func;
+		static uint64_t __token(int __fd, uint32_t __generation) noexcept {
+			return ((uint64_t)__generation << 32) | (uint32_t)__fd;
 		}
 
-		void on_idle(const std::function<void(EventLoop&)>& __func) {
-			handler_idle = __func;
+		// nullptr if the fd was deleted (or deleted and re-added) after the event was queued
+		Slot *__slot_from_token(uint64_t __token) noexcept {
+			Slot *s = __slot((int)(uint32_t)__token);
+
+			if (s && s->active && s->generation == (uint32_t)(__token >> 32))
+				return s;
+
+			return nullptr;
 		}
 
-	};
+		template<typename F>
+		void __for_each_slot(const F& __func) {
+			for (size_t page=0; page<watched_fds.size(); page++) {
+				if (watched_fds[page]) {
+					for (uint32_t i=0; i<=slot_page_mask; i++) {
+						auto &s = watched_fds[page][i];
+						if (s.active)
+							__func((int)((page << slot_page_shift) | i), s);
+					}
+				}
+			}
+		}
 
-#ifdef __linux__
-	template<typename T>
-	class EventLoop<EventBackend::EPoll, T> : public EventLoop<EventBackend::Any, T> {
-	protected:
-		int fd_poll = -1;
+		void __call_event_handler(uint64_t __token, EventType __ev) {
+			Slot *s = __slot_from_token(__token);
 
-		EventType __translate_events_to(int __epoll_events) {
-			EventType ret = EventType::None;
+			if (s) {
+				// Some backends report conditions that weren't asked for (io_uring always reports POLLRDHUP)
+				__ev &= s->events | EventType::Error | EventType::Hangup;
 
-			if (__epoll_events & EPOLLIN)
-				ret |= EventType::In;
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+				if (s->zerocopy && (__ev & EventType::Error)) {
+					if (!(s = __zerocopy_complete(__token, __ev)))
+						return;
+				}
+#endif
 
-			if (__epoll_events & EPOLLOUT)
-				ret |= EventType::Out;
+				if (__ev == EventType::None)
+					return;
 
-			if (__epoll_events & EPOLLERR)
-				ret |= EventType::Error;
+				File view;
+				File &file = __file((int)(uint32_t)__token, *s, view);
 
-			if (__epoll_events & EPOLLHUP)
-				ret |= EventType::Hangup;
+				if (s->handler) {
+					// Moved out while running, so del() or on_event() from inside can't destroy it under our feet.
+					// Put back by the guard, also when the handler throws.
+					struct Dispatching {
+						EventLoop& loop;
+						Slot *s;
+						uint32_t generation;
+						Handler h;
 
-			return ret;
+						~Dispatching() {
+							loop.dispatching_slot = nullptr;
+							loop.dispatching_handler = nullptr;
+
+							if (s->active && s->generation == generation && !loop.handler_replaced)
+								s->handler = std::move(h);
+						}
+					} d{*this, s, s->generation, std::move(s->handler)};
+
+					dispatching_slot = s;
+					dispatching_handler = &d.h;
+					handler_replaced = false;
+					d.h(*this, file, __ev, s->user_data);
+					return;
+				}
+
+				__call_shared_handlers(file, __ev, s->user_data);
+			}
 		}
 
-		int __translate_events_from(EventType __events) {
-			int ret = 0;
+		// The handlers for objects without their own
+		void __call_shared_handlers(File& __file, EventType __ev, UD& __user_data) {
+			if constexpr (!std::is_void_v<H>) {
+				if (static_handler) {
+					(*static_handler)(*this, __file, __ev, __user_data);
+					return;
+				}
+			}
 
-			if (__events & EventType::In)
-				ret |= EPOLLIN;
+			for (uint32_t mask = event_handler_masks[__ev]; mask; mask &= mask - 1)
+				event_handlers[__builtin_ctz(mask)](*this, __file, __ev, __user_data);
+		}
 
-			if (__events & EventType::Out)
-				ret |= EPOLLOUT;
+		void __update_handler_masks() {
+			for (uint8_t ev=0; ev<=event_mask; ev++) {
+				event_handler_masks[ev] = 0;
 
-			if (__events & EventType::Error)
-				ret |= EPOLLERR;
+				for (uint8_t i=0; i<=event_mask; i++) {
+					if ((i & ev) == ev && event_handlers[i])
+						event_handler_masks[ev] |= 1U << i;
+				}
+			}
+		}
 
-			if (__events & EventType::Hangup)
-				ret |= EPOLLHUP;
+		ComputePool& __blocking_pool() {
+			if (!blocking_pool)
+				blocking_pool = std::make_unique<ComputePool>(blocking_threads);
 
-			return ret;
+			return *blocking_pool;
 		}
 
-		void __add_pre() {
-			for (auto &it : EventLoop<EventBackend::Any, T>::watched_fds) {
-				epoll_event ev;
-				ev.data.fd = it.first;
-				ev.events = __translate_events_from(std::get<1>(it.second));
+		// Repeats __io(pos) (a pread or pwrite at pos) until __len is reached, EOF, or an error. Returns {transferred, errno}.
+		template<typename IO>
+		static std::pair<size_t, int> __blocking_transfer(size_t __done, size_t __len, const IO& __io) noexcept {
+			while (__done < __len) {
+				ssize_t rc = __io(__done);
+
+				if (rc > 0)
+					__done += rc;
+				else if (rc == 0)
+					break;
+				else if (errno != EINTR)
+					return {__done, errno};
+			}
 
-				if (epoll_ctl(fd_poll, EPOLL_CTL_ADD, ev.data.fd, &ev))
-					throw std::system_error(errno, std::system_category(), "EPOLL_CTL_ADD");
+			return {__done, 0};
+		}
+
+		// A registration shared with transfer() or async_connect() while it waits on that object, and what to restore afterwards
+		struct Borrowed {
+			bool active = false;
+			// Token of the borrowed (or temporary) registration, 0 if it disappeared meanwhile
+			uint64_t token = 0;
+			bool watched = false;
+			EventType events = EventType::None;
+			Handler handler;
+		};
+
+		void __borrow(const File& __target, EventType __events, const Handler& __handler, Borrowed& __b) {
+			if (__b.active)
+				return;
+
+			Slot *s = __slot(__target.fd());
+			__b.watched = s && s->active;
+
+			if (__b.watched) {
+				__b.events = s->events;
+				__b.handler = s == dispatching_slot ? *dispatching_handler : s->handler;
+
+				// The owner keeps getting what it asked for, in its trigger mode. Except for OneShot: it may not be
+				// armed, so it gets nothing until __give_back() re-arms it.
+				EventType shared = __b.events & EventType::OneShot ? EventType::None : __b.events & event_mask;
+				EventType mode = __b.events & EventType::EdgeTriggered;
+
+				on_event(__target, [__events, __handler, shared, owner = __b.handler](EventLoop& __l, File& __file, EventType __ev, UD& __ud){
+					uint64_t t = __l.token(__file);
+					EventType mine = __ev & (__events | EventType::Error | EventType::Hangup);
+					EventType theirs = __ev & (shared | EventType::Error | EventType::Hangup);
+
+					if (mine)
+						__handler(__l, __file, mine, __ud);
+
+					// Still delivered if __handler gave the registration back, unless it was deleted
+					if (!theirs || !shared || __l.token(__file) != t)
+						return;
+
+					if (owner)
+						owner(__l, __file, theirs, __ud);
+					else
+						__l.__call_shared_handlers(__file, theirs, __ud);
+				});
+				modify(__target, __events | shared | mode);
+			} else {
+				add(FdView(__target), __events, UD{}, __handler);
 			}
+
+			__b.token = token(__target);
+			__b.active = true;
 		}
 
-		virtual void __lower_add(int __fd, EventType __events) override {
-			if (fd_poll > 0) {
-				epoll_event ev;
-				ev.data.fd = __fd;
-				ev.events = __translate_events_from(__events);
+		void __give_back(const File& __target, Borrowed& __b) {
+			if (!__b.active)
+				return;
 
-				if (epoll_ctl(fd_poll, EPOLL_CTL_ADD, __fd, &ev))
-					throw std::system_error(errno, std::system_category(), "EPOLL_CTL_ADD");
+			__b.active = false;
+
+			// del()'ed by someone else meanwhile, nothing to restore
+			if (token(__target) != __b.token)
+				return;
+
+			if (__b.watched) {
+				on_event(__target, __b.handler);
+				modify(__target, __b.events);
+				__b.handler = nullptr;
+			} else {
+				del(__unowned_file(__target.fd()));
 			}
 		}
 
-		virtual void __lower_mod(int __fd, EventType __events) override {
-			if (fd_poll > 0) {
-				epoll_event ev;
-				ev.data.fd = __fd;
-				ev.events = __translate_events_from(__events);
+		struct Connect {
+			// Not owned
+			File socket;
+			Borrowed reg;
+			uint64_t timer = 0;
+			bool done = false;
+			std::function<void(EventLoop&, std::error_code)> handler;
+		};
+
+		// Starts connecting __fd (non-blocking) to __addr. __handler runs once, never before this returns, unless
+		// __connect_cancel() comes first. __timeout_ms: 0 for none.
+		std::shared_ptr<Connect> __connect(int __fd, const SocketAddress<AddressFamily::Any>& __addr, uint64_t __timeout_ms, std::function<void(EventLoop&, std::error_code)> __handler) {
+			auto c = std::make_shared<Connect>();
+			c->socket = __unowned_file(__fd);
+			c->handler = std::move(__handler);
+
+			// Exact lengths, some systems reject sockaddr_storage sized ones
+			socklen_t len = __addr.family() == AddressFamily::IPv4 ? sizeof(sockaddr_in) :
+					__addr.family() == AddressFamily::IPv6 ? sizeof(sockaddr_in6) : __addr.size();
+
+			int err = ::connect(__fd, __addr.raw(), len) == 0 ? 0 : errno;
+
+			if (err != EINPROGRESS && err != EINTR) {
+				c->done = true;
+				completed.emplace_back([c, err](EventLoop& __l){
+					c->handler(__l, std::error_code(err, std::system_category()));
+				});
+				return c;
+			}
+
+			__borrow(c->socket, EventType::Out, [c](EventLoop& __l, File& __file, EventType, UD&){
+				Socket<AddressFamily::Any, SocketType::Stream> so;
+				so.fd() = __file.fd();
+				__l.__connect_finish(c, so.connect_error());
+			}, c->reg);
+
+			if (__timeout_ms) {
+				c->timer = add_timer(__timeout_ms, [c](EventLoop& __l){
+					c->timer = 0;
+					__l.__connect_finish(c, std::error_code(ETIMEDOUT, std::system_category()));
+				});
+			}
+
+			return c;
+		}
+
+		void __connect_cancel(const std::shared_ptr<Connect>& __c) {
+			if (__c->done)
+				return;
+
+			__c->done = true;
+
+			if (__c->timer)
+				cancel_timer(__c->timer);
+
+			__give_back(__c->socket, __c->reg);
+		}
+
+		void __connect_finish(const std::shared_ptr<Connect>& __c, const std::error_code& __ec) {
+			if (__c->done)
+				return;
+
+			__connect_cancel(__c);
+			__c->handler(*this, __ec);
+		}
+
+		// One dial(): attempts race, a new one starts every stagger_ms or as soon as one fails (RFC 8305)
+		struct Dial {
+			struct Attempt {
+				UniqueFd fd;
+				size_t candidate;
+				std::shared_ptr<Connect> connect;
+			};
+
+			std::vector<SocketAddress<AddressFamily::Any>> candidates;
+			size_t next = 0;
+			std::vector<Attempt> attempts;
+			uint64_t stagger_ms;
+			uint64_t stagger_timer = 0, deadline_timer = 0;
+			bool done = false;
+			std::error_code last_error;
+			std::function<void(EventLoop&, UniqueFd, const SocketAddress<AddressFamily::Any>&, std::error_code)> handler;
+		};
+
+		// Alternates address families, starting with the first candidate's, keeping the order within each
+		static std::vector<SocketAddress<AddressFamily::Any>> __interleave(const std::vector<SocketAddress<AddressFamily::Any>>& __addrs) {
+			std::vector<SocketAddress<AddressFamily::Any>> first, second, ret;
 
-				if (epoll_ctl(fd_poll, EPOLL_CTL_MOD, __fd, &ev))
-					throw std::system_error(errno, std::system_category(), "EPOLL_CTL_MOD");
+			if (__addrs.empty())
+				return ret;
+
+			for (auto &it : __addrs)
+				(it.family() == __addrs[0].family() ? first : second).push_back(it);
+
+			for (size_t i=0; i<first.size() || i<second.size(); i++) {
+				if (i < first.size())
+					ret.push_back(first[i]);
+				if (i < second.size())
+					ret.push_back(second[i]);
 			}
+
+			return ret;
 		}
 
-		virtual void __lower_del(int __fd) override {
-			if (fd_poll > 0) {
-				if (epoll_ctl(fd_poll, EPOLL_CTL_DEL, __fd, nullptr))
-					throw std::system_error(errno, std::system_category(), "EPOLL_CTL_DEL");
+		void __dial_end(const std::shared_ptr<Dial>& __d, size_t __winner, const std::error_code& __ec) {
+			__d->done = true;
+
+			if (__d->stagger_timer)
+				cancel_timer(__d->stagger_timer);
+			if (__d->deadline_timer)
+				cancel_timer(__d->deadline_timer);
+
+			UniqueFd fd;
+			SocketAddress<AddressFamily::Any> addr;
+			addr.reset();
+
+			// The losers are closed when attempts goes away
+			for (auto &it : __d->attempts) {
+				__connect_cancel(it.connect);
+
+				if (it.candidate == __winner) {
+					fd = std::move(it.fd);
+					addr = __d->candidates[it.candidate];
+				}
 			}
+
+			__d->attempts.clear();
+			__d->handler(*this, std::move(fd), addr, __ec);
 		}
 
-	public:
-		virtual void run() override {
-			EventLoop<EventBackend::Any, T>::run_ = true;
-			fd_poll = epoll_create(42);
-			__add_pre();
+		void __dial_next(const std::shared_ptr<Dial>& __d) {
+			if (__d->stagger_timer) {
+				cancel_timer(__d->stagger_timer);
+				__d->stagger_timer = 0;
+			}
 
-			epoll_event evs[128];
-			while (EventLoop<EventBackend::Any, T>::run_) {
-				int rc = epoll_wait(fd_poll, evs, 128, 5000);
+			while (__d->next < __d->candidates.size()) {
+				size_t idx = __d->next++;
+				auto &addr = __d->candidates[idx];
+
+				int type = SOCK_STREAM;
+#ifdef SOCK_NONBLOCK
+				type |= SOCK_NONBLOCK | SOCK_CLOEXEC;
+#endif
+				UniqueFd fd(::socket((int)addr.family(), type, 0));
+
+				if (!fd) {
+					__d->last_error.assign(errno, std::system_category());
+					continue;
+				}
+
+#ifndef SOCK_NONBLOCK
+				::fcntl(fd.fd(), F_SETFL, ::fcntl(fd.fd(), F_GETFL) | O_NONBLOCK);
+#endif
+
+				auto c = __connect(fd.fd(), addr, 0, [__d, idx](EventLoop& __l, std::error_code __ec){
+					__l.__dial_attempt_done(__d, idx, __ec);
+				});
+
+				__d->attempts.push_back({std::move(fd), idx, std::move(c)});
+
+				if (__d->next < __d->candidates.size()) {
+					__d->stagger_timer = add_timer(__d->stagger_ms, [__d](EventLoop& __l){
+						__d->stagger_timer = 0;
+						__l.__dial_next(__d);
+					});
+				}
+
+				return;
+			}
+
+			if (__d->attempts.empty())
+				__dial_end(__d, SIZE_MAX, __d->last_error ? __d->last_error : std::error_code(EHOSTUNREACH, std::system_category()));
+		}
+
+		void __dial_attempt_done(const std::shared_ptr<Dial>& __d, size_t __candidate, const std::error_code& __ec) {
+			if (__d->done)
+				return;
+
+			if (!__ec) {
+				__dial_end(__d, __candidate, __ec);
+				return;
+			}
+
+			__d->last_error = __ec;
+
+			auto &a = __d->attempts;
+			for (size_t i=0; i<a.size(); i++) {
+				if (a[i].candidate == __candidate) {
+					a.erase(a.begin() + i);
+					break;
+				}
+			}
+
+			// Don't wait for the stagger delay, the next candidate goes right away
+			__dial_next(__d);
+		}
+
+#ifdef __linux__
+		struct Transfer {
+			File in, out;
+			off_t offset;
+			size_t remaining, done = 0;
+			std::unique_ptr<Splicer> splicer;
+			Borrowed in_reg, out_reg;
+			std::function<void(EventLoop&, size_t, std::error_code)> handler;
+		};
+
+		// Returns the side to wait for: In, Out, or None when finished (__ec set on failure)
+		EventType __transfer_step(Transfer& __t, std::error_code& __ec) {
+			__ec.clear();
+
+			SigPipeBlocker no_sigpipe;
+
+			while (__t.remaining) {
+				size_t chunk = std::min(__t.remaining, (size_t)1 << 30);
+				off_t *offset = __t.offset < 0 ? nullptr : &__t.offset;
+				ssize_t rc = __t.splicer ? __t.splicer->transfer(__t.in, offset, __t.out, chunk) : __t.out.sendfile(__t.in, offset, chunk);
 
 				if (rc > 0) {
-					for (uint32_t i=0; i<rc; i++) {
-						auto &cur_ev = evs[i];
-						EventLoop<EventBackend::Any, T>::__call_event_handler(cur_ev.data.fd, __translate_events_to(cur_ev.events));
-					}
-					if (EventLoop<EventBackend::Any, T>::handler_post_events)
-						EventLoop<EventBackend::Any, T>::handler_post_events(*this);
+					__t.done += rc;
+					__t.remaining -= rc;
 				} else if (rc == 0) {
-					if (EventLoop<EventBackend::Any, T>::handler_idle)
-						EventLoop<EventBackend::Any, T>::handler_idle(*this);
-				} else if (rc < 0) {
-					if (errno != EINTR)
-						throw std::system_error(errno, std::system_category(), "epoll_wait");
+					break;
+				} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					return __t.splicer && !__t.splicer->buffered() ? EventType::In : EventType::Out;
+				} else if (errno != EINTR) {
+					__ec.assign(errno, std::system_category());
+					break;
 				}
 			}
 
+			return EventType::None;
+		}
+
+		void __transfer_continue(const std::shared_ptr<Transfer>& __t) {
+			std::error_code ec;
+			__transfer_wait(__t, __transfer_step(*__t, ec), ec);
+		}
+
+		void __transfer_wait(const std::shared_ptr<Transfer>& __t, EventType __wait, const std::error_code& __ec) {
+			Handler resume = [__t](EventLoop& __l, File&, EventType, UD&){
+				__l.__transfer_continue(__t);
+			};
+
+			if (__wait == EventType::In) {
+				__give_back(__t->out, __t->out_reg);
+				__borrow(__t->in, EventType::In, resume, __t->in_reg);
+			} else if (__wait == EventType::Out) {
+				__give_back(__t->in, __t->in_reg);
+				__borrow(__t->out, EventType::Out, resume, __t->out_reg);
+			} else {
+				__give_back(__t->in, __t->in_reg);
+				__give_back(__t->out, __t->out_reg);
+				__t->handler(*this, __t->done, __ec);
+			}
 		}
-	};
 #endif
 
-	template<typename T>
-	class EventLoop<EventBackend::Poll, T> : public EventLoop<EventBackend::Any, T> {
-	protected:
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+		// Hands the ids of finished sends to __func(release, copied), in order for the usual in-order completions.
+		// Returns true if the queue also held other errors, the first is kept in __zc.error.
+		template<typename F>
+		static bool __zerocopy_drain(int __fd, ZeroCopy& __zc, const F& __func) {
+			// The error queue doesn't depend on the address family or type
+			Socket<AddressFamily::IPv6, SocketType::Stream> so;
+			so.fd() = __fd;
+			bool other = false;
+
+			so.read_zerocopy_completions([&](uint32_t __first, uint32_t __last, bool __copied){
+				auto in_range = [=](uint32_t __id){
+					return (uint32_t)(__id - __first) <= (uint32_t)(__last - __first);
+				};
+
+				auto &p = __zc.pending;
+
+				while (!p.empty() && in_range(p.front().id)) {
+					__func(p.front().release, __copied);
+					p.pop_front();
+				}
 
-		EventType __translate_events_to(int __poll_events) {
-			EventType ret = EventType::None;
+				for (auto it = p.begin(); it != p.end(); ) {
+					if (in_range(it->id)) {
+						__func(it->release, __copied);
+						it = p.erase(it);
+					} else {
+						++it;
+					}
+				}
+			}, [&](const sock_extended_err& __ee){
+				other = true;
+				if (!__zc.error && __ee.ee_errno)
+					__zc.error.assign((int)__ee.ee_errno, std::system_category());
+			});
 
-			if (__poll_events & POLLIN)
-				ret |= EventType::In;
+			return other;
+		}
 
-			if (__poll_events & POLLOUT)
-				ret |= EventType::Out;
+		// An Error event on a socket with zerocopy sends: consumes the completions, and only leaves Error in __ev if
+		// there's a real error left, or the queue held one. Returns the slot, nullptr if a release callback del()'ed it.
+		Slot *__zerocopy_complete(uint64_t __token, EventType& __ev) {
+			int fd = (int)(uint32_t)__token;
+			std::vector<std::pair<std::function<void(EventLoop&, bool, std::error_code)>, bool>> released;
 
-			if (__poll_events & POLLERR)
-				ret |= EventType::Error;
+			bool other = __zerocopy_drain(fd, zerocopy_state[fd], [&](std::function<void(EventLoop&, bool, std::error_code)>& __release, bool __copied){
+				released.emplace_back(std::move(__release), __copied);
+			});
 
-			if (__poll_events & POLLHUP)
-				ret |= EventType::Hangup;
+			pollfd pfd{fd, 0, 0};
+			if (!other && ::poll(&pfd, 1, 0) >= 0 && !(pfd.revents & POLLERR))
+				__ev &= ~EventType::Error;
+
+			for (auto &it : released)
+				it.first(*this, it.second, std::error_code());
+
+			return __slot_from_token(__token);
+		}
+#endif
 
+		// A File without a control block: copying it costs nothing and it never closes the fd
+		static File __unowned_file(int __fd) noexcept {
+			File ret;
+			ret.fd() = __fd;
 			return ret;
 		}
 
-		short __translate_events_from(EventType __events) {
-			short ret = 0;
+		// Registers __fd, the caller sets how it's held. nullptr on failure.
+		Slot *__add(int __fd, EventType __events, const UD& __user_data, std::error_code& __ec) {
+			Slot &s = __slot_alloc(__fd);
 
-			if (__events & EventType::In)
-				ret |= POLLIN;
+			if (s.active) {
+				__ec.assign(EEXIST, std::system_category());
+				return nullptr;
+			}
 
-			if (__events & EventType::Out)
-				ret |= POLLOUT;
+			// Never 0, so a token is never 0 either
+			uint32_t generation = (s.generation + 1) & generation_mask;
+			if (!generation)
+				generation = 1;
+
+			if (deferred_changes) {
+				__mark_dirty(__fd, s);
+			} else {
+				if ((__ec = __lower_add(__fd, __events, __token(__fd, generation))))
+					return nullptr;
+				s.lower_added = true;
+				s.armed = true;
+			}
 
-			if (__events & EventType::Error)
-				ret |= POLLERR;
+			s.events = __events;
+			s.user_data = __user_data;
+			s.generation = generation;
+			s.hold = Hold::View;
+			s.active = true;
+			watched_count_++;
+			__ec.clear();
+			return &s;
+		}
 
-			if (__events & EventType::Hangup)
-				ret |= POLLHUP;
+		void __add_internal(const File& __target, EventType __events, const Handler& __handler) {
+			add(__target, __events, UD{}, __handler);
+			__slot(__target.fd())->internal = true;
+			watched_count_--;
+		}
 
-			return ret;
+		void __wakeup() noexcept {
+			if (!wakeup_pending.exchange(true, std::memory_order_acq_rel)) {
+				uint64_t one = 1;
+				::write(wakeup_wr.fd(), &one, sizeof(one));
+			}
 		}
 
+		void __setup_wakeup() {
+#ifdef __linux__
+			int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			if (fd < 0)
+				throw std::system_error(errno, std::system_category(), "eventfd");
+
+			wakeup_rd = File(fd);
+			wakeup_wr = wakeup_rd;
+#else
+			int fds[2];
+			if (pipe(fds))
+				throw std::system_error(errno, std::system_category(), "pipe");
+
+			for (int fd : fds) {
+				fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+				fcntl(fd, F_SETFD, FD_CLOEXEC);
+			}
+
+			wakeup_rd = File(fds[0]);
+			wakeup_wr = File(fds[1]);
+#endif
+
+			__add_internal(wakeup_rd, EventType::In, [](EventLoop& __loop, File& __fd, EventType, UD&){
+				uint64_t buf[8];
+				while (__fd.read(buf, sizeof(buf)) > 0);
+
+				// Must be an RMW: it synchronizes with the producer that last set the flag, so its element is visible
+				__loop.wakeup_pending.exchange(false, std::memory_order_acq_rel);
+
+				std::function<void(EventLoop&)> func;
+				while (__loop.posted.pop(func))
+					func(__loop);
+			});
+		}
 
 	public:
-		virtual void run() override {
-			EventLoop<EventBackend::Any, T>::run_ = true;
+		EventLoop() {
+			if constexpr (!std::is_void_v<H>) {
+				if constexpr (std::is_default_constructible_v<H>)
+					static_handler.emplace();
+			}
+
+			__setup_wakeup();
+		}
 
-			while (EventLoop<EventBackend::Any, T>::run_) {
-				std::vector<pollfd> pfds;
-				pfds.reserve(EventLoop<EventBackend::Any, T>::watched_fds.size());
+		virtual ~EventLoop() {
+			__for_each_slot([](int __fd, Slot& __s){
+				if (__s.hold == Hold::Unique)
+					::close(__fd);
+			});
+		}
 
-				for (auto &it : EventLoop<EventBackend::Any, T>::watched_fds) {
-					auto &r = pfds.emplace_back();
-					r.fd = it.first;
-					r.events = __translate_events_from(std::get<1>(it.second));
-				}
+		virtual void run() = 0;
 
-				int rc = poll(pfds.data(), pfds.size(), 5000);
+		// Thread safe, wakes the loop up immediately. If the loop isn't running, its next run() returns right away.
+		void stop() {
+			stop_requested.store(true, std::memory_order_release);
+			__wakeup();
+		}
 
-				if (rc > 0) {
-					for (auto &it : pfds) {
-						if (it.revents) {
-							EventLoop<EventBackend::Any, T>::__call_event_handler(it.fd, __translate_events_to(it.revents));
-						}
-					}
-					if (EventLoop<EventBackend::Any, T>::handler_post_events)
-						EventLoop<EventBackend::Any, T>::handler_post_events(*this);
-				} else if (rc == 0) {
-					if (EventLoop<EventBackend::Any, T>::handler_idle)
-						EventLoop<EventBackend::Any, T>::handler_idle(*this);
-				} else if (rc < 0) {
-					if (errno != EINTR && errno != EAGAIN)
-						throw std::system_error(errno, std::system_category(), "poll");
-				}
+		// Thread safe. __func(EventLoop&) runs on the loop's thread during its next iteration.
+		// Everything posted before a wakeup is handled in one batch.
+		void post(std::function<void(EventLoop&)> __func) {
+			posted.push(std::move(__func));
+			__wakeup();
+		}
+
+		void add(const File& __target, EventType __events, const UD& __user_data, const Handler& __handler) {
+			add(__target, __events, __user_data);
+			__slot(__target.fd())->handler = __handler;
+		}
+
+		void add(const File& __target, EventType __events = EventType::All, const UD& __user_data = {}) {
+			std::error_code ec;
+			add(__target, __events, __user_data, ec);
+			if (ec)
+				throw std::system_error(ec, "EventLoop::add");
+		}
+
+		// Hands the caller's reference over to the loop, without touching the refcount. __target is only consumed
+		// on success.
+		void add(File&& __target, EventType __events, const UD& __user_data, const Handler& __handler) {
+			int fd = __target.fd();
+			add(std::move(__target), __events, __user_data);
+			__slot(fd)->handler = __handler;
+		}
+
+		void add(File&& __target, EventType __events = EventType::All, const UD& __user_data = {}) {
+			std::error_code ec;
+			add(std::move(__target), __events, __user_data, ec);
+			if (ec)
+				throw std::system_error(ec, "EventLoop::add");
+		}
+
+		void add(File&& __target, EventType __events, const UD& __user_data, std::error_code& __ec) {
+			int fd = __target.fd();
+
+			if (Slot *s = __add(fd, __events, __user_data, __ec)) {
+				__shared_file_alloc(fd) = std::move(__target);
+				s->hold = Hold::Shared;
+			}
+		}
+
+		// The std::error_code variants here don't throw, except for running out of memory
+		void add(const File& __target, EventType __events, const UD& __user_data, const Handler& __handler, std::error_code& __ec) {
+			add(__target, __events, __user_data, __ec);
+			if (!__ec)
+				__slot(__target.fd())->handler = __handler;
+		}
+
+		// Watches a fd owned by someone else. Nothing is copied or refcounted, del() won't close it.
+		void add(FdView __target, EventType __events, const UD& __user_data, const Handler& __handler) {
+			std::error_code ec;
+			add(__target, __events, __user_data, ec);
+			if (ec)
+				throw std::system_error(ec, "EventLoop::add");
+			__slot(__target.fd())->handler = __handler;
+		}
+
+		void add(FdView __target, EventType __events = EventType::All, const UD& __user_data = {}) {
+			std::error_code ec;
+			add(__target, __events, __user_data, ec);
+			if (ec)
+				throw std::system_error(ec, "EventLoop::add");
+		}
+
+		void add(FdView __target, EventType __events, const UD& __user_data, std::error_code& __ec) {
+			__add(__target.fd(), __events, __user_data, __ec);
+		}
+
+		// Takes ownership of the fd, del() and the loop's destructor close it. No refcount involved.
+		void add(UniqueFd&& __target, EventType __events, const UD& __user_data, const Handler& __handler) {
+			std::error_code ec;
+			add(std::move(__target), __events, __user_data, __handler, ec);
+			if (ec)
+				throw std::system_error(ec, "EventLoop::add");
+		}
+
+		void add(UniqueFd&& __target, EventType __events = EventType::All, const UD& __user_data = {}) {
+			add(std::move(__target), __events, __user_data, nullptr);
+		}
+
+		void add(UniqueFd&& __target, EventType __events, const UD& __user_data, std::error_code& __ec) {
+			add(std::move(__target), __events, __user_data, nullptr, __ec);
+		}
+
+		// __target is only consumed on success
+		void add(UniqueFd&& __target, EventType __events, const UD& __user_data, const Handler& __handler, std::error_code& __ec) {
+			if (Slot *s = __add(__target.fd(), __events, __user_data, __ec)) {
+				s->handler = __handler;
+				s->hold = Hold::Unique;
+				__target.release();
+			}
+		}
+
+		// Shares ownership with __target: the loop keeps a reference until del(). Costs one refcount increment,
+		// see add(File&&) to avoid it.
+		void add(const File& __target, EventType __events, const UD& __user_data, std::error_code& __ec) {
+			int fd = __target.fd();
+
+			if (Slot *s = __add(fd, __events, __user_data, __ec)) {
+				__shared_file_alloc(fd) = __target;
+				s->hold = Hold::Shared;
+			}
+		}
+
+		void modify(const File& __target, EventType __events, const UD& __user_data) {
+			modify(__target, __events);
+			__slot(__target.fd())->user_data = __user_data;
+		}
+
+		void modify(const File& __target, EventType __events) {
+			std::error_code ec;
+			modify(__target, __events, ec);
+			if (ec)
+				throw std::system_error(ec, "EventLoop::modify");
+		}
+
+		void modify(const File& __target, EventType __events, std::error_code& __ec) {
+			int fd = __target.fd();
+			Slot *s = __slot(fd);
+
+			if (!s || !s->active) {
+				__ec.assign(ENOENT, std::system_category());
+				return;
+			}
+
+			if (deferred_changes) {
+				__mark_dirty(fd, *s);
+				if (__events & EventType::OneShot)
+					s->rearm_pending = true;
+			} else {
+				if ((__ec = __lower_mod(fd, __events, __token(fd, s->generation))))
+					return;
+				s->rearm_pending = false;
+				s->armed = true;
+			}
+
+			s->events = __events;
+			__ec.clear();
+		}
+
+		// Re-enables a OneShot registration after it fired
+		void rearm(const File& __target) {
+			std::error_code ec;
+			rearm(__target, ec);
+			if (ec)
+				throw std::system_error(ec, "EventLoop::rearm");
+		}
+
+		void rearm(const File& __target, std::error_code& __ec) {
+			Slot *s = __slot(__target.fd());
+
+			if (!s || !s->active) {
+				__ec.assign(ENOENT, std::system_category());
+				return;
+			}
+
+			modify(__target, s->events, __ec);
+		}
+
+		void del(const File& __target) {
+			std::error_code ec;
+			del(__target, ec);
+			if (ec)
+				throw std::system_error(ec, "EventLoop::del");
+		}
+
+		// For objects added as a FdView or UniqueFd, there's no File to name them by outside their handler
+		void del(FdView __target) {
+			del(__unowned_file(__target.fd()));
+		}
+
+		void del(FdView __target, std::error_code& __ec) {
+			del(__unowned_file(__target.fd()), __ec);
+		}
+
+		// The object is forgotten and closed even if the backend reports an error, e.g. because it was closed already
+		void del(const File& __target, std::error_code& __ec) {
+			int fd = __target.fd();
+			Slot *s = __slot(fd);
+
+			__ec.clear();
+
+			if (!s || !s->active)
+				return;
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+			// Completions already queued are taken while the fd is still open. The kernel may still hold the rest
+			// once the socket is gone: their pages stay pinned, so the memory stays valid, but reusing it may change
+			// what is still being transmitted. They're released after this iteration with ECANCELED.
+			if (s->zerocopy) {
+				auto found = zerocopy_state.find(fd);
+				ZeroCopy zc = std::move(found->second);
+				zerocopy_state.erase(found);
+				s->zerocopy = false;
+
+				__zerocopy_drain(fd, zc, [&](std::function<void(EventLoop&, bool, std::error_code)>& __release, bool __copied){
+					completed.emplace_back([release = std::move(__release), __copied](EventLoop& __l){
+						release(__l, __copied, std::error_code());
+					});
+				});
+
+				for (auto &it : zc.pending)
+					completed.emplace_back([release = std::move(it.release)](EventLoop& __l){
+						release(__l, false, std::error_code(ECANCELED, std::system_category()));
+					});
+			}
+#endif
+
+			if (deferred_changes) {
+				// Keeps the fd number from being reused before the backend forgets about it
+				__mark_dirty(fd, *s);
+				if (s->hold == Hold::Unique)
+					pending_close_fds.emplace_back(fd);
+				else if (s->hold == Hold::Shared)
+					pending_close.push_back(std::move(__shared_file(fd)));
+			} else {
+				if (s->lower_added)
+					__ec = __lower_del(fd, __token(fd, s->generation));
+				s->lower_added = false;
+				if (s->hold == Hold::Unique)
+					::close(fd);
+				else if (s->hold == Hold::Shared) {
+					File &f = __shared_file(fd);
+					f.close();
+					f = File();
+				}
+			}
+
+			s->hold = Hold::View;
+			s->active = false;
+			s->user_data = UD{};
+			s->handler = nullptr;
+			watched_count_--;
+		}
+
+		size_t watched_count() const noexcept {
+			return watched_count_;
+		}
+
+		// When enabled, add/modify/del only record the change. The net result per fd is handed to the backend once,
+		// right before the next wait, so e.g. flipping between In and Out and back within one iteration costs nothing.
+		// del() closes the fd at that point too. The io_uring backend already batches its changes into one submit.
+		// A change the backend refuses then can't be reported to its caller, see on_change_error().
+		void set_deferred_changes(bool __enable = true) {
+			deferred_changes = __enable;
+
+			if (!__enable)
+				__flush_changes();
+		}
+
+		// Names the current registration of __target, 0 if it isn't watched.
+		// Unlike the fd, a token goes stale when the object is deleted, even if the fd number gets reused.
+		uint64_t token(const File& __target) noexcept {
+			int fd = __target.fd();
+			Slot *s = __slot(fd);
+
+			return s && s->active ? __token(fd, s->generation) : 0;
+		}
+
+		// Calls __func(File&, UD&) and returns true if the registration named by __token is still alive
+		template<typename F>
+		bool with_token(uint64_t __token, const F& __func) {
+			Slot *s = __slot_from_token(__token);
+
+			if (!s)
+				return false;
+
+			File view;
+			__func(__file((int)(uint32_t)__token, *s, view), s->user_data);
+			return true;
+		}
+
+		// __func(File&, EventType, UD&) for every watched object
+		template<typename F>
+		void for_each_watched(const F& __func) {
+			__for_each_slot([&](int __fd, Slot& __s){
+				File view;
+				if (!__s.internal)
+					__func(__file(__fd, __s, view), __s.events, __s.user_data);
+			});
+		}
+
+		template <typename T>
+		void on_event(EventType __events, const T& __func) {
+			event_handlers[__events & event_mask] = __func;
+			__update_handler_masks();
+		}
+
+		// Replaces the handler of a watched object, nullptr falls back to the loop wide handlers
+		void on_event(const File& __target, const Handler& __handler) {
+			Slot *s = __slot(__target.fd());
+
+			if (!s || !s->active)
+				throw std::system_error(ENOENT, std::system_category(), "EventLoop::on_event");
+
+			s->handler = __handler;
+			if (s == dispatching_slot)
+				handler_replaced = true;
+		}
+
+		// Only available with a handler type H
+		template<typename HH = H, typename = std::enable_if_t<!std::is_void_v<HH>>>
+		void set_handler(const HH& __handler) {
+			static_handler.emplace(__handler);
+		}
+
+		// With deferred changes, __func(EventLoop&, File&, UD&, std::error_code) is called for every object the
+		// backend refused to add or modify when the changes were applied. The object is deleted right after.
+		void on_change_error(const std::function<void(EventLoop&, File&, UD&, std::error_code)>& __func) {
+			handler_change_error = __func;
+		}
+
+		void on_post_events(const std::function<void(EventLoop&)>& __func) {
+			handler_post_events = __func;
+		}
+
+		void on_idle(const std::function<void(EventLoop&)>& __func) {
+			handler_idle = __func;
+		}
+
+		// Calls __func(EventLoop&) once after __delay_ms, on the loop's thread. Cheap enough for one per connection.
+		// Returns an id for cancel_timer()/reset_timer(), never 0.
+		uint64_t add_timer(uint64_t __delay_ms, const std::function<void(EventLoop&)>& __func) {
+			return timers.schedule(__delay_ms, __func);
+		}
+
+		// Returns false if the timer already fired or was cancelled
+		bool cancel_timer(uint64_t __timer) noexcept {
+			return timers.cancel(__timer);
+		}
+
+		// Pushes a pending timer back to __delay_ms from now, e.g. an idle timeout after activity
+		bool reset_timer(uint64_t __timer, uint64_t __delay_ms) noexcept {
+			return timers.reschedule(__timer, __delay_ms);
+		}
+
+#ifdef __linux__
+		// Zero-copy transfer of __len bytes (SIZE_MAX: until EOF) from __in to __out, driven by the loop: sendfile()
+		// from regular files, splice() through a pipe otherwise (e.g. socket to socket). __offset is where to start
+		// in __in, -1 to use (and advance) its current position. Sockets must be non-blocking. A peer that's gone
+		// fails it with EPIPE, SIGPIPE is blocked while writing to __out.
+		// While it waits, the transfer adds its interest to the registration of the side that would block (or watches
+		// it temporarily). The object's own handler still gets the events it asked for, except a OneShot one: it's
+		// restored and re-armed when done. del()'ing either side meanwhile abandons it. __handler(EventLoop&, size_t transferred, std::error_code) runs on the loop's
+		// thread, never before this returns.
+		template<typename F>
+		void transfer(const File& __in, off_t __offset, size_t __len, const File& __out, F&& __handler) {
+			auto t = std::make_shared<Transfer>();
+			t->in = __in;
+			t->out = __out;
+			t->offset = __offset;
+			t->remaining = __len;
+			t->handler = std::forward<F>(__handler);
+
+			struct stat stbuf;
+			if (::fstat(__in.fd(), &stbuf) || !S_ISREG(stbuf.st_mode))
+				t->splicer = std::make_unique<Splicer>();
+
+			std::error_code ec;
+			EventType wait = __transfer_step(*t, ec);
+
+			if (wait == EventType::None) {
+				completed.emplace_back([t, ec](EventLoop& __l){
+					t->handler(__l, t->done, ec);
+				});
+			} else {
+				__transfer_wait(t, wait, ec);
+			}
+		}
+#endif
+
+		// Connects __socket (made non-blocking) to __addr. __handler(EventLoop&, std::error_code) runs on the loop's
+		// thread when it's done, ETIMEDOUT after __timeout_ms (0: no deadline, the kernel gives up after minutes),
+		// never before this returns. Like transfer(), it shares the socket's registration while waiting, if any.
+		// __socket must stay open until then; on failure it's still the caller's to close.
+		template<AddressFamily AF, SocketType ST, typename F>
+		void async_connect(const Socket<AF, ST>& __socket, const SocketAddress<AF>& __addr, uint64_t __timeout_ms, F&& __handler) {
+			int fd = __socket.fd();
+			::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+			__connect(fd, __addr, __timeout_ms, std::forward<F>(__handler));
+		}
+
+		// Happy Eyeballs (RFC 8305): connects a stream socket to whichever of __addrs answers first. Families
+		// alternate starting with the first address' (list IPv6 first to prefer it), a new attempt starts every
+		// __stagger_ms or as soon as one fails, and the losers are closed. __handler(EventLoop&, UniqueFd,
+		// const SocketAddress<AddressFamily::Any>& connected to, std::error_code) gets the non-blocking connected
+		// socket, or the last error (ETIMEDOUT after __timeout_ms, 0: none). Never called before this returns.
+		template<typename F>
+		void dial(const std::vector<SocketAddress<AddressFamily::Any>>& __addrs, uint64_t __timeout_ms, F&& __handler, uint64_t __stagger_ms = 250) {
+			auto d = std::make_shared<Dial>();
+			d->candidates = __interleave(__addrs);
+			d->stagger_ms = __stagger_ms;
+			d->handler = std::forward<F>(__handler);
+
+			if (__timeout_ms) {
+				d->deadline_timer = add_timer(__timeout_ms, [d](EventLoop& __l){
+					d->deadline_timer = 0;
+					if (!d->done)
+						__l.__dial_end(d, SIZE_MAX, std::error_code(ETIMEDOUT, std::system_category()));
+				});
+			}
+
+			completed.emplace_back([d](EventLoop& __l){
+				if (!d->done)
+					__l.__dial_next(d);
+			});
+		}
+
+		// Watches __socket and drains it with recvmmsg() on each readiness event: up to __max_batches batches, so one busy
+		// socket can't starve the others, readiness brings the loop back for the rest. __handler(EventLoop&,
+		// Socket<AF, ST>&, DatagramBatch<AF>&) is called per batch. __batch must outlive the registration.
+		template<AddressFamily AF, SocketType ST, typename F>
+		void add_batch_reader(const Socket<AF, ST>& __socket, DatagramBatch<AF>& __batch, F&& __handler, const UD& __user_data = {}, size_t __max_batches = 16) {
+			add(__socket, EventType::In, __user_data, [&__batch, handler = std::forward<F>(__handler), __max_batches](EventLoop& __l, File& __file, EventType, UD&) mutable {
+				// Non-owning, the slot holds a plain File
+				Socket<AF, ST> so;
+				so.fd() = __file.fd();
+
+				for (size_t i=0; i<__max_batches; i++) {
+					if (so.recv_batch(__batch) <= 0)
+						break;
+
+					handler(__l, so, __batch);
+
+					// A short batch means the queue is empty, no need for another syscall to see EAGAIN
+					if (__batch.size() < __batch.capacity())
+						break;
+				}
+			});
+		}
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+		// Sends __buf from a socket watched by this loop with MSG_ZEROCOPY, enabling SO_ZEROCOPY first if needed.
+		// __release(EventLoop&, bool copied, std::error_code) is called once the kernel is done with what was sent, __buf
+		// must stay unchanged until then. If __socket is deleted first, the sends not completed yet get ECANCELED.
+		// The kernel reports completions on the error queue, as an Error event the loop consumes before the socket's
+		// handler would see it (so a OneShot registration must be armed to get it). Returns what send()
+		// returns, __release is dropped if nothing was sent. Without kernel support it's a plain send, released
+		// after this iteration. copied: the kernel copied after all (e.g. over loopback), plain send() is cheaper there.
+		template<typename F>
+		ssize_t send_zerocopy(const File& __socket, const void *__buf, size_t __len, F&& __release, int __flags = MSG_NOSIGNAL) {
+			int fd = __socket.fd();
+			Slot *s = __slot(fd);
+
+			if (!s || !s->active)
+				throw std::system_error(ENOENT, std::system_category(), "EventLoop::send_zerocopy");
+
+			auto &zc = zerocopy_state[fd];
+
+			if (!s->zerocopy) {
+				s->zerocopy = true;
+
+				int enable = 1;
+				if (::setsockopt(fd, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)))
+					zc.supported = false;
+			}
+
+			if (!zc.supported || !__len) {
+				ssize_t rc = ::send(fd, __buf, __len, __flags);
+				if (rc >= 0)
+					completed.emplace_back([release = std::forward<F>(__release)](EventLoop& __l) mutable {
+						release(__l, true, std::error_code());
+					});
+				return rc;
+			}
+
+			ssize_t rc = ::send(fd, __buf, __len, __flags | MSG_ZEROCOPY);
+
+			if (rc > 0)
+				zc.pending.push_back({zc.next_id++, std::forward<F>(__release)});
+
+			return rc;
+		}
+
+		// Sends from send_zerocopy() on __socket the kernel hasn't released yet
+		size_t zerocopy_pending(const File& __socket) noexcept {
+			Slot *s = __slot(__socket.fd());
+			return s && s->active && s->zerocopy ? zerocopy_state[__socket.fd()].pending.size() : 0;
+		}
+
+		// Errors share the error queue with the completions, the loop takes them off it. Returns the first one
+		// taken since the last call (the Error event it came with is passed on), and clears it.
+		std::error_code zerocopy_error(const File& __socket) noexcept {
+			Slot *s = __slot(__socket.fd());
+			if (!s || !s->active || !s->zerocopy)
+				return {};
+
+			auto &zc = zerocopy_state[__socket.fd()];
+			std::error_code ret = zc.error;
+			zc.error.clear();
+			return ret;
+		}
+#endif
+
+		// Threads used by async_pread() and friends. Only takes effect before the first one.
+		void set_blocking_threads(size_t __nr_threads) noexcept {
+			blocking_threads = __nr_threads;
+		}
+
+		// Reads __len bytes at __offset, fewer only at EOF. Page cache hits are read right away (preadv2 with
+		// RWF_NOWAIT), the rest by a small blocking I/O pool. __handler(EventLoop&, size_t read, std::error_code)
+		// runs on the loop's thread, never before this returns. __file and __buf must stay valid until then.
+		template<typename F>
+		void async_pread(const File& __file, void *__buf, size_t __len, off_t __offset, F&& __handler) {
+			int fd = __file.fd();
+			size_t done = 0;
+
+#ifdef RWF_NOWAIT
+			iovec iov{__buf, __len};
+			ssize_t rc = ::preadv2(fd, &iov, 1, __offset, RWF_NOWAIT);
+
+			// EAGAIN if it would block, EOPNOTSUPP/ENOSYS without support. A short read may just be partially cached.
+			if (rc >= 0) {
+				done = rc;
+
+				if (done == __len || !rc) {
+					completed.emplace_back([done, handler = std::forward<F>(__handler)](EventLoop& __l) mutable {
+						handler(__l, done, std::error_code());
+					});
+					return;
+				}
+			}
+#endif
+
+			__blocking_pool().submit(*this, [=](){
+				return __blocking_transfer(done, __len, [=](size_t __pos){
+					return ::pread(fd, (uint8_t *)__buf + __pos, __len - __pos, __offset + __pos);
+				});
+			}, [handler = std::forward<F>(__handler)](EventLoop& __l, std::pair<size_t, int> __result, std::exception_ptr) mutable {
+				handler(__l, __result.first, std::error_code(__result.second, std::system_category()));
+			});
+		}
+
+		// Writes all of __buf at __offset on the blocking I/O pool. Same rules as async_pread().
+		template<typename F>
+		void async_pwrite(const File& __file, const void *__buf, size_t __len, off_t __offset, F&& __handler) {
+			int fd = __file.fd();
+
+			__blocking_pool().submit(*this, [=](){
+				return __blocking_transfer(0, __len, [=](size_t __pos){
+					return ::pwrite(fd, (const uint8_t *)__buf + __pos, __len - __pos, __offset + __pos);
+				});
+			}, [handler = std::forward<F>(__handler)](EventLoop& __l, std::pair<size_t, int> __result, std::exception_ptr) mutable {
+				handler(__l, __result.first, std::error_code(__result.second, std::system_category()));
+			});
+		}
+
+		// fsync() (fdatasync() if __datasync) on the blocking I/O pool, then __handler(EventLoop&, std::error_code)
+		template<typename F>
+		void async_fsync(const File& __file, F&& __handler, bool __datasync = false) {
+			int fd = __file.fd();
+
+			__blocking_pool().submit(*this, [=](){
+#ifdef __linux__
+				int rc = __datasync ? ::fdatasync(fd) : ::fsync(fd);
+#else
+				int rc = ::fsync(fd);
+#endif
+				return rc < 0 ? errno : 0;
+			}, [handler = std::forward<F>(__handler)](EventLoop& __l, int __err, std::exception_ptr) mutable {
+				handler(__l, std::error_code(__err, std::system_category()));
+			});
+		}
+
+	};
+
+#ifdef __linux__
+	template<typename T, typename H>
+	class EventLoop<EventBackend::EPoll, T, H> : public EventLoop<EventBackend::Any, T, H> {
+	protected:
+		int fd_poll = -1;
+
+		EventType __translate_events_to(int __epoll_events) {
+			EventType ret = EventType::None;
+
+			if (__epoll_events & EPOLLIN)
+				ret |= EventType::In;
+
+			if (__epoll_events & EPOLLOUT)
+				ret |= EventType::Out;
+
+			if (__epoll_events & EPOLLERR)
+				ret |= EventType::Error;
+
+			if (__epoll_events & EPOLLHUP)
+				ret |= EventType::Hangup;
+
+			if (__epoll_events & EPOLLRDHUP)
+				ret |= EventType::ReadHangup;
+
+			return ret;
+		}
+
+		int __translate_events_from(EventType __events) {
+			int ret = 0;
+
+			if (__events & EventType::In)
+				ret |= EPOLLIN;
+
+			if (__events & EventType::Out)
+				ret |= EPOLLOUT;
+
+			if (__events & EventType::Error)
+				ret |= EPOLLERR;
+
+			if (__events & EventType::Hangup)
+				ret |= EPOLLHUP;
+
+			if (__events & EventType::ReadHangup)
+				ret |= EPOLLRDHUP;
+
+			if (__events & EventType::EdgeTriggered)
+				ret |= EPOLLET;
+
+			if (__events & EventType::OneShot)
+				ret |= EPOLLONESHOT;
+
+			return ret;
+		}
+
+		void __add_pre() {
+			EventLoop<EventBackend::Any, T, H>::__for_each_slot([this](int __fd, auto& __s){
+				epoll_event ev;
+				ev.data.u64 = EventLoop<EventBackend::Any, T, H>::__token(__fd, __s.generation);
+				ev.events = __translate_events_from(__s.events);
+
+				if (epoll_ctl(fd_poll, EPOLL_CTL_ADD, __fd, &ev))
+					throw std::system_error(errno, std::system_category(), "EPOLL_CTL_ADD");
+			});
+		}
+
+		std::error_code __ctl(int __op, int __fd, EventType __events, uint64_t __token) noexcept {
+			if (fd_poll < 0)
+				return {};
+
+			epoll_event ev;
+			ev.data.u64 = __token;
+			ev.events = __translate_events_from(__events);
+
+			if (epoll_ctl(fd_poll, __op, __fd, &ev))
+				return {errno, std::system_category()};
+
+			return {};
+		}
+
+		virtual std::error_code __lower_add(int __fd, EventType __events, uint64_t __token) override {
+			return __ctl(EPOLL_CTL_ADD, __fd, __events, __token);
+		}
+
+		virtual std::error_code __lower_mod(int __fd, EventType __events, uint64_t __token) override {
+			return __ctl(EPOLL_CTL_MOD, __fd, __events, __token);
+		}
+
+		virtual std::error_code __lower_del(int __fd, uint64_t __token) override {
+			return __ctl(EPOLL_CTL_DEL, __fd, EventType::None, __token);
+		}
+
+	public:
+		~EventLoop() {
+			if (fd_poll >= 0)
+				close(fd_poll);
+		}
+
+		virtual void run() override {
+			if (fd_poll < 0) {
+				// Deferred changes must not be applied on top of __add_pre()
+				EventLoop<EventBackend::Any, T, H>::__flush_changes();
+				fd_poll = epoll_create1(EPOLL_CLOEXEC);
+				if (fd_poll < 0)
+					throw std::system_error(errno, std::system_category(), "epoll_create1");
+
+				__add_pre();
+			}
+
+			epoll_event evs[128];
+			while (!EventLoop<EventBackend::Any, T, H>::__stopping()) {
+				EventLoop<EventBackend::Any, T, H>::__flush_changes();
+				int rc = epoll_wait(fd_poll, evs, 128, EventLoop<EventBackend::Any, T, H>::__wait_timeout());
+
+				if (rc > 0) {
+					for (int i=0; i<rc; i++) {
+						auto &cur_ev = evs[i];
+						EventLoop<EventBackend::Any, T, H>::__call_event_handler(cur_ev.data.u64, __translate_events_to(cur_ev.events));
+					}
+				} else if (rc < 0) {
+					if (errno != EINTR)
+						throw std::system_error(errno, std::system_category(), "epoll_wait");
+				}
+
+				EventLoop<EventBackend::Any, T, H>::__after_wait(rc > 0);
+			}
+
+		}
+	};
+
+	// Readiness events use multishot polls with in-place updates: Linux 5.13+. The completion based ops below
+	// need newer kernels, see each of them.
+	template<typename T, typename H>
+	class EventLoop<EventBackend::IoUring, T, H> : public EventLoop<EventBackend::Any, T, H> {
+	protected:
+		// user_data of our own bookkeeping SQEs, their CQEs are never dispatched
+		static constexpr uint64_t ud_internal = 1ULL << 63;
+		// user_data of completion ops: ud_op | generation << 32 | index
+		static constexpr uint64_t ud_op = 1ULL << 62;
+		// Set in the user_data of an fd's poll every other time it's re-added for a trigger mode switch, so a
+		// CQE of the poll that was replaced can be told apart. The slot's backend_index holds the current bit.
+		static constexpr uint64_t ud_epoch = 1ULL << 61;
+
+		// backend_index bits: the epoch above, and whether the poll in the kernel is multishot
+		static constexpr uint32_t poll_epoch = 1, poll_multishot = 2;
+
+		uint64_t __poll_ud(int __fd, uint64_t __token) {
+			return EventLoop<EventBackend::Any, T, H>::__slot(__fd)->backend_index & poll_epoch ? __token | ud_epoch : __token;
+		}
+
+		struct Op {
+			std::function<void(EventLoop&, const io_uring_cqe&)> on_complete;
+			int fd = -1;
+			uint8_t opcode = IORING_OP_NOP;
+			bool multishot = false;
+			bool cancelled = false;
+			// A multishot recv that ran out of provided buffers, waiting in starved_ops
+			bool starved = false;
+			const uint8_t *buf = nullptr;
+			size_t len = 0, done = 0;
+			uint64_t offset = 0;
+			uint32_t fsync_flags = 0;
+			// Same width as slot generations, bits 32-60 of the op's user_data
+			uint32_t generation = 0;
+		};
+
+		std::unique_ptr<IoUring> ring;
+		std::unique_ptr<IoUringBufferRing> buffer_ring;
+		unsigned ring_entries, buffer_count, buffer_size;
+
+		// A deque: ops started from a completion handler don't move the one being called
+		std::deque<Op> ops;
+		std::vector<uint32_t> free_ops;
+		// Resubmitted at the end of a CQE batch once a buffer has been recycled, not right away: the ring would
+		// just be empty again. The previous batch counts too, its recycles may have raced with the -ENOBUFS.
+		std::vector<uint32_t> starved_ops;
+		bool buffers_recycled = false, buffers_recycled_before = false;
+
+		// Edge-triggered registrations use multishot polls, everything else one-shot polls
+		static bool __multishot(EventType __events) {
+			return (__events & EventType::TriggerMask) == EventType::EdgeTriggered;
+		}
+
+		EventType __translate_events_to(int __poll_events) {
+			EventType ret = EventType::None;
+
+			if (__poll_events & POLLIN)
+				ret |= EventType::In;
+
+			if (__poll_events & POLLOUT)
+				ret |= EventType::Out;
+
+			if (__poll_events & POLLERR)
+				ret |= EventType::Error;
+
+			if (__poll_events & POLLHUP)
+				ret |= EventType::Hangup;
+
+#ifdef POLLRDHUP
+			if (__poll_events & POLLRDHUP)
+				ret |= EventType::ReadHangup;
+#endif
+
+			return ret;
+		}
+
+		uint32_t __translate_events_from(EventType __events) {
+			uint32_t ret = 0;
+
+			if (__events & EventType::In)
+				ret |= POLLIN;
+
+			if (__events & EventType::Out)
+				ret |= POLLOUT;
+
+			if (__events & EventType::Error)
+				ret |= POLLERR;
+
+			if (__events & EventType::Hangup)
+				ret |= POLLHUP;
+
+#ifdef POLLRDHUP
+			if (__events & EventType::ReadHangup)
+				ret |= POLLRDHUP;
+#endif
+
+			return ret;
+		}
+
+		void __arm(int __fd, EventType __events, uint64_t __token) {
+			std::error_code ec;
+			if (__arm(__fd, __events, __token, ec))
+				throw std::system_error(ec, "io_uring SQ full");
+		}
+
+		std::error_code __arm(int __fd, EventType __events, uint64_t __token, std::error_code& __ec) noexcept {
+			auto *sqe = ring->get_sqe(__ec);
+			if (!sqe)
+				return __ec;
+
+			auto *s = EventLoop<EventBackend::Any, T, H>::__slot(__fd);
+			s->backend_index = (s->backend_index & poll_epoch) | (__multishot(__events) ? poll_multishot : 0);
+
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->fd = __fd;
+			sqe->poll32_events = __translate_events_from(__events);
+			sqe->len = __multishot(__events) ? IORING_POLL_ADD_MULTI : 0;
+			sqe->user_data = __poll_ud(__fd, __token);
+			return {};
+		}
+
+		// Creates the ring on first use and arms everything added before that
+		IoUring& __ensure_ring() {
+			if (!ring) {
+				// Deferred changes must not be applied on top of arming everything below
+				EventLoop<EventBackend::Any, T, H>::__flush_changes();
+				ring = std::make_unique<IoUring>(ring_entries);
+
+				EventLoop<EventBackend::Any, T, H>::__for_each_slot([this](int __fd, auto& __s){
+					__arm(__fd, __s.events, EventLoop<EventBackend::Any, T, H>::__token(__fd, __s.generation));
+				});
+			}
+
+			return *ring;
+		}
+
+		IoUringBufferRing& __ensure_buffer_ring() {
+			if (!buffer_ring)
+				buffer_ring = std::make_unique<IoUringBufferRing>(__ensure_ring(), 0, buffer_count, buffer_size);
+
+			return *buffer_ring;
+		}
+
+		uint32_t __alloc_op() {
+			uint32_t idx;
+
+			if (free_ops.empty()) {
+				idx = ops.size();
+				ops.emplace_back();
+			} else {
+				idx = free_ops.back();
+				free_ops.pop_back();
+			}
+
+			return idx;
+		}
+
+		void __free_op(uint32_t __idx) {
+			auto &op = ops[__idx];
+			op.on_complete = nullptr;
+			op.cancelled = false;
+			op.starved = false;
+			op.generation = (op.generation + 1) & EventLoop<EventBackend::Any, T, H>::generation_mask;
+			free_ops.push_back(__idx);
+		}
+
+		uint64_t __op_ud(uint32_t __idx) {
+			return ud_op | ((uint64_t)ops[__idx].generation << 32) | __idx;
+		}
+
+		// Whether __ud still refers to the op it was returned for
+		bool __op_live(uint64_t __ud) {
+			uint32_t idx = (uint32_t)__ud;
+			return idx < ops.size() && ops[idx].generation == ((uint32_t)(__ud >> 32) & EventLoop<EventBackend::Any, T, H>::generation_mask);
+		}
+
+		void __recycle_buffer(uint16_t __bid) noexcept {
+			buffer_ring->recycle(__bid);
+			buffers_recycled = true;
+		}
+
+		void __resume_starved_ops() {
+			if (!starved_ops.empty() && (buffers_recycled || buffers_recycled_before)) {
+				auto starved = std::move(starved_ops);
+				starved_ops.clear();
+
+				for (auto idx : starved) {
+					if (ops[idx].starved) {
+						ops[idx].starved = false;
+						__submit_op(idx);
+					}
+				}
+			}
+
+			buffers_recycled_before = buffers_recycled;
+			buffers_recycled = false;
+		}
+
+		void __submit_op(uint32_t __idx) {
+			auto &op = ops[__idx];
+			auto *sqe = __ensure_ring().get_sqe();
+
+			sqe->opcode = op.opcode;
+			sqe->fd = op.fd;
+			sqe->user_data = __op_ud(__idx);
+
+			switch (op.opcode) {
+				case IORING_OP_ACCEPT:
+					sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+					break;
+				case IORING_OP_RECV:
+					sqe->ioprio = IORING_RECV_MULTISHOT;
+					sqe->flags = IOSQE_BUFFER_SELECT;
+					sqe->buf_group = __ensure_buffer_ring().group();
+					break;
+				case IORING_OP_SEND:
+					sqe->addr = (uint64_t)(uintptr_t)(op.buf + op.done);
+					sqe->len = op.len - op.done;
+					sqe->msg_flags = MSG_NOSIGNAL;
+					break;
+				case IORING_OP_READ:
+				case IORING_OP_WRITE:
+					sqe->addr = (uint64_t)(uintptr_t)(op.buf + op.done);
+					sqe->len = op.len - op.done;
+					sqe->off = op.offset + op.done;
+					break;
+				case IORING_OP_FSYNC:
+					sqe->fsync_flags = op.fsync_flags;
+					break;
+				default:
+					break;
+			}
+		}
+
+		void __complete_op(const io_uring_cqe& __cqe) {
+			uint32_t idx = (uint32_t)__cqe.user_data;
+
+			if (!__op_live(__cqe.user_data))
+				return;
+
+			auto &op = ops[idx];
+			bool more = __cqe.flags & IORING_CQE_F_MORE;
+
+			// Short transfers are continued, a read ends at EOF (res == 0)
+			bool resumable = op.opcode == IORING_OP_SEND || op.opcode == IORING_OP_READ || op.opcode == IORING_OP_WRITE;
+
+			if (resumable && __cqe.res > 0) {
+				op.done += __cqe.res;
+				if (op.done < op.len && !op.cancelled) {
+					__submit_op(idx);
+					return;
+				}
+			}
+
+			// Multishot requests end on their own when e.g. the buffer ring runs dry, start a new one. Without
+			// buffers that waits until one comes back.
+			if (op.multishot && !more && !op.cancelled && __cqe.res == -ENOBUFS) {
+				op.starved = true;
+				starved_ops.push_back(idx);
+				return;
+			}
+
+			if (op.multishot && !more && !op.cancelled && __cqe.res > 0) {
+				op.on_complete(*this, __cqe);
+				if (__op_live(__cqe.user_data) && !ops[idx].cancelled)
+					__submit_op(idx);
+				return;
+			}
+
+			// Called in place while the op lives on, it's only freed (and its handler reset) by its last CQE
+			if (more) {
+				op.on_complete(*this, __cqe);
+			} else {
+				auto handler = std::move(op.on_complete);
+				__free_op(idx);
+				handler(*this, __cqe);
+			}
+		}
+
+		// Errors only show up in CQEs, the one thing that can fail here is getting an SQE when the ring is full
+		virtual std::error_code __lower_add(int __fd, EventType __events, uint64_t __token) override {
+			std::error_code ec;
+
+			if (ring)
+				__arm(__fd, __events, __token, ec);
+
+			return ec;
+		}
+
+		virtual std::error_code __lower_mod(int __fd, EventType __events, uint64_t __token) override {
+			std::error_code ec;
+
+			if (!ring)
+				return ec;
+
+			auto *s = EventLoop<EventBackend::Any, T, H>::__slot(__fd);
+
+			if (!s->armed) {
+				__arm(__fd, __events, __token, ec);
+				return ec;
+			}
+
+			auto *sqe = ring->get_sqe(ec);
+			if (!sqe)
+				return ec;
+
+			sqe->opcode = IORING_OP_POLL_REMOVE;
+			sqe->fd = -1;
+			sqe->addr = __poll_ud(__fd, __token);
+			sqe->user_data = ud_internal;
+
+			// An update only replaces the event mask, the kernel keeps the poll single or multishot as it was added.
+			// Switching between EdgeTriggered (multishot) and the others cancels it and adds a new one instead,
+			// issued in order within the same submit.
+			if (((s->backend_index & poll_multishot) != 0) == __multishot(__events)) {
+				sqe->len = IORING_POLL_UPDATE_EVENTS;
+				sqe->poll32_events = __translate_events_from(__events);
+			} else {
+				// A CQE the old poll already posted must not be taken for the new one's
+				s->backend_index ^= poll_epoch;
+				if (__arm(__fd, __events, __token, ec))
+					s->armed = false;
+			}
+
+			return ec;
+		}
+
+		virtual std::error_code __lower_del(int __fd, uint64_t __token) override {
+			std::error_code ec;
+
+			if (ring && EventLoop<EventBackend::Any, T, H>::__slot(__fd)->armed) {
+				auto *sqe = ring->get_sqe(ec);
+				if (!sqe)
+					return ec;
+
+				sqe->opcode = IORING_OP_POLL_REMOVE;
+				sqe->fd = -1;
+				sqe->addr = __poll_ud(__fd, __token);
+				sqe->user_data = ud_internal;
+			}
+
+			return ec;
+		}
+
+		template<typename F>
+		uint64_t __file_op(uint8_t __opcode, const File& __file, const void *__buf, size_t __len, off_t __offset, F&& __handler) {
+			uint32_t idx = __alloc_op();
+			auto &op = ops[idx];
+
+			op.fd = __file.fd();
+			op.opcode = __opcode;
+			op.multishot = false;
+			op.buf = (const uint8_t *)__buf;
+			op.len = __len;
+			op.done = 0;
+			op.offset = __offset;
+			op.on_complete = [handler = std::forward<F>(__handler), idx](EventLoop& __loop, const io_uring_cqe& __cqe) mutable {
+				size_t done = __loop.ops[idx].done;
+				handler(__loop, done, std::error_code(__cqe.res < 0 ? -__cqe.res : 0, std::system_category()));
+			};
+
+			__submit_op(idx);
+			return __op_ud(idx);
+		}
+
+		bool __dispatch(const io_uring_cqe& __cqe) {
+			if (__cqe.user_data & ud_internal)
+				return false;
+
+			if (__cqe.user_data & ud_op) {
+				__complete_op(__cqe);
+				return true;
+			}
+
+			int fd = (int)(uint32_t)__cqe.user_data;
+			uint64_t token = __cqe.user_data & ~ud_epoch;
+			auto *s = EventLoop<EventBackend::Any, T, H>::__slot_from_token(token);
+
+			// Gone, or a poll replaced by a trigger mode switch: the new one reports the same readiness. This is also
+			// where the -ECANCELED of the polls removed by del() and by those switches end up.
+			if (!s || ((__cqe.user_data & ud_epoch) != 0) != ((s->backend_index & poll_epoch) != 0))
+				return false;
+
+			// Checked before anything else: a poll that failed is gone from the kernel too
+			if (!(__cqe.flags & IORING_CQE_F_MORE))
+				s->armed = false;
+
+			// Re-arm level-triggered polls, and multishot polls the kernel dropped, also if the handler throws. It goes
+			// out with the next io_uring_enter. The fd may have been modified, deleted, or deleted and re-added by the handler.
+			struct Rearm {
+				EventLoop& loop;
+				int fd;
+
+				~Rearm() {
+					auto *s = loop.__slot(fd);
+					// A slot with deferred changes is armed by __flush_changes(), also after a del() and add() of the same fd
+					if (s->active && !s->armed && !s->dirty && !(s->events & EventType::OneShot)) {
+						loop.__arm(fd, s->events, EventLoop<EventBackend::Any, T, H>::__token(fd, s->generation));
+						s->armed = true;
+					}
+				}
+			} rearm{*this, fd};
+
+			// A live poll cancelled by the kernel is just added again. Other failures are reported as an Error.
+			if (__cqe.res == -ECANCELED)
+				return false;
+
+			EventType ev = __cqe.res < 0 ? EventType::Error : __translate_events_to(__cqe.res);
+			EventLoop<EventBackend::Any, T, H>::__call_event_handler(token, ev);
+
+			return true;
+		}
+
+	public:
+		// __buffer_count (a power of 2) buffers of __buffer_size bytes are shared by all async_recv() ops
+		EventLoop(unsigned __ring_entries = 1024, unsigned __buffer_count = 1024, unsigned __buffer_size = 4096) :
+			ring_entries(__ring_entries), buffer_count(__buffer_count), buffer_size(__buffer_size) {
+
+		}
+
+		// Multishot accept (Linux 5.19+). __handler(EventLoop&, Socket<AF, ST>& client, std::error_code) is called
+		// for every new connection until the op is cancelled or fails.
+		template<AddressFamily AF, SocketType ST, typename F>
+		uint64_t async_accept(const Socket<AF, ST>& __listener, const F& __handler) {
+			uint32_t idx = __alloc_op();
+			auto &op = ops[idx];
+
+			op.fd = __listener.fd();
+			op.opcode = IORING_OP_ACCEPT;
+			op.multishot = true;
+			op.on_complete = [handler = __handler](EventLoop& __loop, const io_uring_cqe& __cqe) mutable {
+				Socket<AF, ST> client(__cqe.res >= 0 ? __cqe.res : -1);
+				handler(__loop, client, std::error_code(__cqe.res < 0 ? -__cqe.res : 0, std::system_category()));
+			};
+
+			__submit_op(idx);
+			return __op_ud(idx);
+		}
+
+		// Multishot recv into the loop's provided buffer ring (Linux 6.0+).
+		// __handler(EventLoop&, const uint8_t *data, size_t len, std::error_code) is called for every chunk received.
+		// data is only valid during the call. len == 0 without an error means the peer closed the connection.
+		template<AddressFamily AF, SocketType ST, typename F>
+		uint64_t async_recv(const Socket<AF, ST>& __socket, const F& __handler) {
+			uint32_t idx = __alloc_op();
+			auto &op = ops[idx];
+
+			op.fd = __socket.fd();
+			op.opcode = IORING_OP_RECV;
+			op.multishot = true;
+			op.on_complete = [handler = __handler](EventLoop& __loop, const io_uring_cqe& __cqe) mutable {
+				if (__cqe.flags & IORING_CQE_F_BUFFER) {
+					// Handed back even if the handler throws
+					struct Recycle {
+						EventLoop &loop;
+						uint16_t bid;
+						~Recycle() { loop.__recycle_buffer(bid); }
+					} recycle{__loop, (uint16_t)(__cqe.flags >> IORING_CQE_BUFFER_SHIFT)};
+
+					handler(__loop, (const uint8_t *)__loop.buffer_ring->buffer(recycle.bid), (size_t)__cqe.res, std::error_code());
+				} else {
+					handler(__loop, (const uint8_t *)nullptr, (size_t)0, std::error_code(__cqe.res < 0 ? -__cqe.res : 0, std::system_category()));
+				}
+			};
+
+			__submit_op(idx);
+			return __op_ud(idx);
+		}
+
+		// Sends the whole buffer, resubmitting on short writes. __buf must stay valid until
+		// __handler(EventLoop&, size_t sent, std::error_code) is called.
+		template<AddressFamily AF, SocketType ST, typename F>
+		uint64_t async_send(const Socket<AF, ST>& __socket, const void *__buf, size_t __len, const F& __handler) {
+			uint32_t idx = __alloc_op();
+			auto &op = ops[idx];
+
+			op.fd = __socket.fd();
+			op.opcode = IORING_OP_SEND;
+			op.multishot = false;
+			op.buf = (const uint8_t *)__buf;
+			op.len = __len;
+			op.done = 0;
+			op.on_complete = [handler = __handler, idx](EventLoop& __loop, const io_uring_cqe& __cqe) mutable {
+				size_t sent = __loop.ops[idx].done;
+				handler(__loop, sent, std::error_code(__cqe.res < 0 ? -__cqe.res : 0, std::system_category()));
+			};
+
+			__submit_op(idx);
+			return __op_ud(idx);
+		}
+
+		// Regular file I/O as io_uring ops (Linux 5.6+), no thread pool involved. Same rules as
+		// EventLoop<EventBackend::Any>::async_pread() and friends, but returns an op for cancel().
+		template<typename F>
+		uint64_t async_pread(const File& __file, void *__buf, size_t __len, off_t __offset, F&& __handler) {
+			return __file_op(IORING_OP_READ, __file, __buf, __len, __offset, std::forward<F>(__handler));
+		}
+
+		template<typename F>
+		uint64_t async_pwrite(const File& __file, const void *__buf, size_t __len, off_t __offset, F&& __handler) {
+			return __file_op(IORING_OP_WRITE, __file, __buf, __len, __offset, std::forward<F>(__handler));
+		}
+
+		template<typename F>
+		uint64_t async_fsync(const File& __file, F&& __handler, bool __datasync = false) {
+			uint32_t idx = __alloc_op();
+			auto &op = ops[idx];
+
+			op.fd = __file.fd();
+			op.opcode = IORING_OP_FSYNC;
+			op.multishot = false;
+			op.fsync_flags = __datasync ? IORING_FSYNC_DATASYNC : 0;
+			op.on_complete = [handler = std::forward<F>(__handler)](EventLoop& __loop, const io_uring_cqe& __cqe) mutable {
+				handler(__loop, std::error_code(__cqe.res < 0 ? -__cqe.res : 0, std::system_category()));
+			};
+
+			__submit_op(idx);
+			return __op_ud(idx);
+		}
+
+		// Cancels an op returned by async_*(). Its handler is called one last time with operation_canceled.
+		void cancel(uint64_t __op) {
+			uint32_t idx = (uint32_t)__op;
+
+			if (!__op_live(__op) || !ops[idx].on_complete)
+				return;
+
+			ops[idx].cancelled = true;
+
+			// Not in the kernel while waiting for a buffer, finish it here
+			if (ops[idx].starved) {
+				io_uring_cqe cqe{};
+				cqe.user_data = __op;
+				cqe.res = -ECANCELED;
+				__complete_op(cqe);
+				return;
+			}
+
+			auto *sqe = __ensure_ring().get_sqe();
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->fd = -1;
+			sqe->addr = __op;
+			sqe->user_data = ud_internal;
+		}
+
+		virtual void run() override {
+			__ensure_ring();
+
+			while (!EventLoop<EventBackend::Any, T, H>::__stopping()) {
+				EventLoop<EventBackend::Any, T, H>::__flush_changes();
+				int rc = ring->submit_and_wait(1, EventLoop<EventBackend::Any, T, H>::__wait_timeout());
+
+				if (rc < 0 && rc != -ETIME && rc != -EINTR && rc != -EBUSY)
+					throw std::system_error(-rc, std::system_category(), "io_uring_enter");
+
+				unsigned nr_events = 0;
+				ring->for_each_cqe([this, &nr_events](const io_uring_cqe& cqe){
+					nr_events += __dispatch(cqe);
+				});
+
+				__resume_starved_ops();
+
+				EventLoop<EventBackend::Any, T, H>::__after_wait(nr_events);
+			}
+
+		}
+	};
+#endif
+
+	template<typename T, typename H>
+	class EventLoop<EventBackend::Poll, T, H> : public EventLoop<EventBackend::Any, T, H> {
+	protected:
+
+		EventType __translate_events_to(int __poll_events) {
+			EventType ret = EventType::None;
+
+			if (__poll_events & POLLIN)
+				ret |= EventType::In;
+
+			if (__poll_events & POLLOUT)
+				ret |= EventType::Out;
+
+			if (__poll_events & POLLERR)
+				ret |= EventType::Error;
+
+			if (__poll_events & POLLHUP)
+				ret |= EventType::Hangup;
+
+#ifdef POLLRDHUP
+			if (__poll_events & POLLRDHUP)
+				ret |= EventType::ReadHangup;
+#endif
+
+			return ret;
+		}
+
+		short __translate_events_from(EventType __events) {
+			short ret = 0;
+
+			if (__events & EventType::In)
+				ret |= POLLIN;
+
+			if (__events & EventType::Out)
+				ret |= POLLOUT;
+
+			if (__events & EventType::Error)
+				ret |= POLLERR;
+
+			if (__events & EventType::Hangup)
+				ret |= POLLHUP;
+
+#ifdef POLLRDHUP
+			if (__events & EventType::ReadHangup)
+				ret |= POLLRDHUP;
+#endif
+
+			return ret;
+		}
+
+
+		using Base = EventLoop<EventBackend::Any, T, H>;
+
+		// Persistent, updated in place by add/modify/del. pfd_tokens[i] is 0 for an entry deleted during
+		// dispatch (compacted afterwards), pfds[i].fd is -1 for a fired OneShot entry waiting for rearm().
+		std::vector<pollfd> pfds;
+		std::vector<uint64_t> pfd_tokens;
+		bool dispatching = false;
+		bool need_compact = false;
+
+		// revents is left alone: a handler may modify an entry that wasn't scanned yet, its events still count.
+		// New entries start out zeroed, and poll() overwrites all of them anyway.
+		void __pfd_set(size_t __idx, int __fd, EventType __events, bool __armed) {
+			pfds[__idx].fd = __armed ? __fd : -1;
+			pfds[__idx].events = __translate_events_from(__events);
+		}
+
+		void __pfd_remove(size_t __idx) {
+			size_t last = pfds.size() - 1;
+
+			if (__idx != last) {
+				pfds[__idx] = pfds[last];
+				pfd_tokens[__idx] = pfd_tokens[last];
+				Base::__slot((int)(uint32_t)pfd_tokens[__idx])->backend_index = __idx;
+			}
+
+			pfds.pop_back();
+			pfd_tokens.pop_back();
+		}
+
+		void __compact() {
+			for (size_t i=pfds.size(); i--; ) {
+				if (!pfd_tokens[i])
+					__pfd_remove(i);
+			}
+
+			need_compact = false;
+		}
+
+		virtual std::error_code __lower_add(int __fd, EventType __events, uint64_t __token) override {
+			Base::__slot(__fd)->backend_index = pfds.size();
+			pfds.emplace_back();
+			pfd_tokens.push_back(__token);
+			__pfd_set(pfds.size() - 1, __fd, __events, true);
+			return {};
+		}
+
+		virtual std::error_code __lower_mod(int __fd, EventType __events, uint64_t /* __token */) override {
+			__pfd_set(Base::__slot(__fd)->backend_index, __fd, __events, true);
+			return {};
+		}
+
+		virtual std::error_code __lower_del(int __fd, uint64_t /* __token */) override {
+			size_t idx = Base::__slot(__fd)->backend_index;
+
+			if (dispatching) {
+				// Entries are still being scanned, don't move them around
+				pfds[idx].fd = -1;
+				pfd_tokens[idx] = 0;
+				need_compact = true;
+			} else {
+				__pfd_remove(idx);
+			}
+
+			return {};
+		}
+
+	public:
+		EventLoop() {
+			// Objects added by the base class constructor, before our __lower_add() existed
+			Base::__for_each_slot([this](int __fd, auto& __s){
+				__lower_add(__fd, __s.events, Base::__token(__fd, __s.generation));
+			});
+		}
+
+		virtual void run() override {
+			// A handler may have thrown out of the previous run()
+			dispatching = false;
+			if (need_compact)
+				__compact();
+
+			while (!Base::__stopping()) {
+				Base::__flush_changes();
+				int rc = poll(pfds.data(), pfds.size(), Base::__wait_timeout());
+				bool had_events = rc > 0;
+
+				if (rc > 0) {
+					dispatching = true;
+
+					// Entries added by handlers go to the end and weren't polled, rc bounds the scan anyway
+					for (size_t i=0; rc && i<pfds.size(); i++) {
+						short revents = pfds[i].revents;
+						if (!revents)
+							continue;
+
+						rc--;
+
+						uint64_t token = pfd_tokens[i];
+						auto *s = Base::__slot_from_token(token);
+						if (!s)
+							continue;
+
+						if (s->events & EventType::OneShot) {
+							s->armed = false;
+							pfds[i].fd = -1;
+						}
+
+						Base::__call_event_handler(token, __translate_events_to(revents));
+					}
+
+					dispatching = false;
+					if (need_compact)
+						__compact();
+				} else if (rc < 0) {
+					if (errno != EINTR && errno != EAGAIN)
+						throw std::system_error(errno, std::system_category(), "poll");
+				}
+
+				Base::__after_wait(had_events);
 			}
 
 		}
@@ -0,0 +1,169 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <memory>
+#include <exception>
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "EventLoop.hpp"
+
+namespace IODash {
+
+	// N event loops on N threads. Each loop owns its connections, nothing is shared between them.
+	template<EventBackend EB, typename UD = int, typename H = void>
+	class EventLoopGroup {
+	public:
+		using Loop = EventLoop<EB, UD, H>;
+
+	protected:
+		std::vector<std::unique_ptr<Loop>> loops;
+		std::vector<std::thread> threads;
+		std::vector<std::exception_ptr> errors;
+		std::vector<File> listeners;
+		std::vector<int> cpus;
+
+		// Called by the loop's own thread before it runs anything
+		void __pin(size_t __idx) {
+			if (cpus.empty())
+				return;
+
+#ifdef __linux__
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cpus[__idx % cpus.size()], &set);
+
+			int rc = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+			if (rc)
+				throw std::system_error(rc, std::system_category(), "pthread_setaffinity_np");
+#endif
+		}
+
+	public:
+		EventLoopGroup(size_t __nr_loops = std::thread::hardware_concurrency()) {
+			if (!__nr_loops)
+				__nr_loops = 1;
+
+			for (size_t i=0; i<__nr_loops; i++)
+				loops.emplace_back(std::make_unique<Loop>());
+		}
+
+		~EventLoopGroup() {
+			stop();
+			for (auto &it : threads) {
+				if (it.joinable())
+					it.join();
+			}
+		}
+
+		size_t size() const noexcept {
+			return loops.size();
+		}
+
+		Loop& operator[](size_t __idx) noexcept {
+			return *loops[__idx];
+		}
+
+		// Calls __func(Loop&, size_t index) for every loop. Use before start(), the loops aren't thread safe.
+		template<typename F>
+		void for_each(const F& __func) {
+			for (size_t i=0; i<loops.size(); i++)
+				__func(*loops[i], i);
+		}
+
+		// Pins loop i to __cpus[i % __cpus.size()]. Empty to disable pinning.
+		void set_cpu_affinity(const std::vector<int>& __cpus) {
+			cpus = __cpus;
+		}
+
+		// Pins loop i to the i-th CPU this process is allowed to run on
+		void set_cpu_affinity() {
+			cpus.clear();
+
+#ifdef __linux__
+			cpu_set_t set;
+			CPU_ZERO(&set);
+
+			if (sched_getaffinity(0, sizeof(cpu_set_t), &set))
+				throw std::system_error(errno, std::system_category(), "sched_getaffinity");
+
+			for (int i=0; i<CPU_SETSIZE; i++) {
+				if (CPU_ISSET(i, &set))
+					cpus.push_back(i);
+			}
+#endif
+		}
+
+		// Creates one SO_REUSEPORT listening socket per loop, all bound to __addr, and calls
+		// __setup(Loop&, Socket<AF, ST>& listener, size_t index) so it can be added to its loop.
+		template<AddressFamily AF, SocketType ST = SocketType::Stream, typename F>
+		void listen(const SocketAddress<AF>& __addr, const F& __setup, int __backlog = 256) {
+			for (size_t i=0; i<loops.size(); i++) {
+				Socket<AF, ST> listener;
+				listener.create();
+				listener.set_reuseaddr();
+				listener.set_reuseport();
+				listener.bind(__addr);
+				listener.listen(__backlog);
+
+				listeners.push_back(listener);
+				__setup(*loops[i], listener, i);
+			}
+		}
+
+		void start() {
+			errors.assign(loops.size(), nullptr);
+
+			for (size_t i=0; i<loops.size(); i++) {
+				threads.emplace_back([this, i](){
+					try {
+						__pin(i);
+						// A stop() before this point is kept by the loop, run() returns right away then
+						loops[i]->run();
+					} catch (...) {
+						errors[i] = std::current_exception();
+					}
+				});
+			}
+		}
+
+		void stop() {
+			for (auto &it : loops)
+				it->stop();
+		}
+
+		// Waits for every loop to exit, rethrows the first exception a loop died with
+		void join() {
+			for (auto &it : threads) {
+				if (it.joinable())
+					it.join();
+			}
+			threads.clear();
+
+			for (auto &it : errors) {
+				if (it)
+					std::rethrow_exception(it);
+			}
+		}
+
+		void run() {
+			start();
+			join();
+		}
+	};
+
+}
@@ -13,27 +13,109 @@
 #pragma once
 
 #include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <system_error>
+#include <algorithm>
+#include <utility>
+
+#if __cplusplus >= 202002L && __has_include(<span>)
+#include <span>
+#endif
+
+#include <cstring>
+#include <cstdint>
 
 #include <unistd.h>
 #include <fcntl.h>
 
+#include <climits>
+
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+#ifdef __linux__
+#include <sys/sendfile.h>
+#include <signal.h>
+#include <pthread.h>
+#endif
 
 namespace IODash {
+	// Coroutine awaitables, defined in Coroutine.hpp (C++20)
+	template<typename EL> class ReadAwaiter;
+	template<typename EL> class WriteAwaiter;
+
 	class File {
 	protected:
 		int fd_ = -1;
 		std::shared_ptr<int> refcounter;
 
+		// For the error_code overloads: __rc is a syscall's return value
+		static void __errno_to(std::error_code& __ec, int __rc) noexcept {
+			if (__rc < 0)
+				__ec.assign(errno, std::system_category());
+			else
+				__ec.clear();
+		}
+
+		// Consumes __n bytes from the front of an iovec array, for resuming after a partial scatter/gather call.
+		// Finished entries are left empty, so the caller's array shows what's left.
+		static void __advance_iov(iovec *&__iov, int& __iovcnt, size_t __n) noexcept {
+			while (__iovcnt && __n >= __iov->iov_len) {
+				__n -= __iov->iov_len;
+				__iov->iov_len = 0;
+				__iov++;
+				__iovcnt--;
+			}
+
+			if (__iovcnt) {
+				__iov->iov_base = (uint8_t *)__iov->iov_base + __n;
+				__iov->iov_len -= __n;
+			}
+		}
+
+		// Starts refcounting fd_, just opened. Out of memory for the control block, it's closed again with ENOMEM.
+		bool __adopt(std::error_code& __ec) noexcept {
+			try {
+				refcounter.reset((int *)nullptr);
+			} catch (std::bad_alloc&) {
+				::close(fd_);
+				fd_ = -1;
+				__ec.assign(ENOMEM, std::system_category());
+				return false;
+			}
+
+			__ec.clear();
+			return true;
+		}
+
+		static int __iov_batch(int __iovcnt) noexcept {
+			return __iovcnt > IOV_MAX ? IOV_MAX : __iovcnt;
+		}
+
 		void set_nonblocking(bool __nonblocking = true) {
+			std::error_code ec;
+			set_nonblocking(__nonblocking, ec);
+			if (ec)
+				throw std::system_error(ec, "fcntl");
+		}
+
+		void set_nonblocking(bool __nonblocking, std::error_code& __ec) noexcept {
+			__ec.clear();
+
 			int flags = fcntl(fd_, F_GETFL, 0);
-			if (flags == -1)
-				throw std::system_error(errno, std::system_category(), "fcntl F_GETFL");
+			if (flags == -1) {
+				__ec.assign(errno, std::system_category());
+				return;
+			}
 
 			flags = __nonblocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
 
 			if (fcntl(fd_, F_SETFL, flags))
-				throw std::system_error(errno, std::system_category(), "fcntl F_SETFL");
+				__ec.assign(errno, std::system_category());
 		}
 
 	public:
@@ -53,7 +135,7 @@ namespace IODash {
 //			printf("copy-constructed, refcount=%ld\n", refcounter.use_count());
 		}
 
-		File(File&& o) {
+		File(File&& o) noexcept {
 //			puts("move-constructed\n");
 			refcounter = std::move(o.refcounter);
 			fd_ = o.fd_;
@@ -62,6 +144,17 @@ namespace IODash {
 
 		File& operator=(const File& o) = default;
 
+		// Like copying, the fd held before is only released, not closed
+		File& operator=(File&& o) noexcept {
+			if (this != &o) {
+				refcounter = std::move(o.refcounter);
+				fd_ = o.fd_;
+				o.fd_ = -1;
+			}
+
+			return *this;
+		}
+
 		explicit operator bool() {
 			return fd_ >= 0;
 		}
@@ -75,14 +168,23 @@ namespace IODash {
 		}
 
 		void open(const std::string& __path, int __mode = O_RDWR) {
+			std::error_code ec;
+			open(__path, __mode, ec);
+			if (ec)
+				throw std::system_error(ec, "failed to open");
+		}
+
+		void open(const std::string& __path, int __mode, std::error_code& __ec) noexcept {
 			close();
 
 			fd_ = ::open(__path.c_str(), __mode);
 
-			if (fd_ < 0)
-				throw std::system_error(errno, std::system_category(), "failed to open");
+			if (fd_ < 0) {
+				__ec.assign(errno, std::system_category());
+				return;
+			}
 
-			refcounter.reset((int *)nullptr);
+			__adopt(__ec);
 		}
 
 		void close() noexcept {
@@ -94,10 +196,23 @@ namespace IODash {
 		}
 
 		struct stat stat() const {
-			struct stat stbuf;
-			int rc = ::fstat(fd_, &stbuf);
-			if (rc < 0)
-				throw std::system_error(errno, std::system_category(), "failed to stat");
+			std::error_code ec;
+			struct stat stbuf = stat(ec);
+			if (ec)
+				throw std::system_error(ec, "failed to stat");
+
+			return stbuf;
+		}
+
+		struct stat stat(std::error_code& __ec) const noexcept {
+			struct stat stbuf{};
+
+			if (::fstat(fd_, &stbuf) < 0)
+				__ec.assign(errno, std::system_category());
+			else
+				__ec.clear();
+
+			return stbuf;
 		}
 
 		ssize_t write(const void *__buf, size_t __len) {
@@ -108,6 +223,64 @@ namespace IODash {
 			return ::read(fd_, __buf, __len);
 		}
 
+		ssize_t pwrite(const void *__buf, size_t __len, off_t __offset) {
+			return ::pwrite(fd_, __buf, __len, __offset);
+		}
+
+		ssize_t pread(void *__buf, size_t __len, off_t __offset) {
+			return ::pread(fd_, __buf, __len, __offset);
+		}
+
+		// Scatter/gather: e.g. a header, a body and a trailer in one syscall without copying them together
+		ssize_t writev(const iovec *__iov, int __iovcnt) {
+			return ::writev(fd_, __iov, __iovcnt);
+		}
+
+		ssize_t readv(const iovec *__iov, int __iovcnt) {
+			return ::readv(fd_, __iov, __iovcnt);
+		}
+
+		ssize_t pwritev(const iovec *__iov, int __iovcnt, off_t __offset) {
+			return ::pwritev(fd_, __iov, __iovcnt, __offset);
+		}
+
+		ssize_t preadv(const iovec *__iov, int __iovcnt, off_t __offset) {
+			return ::preadv(fd_, __iov, __iovcnt, __offset);
+		}
+
+		// Like write_all(), across iovecs. __iov is updated in place: on failure its non-empty entries are what's left.
+		ssize_t writev_all(iovec *__iov, int __iovcnt) {
+			size_t written = 0;
+
+			while (__iovcnt) {
+				ssize_t rc = writev(__iov, __iov_batch(__iovcnt));
+				if (rc > 0) {
+					written += rc;
+					__advance_iov(__iov, __iovcnt, rc);
+				} else if (rc == 0) {
+					return written;
+				} else if (errno != EINTR) {
+					return -1;
+				}
+			}
+
+			return written;
+		}
+
+#ifdef __linux__
+		// Zero-copy from a regular file (or anything mmap-able) to this object, e.g. a socket. Advances __offset,
+		// or the file position of __in if it's nullptr. Raises SIGPIPE on a closed socket, like write().
+		ssize_t sendfile(const File& __in, off_t *__offset, size_t __count) {
+			return ::sendfile(fd_, __in.fd(), __offset, __count);
+		}
+
+		// In-kernel copy between regular files, may share extents (reflink) on file systems that support it
+		ssize_t copy_file_range(off_t *__offset, const File& __out, off_t *__out_offset, size_t __len, unsigned __flags = 0) {
+			return ::copy_file_range(fd_, __offset, __out.fd(), __out_offset, __len, __flags);
+		}
+#endif
+
+		// Retries on EINTR, like writev_all()
 		ssize_t write_all(const void *__buf, size_t __len) {
 			size_t written = 0;
 
@@ -117,7 +290,7 @@ namespace IODash {
 					written += rc;
 				} else if (rc == 0) {
 					return written;
-				} else {
+				} else if (errno != EINTR) {
 					return -1;
 				}
 			}
@@ -144,7 +317,7 @@ namespace IODash {
 					readd += rc;
 				} else if (rc == 0) {
 					return readd;
-				} else {
+				} else if (errno != EINTR) {
 					return -1;
 				}
 			}
@@ -162,6 +335,34 @@ namespace IODash {
 			}
 		}
 
+		// Completed through __loop, see EventLoop::async_pread(). __handler(EventLoop&, size_t, std::error_code)
+		template<typename EL, typename F>
+		auto async_pread(EL& __loop, void *__buf, size_t __len, off_t __offset, F&& __handler) const {
+			return __loop.async_pread(*this, __buf, __len, __offset, std::forward<F>(__handler));
+		}
+
+		template<typename EL, typename F>
+		auto async_pwrite(EL& __loop, const void *__buf, size_t __len, off_t __offset, F&& __handler) const {
+			return __loop.async_pwrite(*this, __buf, __len, __offset, std::forward<F>(__handler));
+		}
+
+		// __handler(EventLoop&, std::error_code)
+		template<typename EL, typename F>
+		auto async_fsync(EL& __loop, F&& __handler, bool __datasync = false) const {
+			return __loop.async_fsync(*this, std::forward<F>(__handler), __datasync);
+		}
+
+		// co_await file.async_read(loop, buf, len) on a non-blocking pipe, tty..., see Coroutine.hpp
+		template<typename EL>
+		ReadAwaiter<EL> async_read(EL& __loop, void *__buf, size_t __len) {
+			return {__loop, *this, __buf, __len};
+		}
+
+		template<typename EL>
+		WriteAwaiter<EL> async_write(EL& __loop, const void *__buf, size_t __len) {
+			return {__loop, *this, __buf, __len};
+		}
+
 		ssize_t putc(uint8_t __c) {
 			return write(&__c, 1);
 		}
@@ -176,6 +377,364 @@ namespace IODash {
 		}
 
 	};
+
+	// A whole file (or memfd) mapped MAP_SHARED: no copy on load, and every process mapping it shares the page cache.
+	// The mapping grows ahead of the file on resize()/append(), which may move it and invalidates pointers and spans.
+	class MappedFile {
+	protected:
+		File file_;
+		uint8_t *addr_ = nullptr;
+		// File size, and mapping length which runs ahead of it while appending
+		size_t size_ = 0, capacity_ = 0;
+		bool writable_ = false;
+		int map_flags_ = 0;
+
+		static size_t __page_size() noexcept {
+			static const size_t page = sysconf(_SC_PAGESIZE);
+			return page;
+		}
+
+		static size_t __page_round(size_t __len) noexcept {
+			return (__len + __page_size() - 1) & ~(__page_size() - 1);
+		}
+
+		void __remap(size_t __capacity, std::error_code& __ec) noexcept {
+			__ec.clear();
+
+			int prot = writable_ ? PROT_READ | PROT_WRITE : PROT_READ;
+			void *p;
+
+			if (!addr_) {
+				p = ::mmap(nullptr, __capacity, prot, MAP_SHARED | map_flags_, file_.fd(), 0);
+			} else {
+#ifdef __linux__
+				p = ::mremap(addr_, capacity_, __capacity, MREMAP_MAYMOVE);
+#else
+				p = ::mmap(nullptr, __capacity, prot, MAP_SHARED | map_flags_, file_.fd(), 0);
+				if (p != MAP_FAILED)
+					::munmap(addr_, capacity_);
+#endif
+			}
+
+			if (p == MAP_FAILED) {
+				__ec.assign(errno, std::system_category());
+				return;
+			}
+
+			addr_ = (uint8_t *)p;
+			capacity_ = __capacity;
+		}
+
+	public:
+		MappedFile() = default;
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		MappedFile(MappedFile&& o) noexcept {
+			*this = std::move(o);
+		}
+
+		MappedFile& operator=(MappedFile&& o) noexcept {
+			if (this != &o) {
+				unmap();
+				file_ = o.file_;
+				o.file_ = File();
+				addr_ = std::exchange(o.addr_, nullptr);
+				size_ = std::exchange(o.size_, 0);
+				capacity_ = std::exchange(o.capacity_, 0);
+				writable_ = o.writable_;
+				map_flags_ = o.map_flags_;
+			}
+
+			return *this;
+		}
+
+		~MappedFile() {
+			unmap();
+		}
+
+		// Maps all of __file, read-only unless __writable (the file must be open for it then).
+		// __map_flags are added to MAP_SHARED, e.g. MAP_POPULATE to fault everything in up front.
+		void map(const File& __file, bool __writable = false, int __map_flags = 0) {
+			std::error_code ec;
+			map(__file, __writable, __map_flags, ec);
+			if (ec)
+				throw std::system_error(ec, "failed to map");
+		}
+
+		void map(const File& __file, bool __writable, int __map_flags, std::error_code& __ec) noexcept {
+			unmap();
+
+			struct stat stbuf = __file.stat(__ec);
+			if (__ec)
+				return;
+
+			file_ = __file;
+			writable_ = __writable;
+			map_flags_ = __map_flags;
+			size_ = stbuf.st_size;
+
+			// mmap() refuses empty mappings, an empty file is mapped on its first resize()
+			if (size_)
+				__remap(__page_round(size_), __ec);
+
+			if (__ec)
+				unmap();
+		}
+
+		void open(const std::string& __path, bool __writable = false, int __map_flags = 0) {
+			std::error_code ec;
+			open(__path, __writable, __map_flags, ec);
+			if (ec)
+				throw std::system_error(ec, "failed to map");
+		}
+
+		void open(const std::string& __path, bool __writable, int __map_flags, std::error_code& __ec) noexcept {
+			File f;
+			f.open(__path, (__writable ? O_RDWR : O_RDONLY) | O_CLOEXEC, __ec);
+			if (!__ec)
+				map(f, __writable, __map_flags, __ec);
+		}
+
+#ifdef __linux__
+		// Anonymous, writable and shareable with child processes or over a Unix socket (file().fd())
+		void create_memfd(const std::string& __name, size_t __size, unsigned __memfd_flags = MFD_CLOEXEC) {
+			int fd = ::memfd_create(__name.c_str(), __memfd_flags);
+			if (fd < 0)
+				throw std::system_error(errno, std::system_category(), "memfd_create");
+
+			File f(fd);
+			map(f, true);
+			resize(__size);
+		}
+#endif
+
+		void unmap() noexcept {
+			if (addr_)
+				::munmap(addr_, capacity_);
+
+			addr_ = nullptr;
+			size_ = capacity_ = 0;
+			// Closes it if nobody else holds the File
+			file_.close();
+			file_ = File();
+		}
+
+		explicit operator bool() const noexcept {
+			return file_.fd() >= 0;
+		}
+
+		const File& file() const noexcept {
+			return file_;
+		}
+
+		uint8_t *data() noexcept {
+			return addr_;
+		}
+
+		const uint8_t *data() const noexcept {
+			return addr_;
+		}
+
+		size_t size() const noexcept {
+			return size_;
+		}
+
+		// Clamped to the file's size
+		std::string_view view(size_t __offset = 0, size_t __len = SIZE_MAX) const noexcept {
+			if (__offset >= size_)
+				return {};
+
+			return {(const char *)addr_ + __offset, std::min(__len, size_ - __offset)};
+		}
+
+#if __cplusplus >= 202002L && __has_include(<span>)
+		std::span<uint8_t> span(size_t __offset = 0, size_t __len = SIZE_MAX) noexcept {
+			if (__offset >= size_)
+				return {};
+
+			return {addr_ + __offset, std::min(__len, size_ - __offset)};
+		}
+#endif
+
+		// madvise() on a byte range, rounded out to pages. E.g. MADV_SEQUENTIAL, MADV_WILLNEED, MADV_RANDOM.
+		void advise(int __advice, size_t __offset = 0, size_t __len = SIZE_MAX) {
+			if (!addr_ || __offset >= capacity_)
+				return;
+
+			size_t start = __offset & ~(__page_size() - 1);
+			size_t end = __len >= capacity_ - __offset ? capacity_ : __page_round(__offset + __len);
+
+			if (::madvise(addr_ + start, end - start, __advice))
+				throw std::system_error(errno, std::system_category(), "madvise");
+		}
+
+		// Transparent huge pages for the mapping. Returns false where unsupported: the kernel only does it
+		// for anonymous/shmem (memfd) mappings and some file systems, or THP is disabled.
+		bool use_hugepages() noexcept {
+#ifdef MADV_HUGEPAGE
+			return addr_ && !::madvise(addr_, capacity_, MADV_HUGEPAGE);
+#else
+			return false;
+#endif
+		}
+
+		// Sets the file's size (ftruncate) and maps it all. Growing reserves at least twice the previous
+		// mapping, so appending is amortized O(1).
+		void resize(size_t __size) {
+			std::error_code ec;
+			resize(__size, ec);
+			if (ec)
+				throw std::system_error(ec, "failed to resize mapping");
+		}
+
+		void resize(size_t __size, std::error_code& __ec) noexcept {
+			if (!writable_) {
+				__ec.assign(EBADF, std::system_category());
+				return;
+			}
+
+			if (::ftruncate(file_.fd(), __size)) {
+				__ec.assign(errno, std::system_category());
+				return;
+			}
+
+			__ec.clear();
+
+			if (__size > capacity_)
+				__remap(std::max(__page_round(__size), capacity_ * 2), __ec);
+
+			if (!__ec)
+				size_ = __size;
+		}
+
+		// Grows the file by __len and copies __buf there. Returns the offset it was written at.
+		size_t append(const void *__buf, size_t __len) {
+			size_t offset = size_;
+			resize(size_ + __len);
+			memcpy(addr_ + offset, __buf, __len);
+			return offset;
+		}
+
+		// msync(): writes dirty pages back, MS_ASYNC only schedules it
+		void sync(bool __async = false) {
+			if (addr_ && size_ && ::msync(addr_, __page_round(size_), __async ? MS_ASYNC : MS_SYNC))
+				throw std::system_error(errno, std::system_category(), "msync");
+		}
+	};
+
+#ifdef __linux__
+	// Keeps SIGPIPE from being raised in this thread while it lives, so sendfile() and splice() into a socket whose
+	// peer is gone just fail with EPIPE. A SIGPIPE caused meanwhile is discarded, one that was already pending stays.
+	class SigPipeBlocker {
+	protected:
+		sigset_t old_;
+		bool pending_ = false;
+
+	public:
+		SigPipeBlocker() noexcept {
+			sigset_t pipe;
+			sigemptyset(&pipe);
+			sigaddset(&pipe, SIGPIPE);
+			pthread_sigmask(SIG_BLOCK, &pipe, &old_);
+
+			sigset_t pending;
+			sigpending(&pending);
+			pending_ = sigismember(&pending, SIGPIPE);
+		}
+
+		SigPipeBlocker(const SigPipeBlocker&) = delete;
+		SigPipeBlocker& operator=(const SigPipeBlocker&) = delete;
+
+		~SigPipeBlocker() {
+			int saved_errno = errno;
+
+			if (!pending_) {
+				sigset_t pending;
+				sigpending(&pending);
+				if (sigismember(&pending, SIGPIPE)) {
+					sigset_t pipe;
+					sigemptyset(&pipe);
+					sigaddset(&pipe, SIGPIPE);
+					timespec zero{};
+					sigtimedwait(&pipe, nullptr, &zero);
+				}
+			}
+
+			pthread_sigmask(SIG_SETMASK, &old_, nullptr);
+			errno = saved_errno;
+		}
+	};
+
+	// Moves data between two fds through a pipe with splice(2), without copying it to userspace. Works for any
+	// pair, e.g. socket to socket. Bytes taken from the source but not written out yet stay in the pipe.
+	class Splicer {
+	protected:
+		int pipe_[2] = {-1, -1};
+		size_t buffered_ = 0;
+
+	public:
+		// __pipe_size: F_SETPIPE_SZ, bytes moved per splice() pair. 0 keeps the default (64K).
+		explicit Splicer(size_t __pipe_size = 0) {
+			if (::pipe2(pipe_, O_NONBLOCK | O_CLOEXEC))
+				throw std::system_error(errno, std::system_category(), "pipe2");
+
+			if (__pipe_size)
+				::fcntl(pipe_[1], F_SETPIPE_SZ, (int)__pipe_size);
+		}
+
+		Splicer(const Splicer&) = delete;
+		Splicer& operator=(const Splicer&) = delete;
+
+		~Splicer() {
+			::close(pipe_[0]);
+			::close(pipe_[1]);
+		}
+
+		// Bytes read from a source and not yet written out
+		size_t buffered() const noexcept {
+			return buffered_;
+		}
+
+		// Moves up to __len bytes from __in (at *__in_offset unless nullptr) to __out. Returns the bytes written to
+		// __out, 0 at the end of __in, or -1 with errno set if nothing could be written. On EAGAIN, __out is the
+		// side that would block if buffered() isn't 0, __in otherwise. Sockets must be non-blocking.
+		ssize_t transfer(const File& __in, off_t *__in_offset, const File& __out, size_t __len) {
+			size_t written = 0;
+
+			while (written < __len) {
+				if (!buffered_) {
+					ssize_t rc = ::splice(__in.fd(), __in_offset, pipe_[1], nullptr, __len - written, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+					if (rc == 0)
+						break;
+
+					if (rc < 0) {
+						if (errno == EINTR)
+							continue;
+						return written ? (ssize_t)written : -1;
+					}
+
+					buffered_ += rc;
+				}
+
+				ssize_t rc = ::splice(pipe_[0], nullptr, __out.fd(), nullptr, buffered_, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+				if (rc < 0) {
+					if (errno == EINTR)
+						continue;
+					return written ? (ssize_t)written : -1;
+				}
+
+				buffered_ -= rc;
+				written += rc;
+			}
+
+			return written;
+		}
+	};
+#endif
 }
 
 namespace std {
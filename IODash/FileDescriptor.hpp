@@ -0,0 +1,188 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#pragma once
+
+#include <utility>
+
+#include <cstdint>
+
+#include <unistd.h>
+
+#include "File.hpp"
+
+namespace IODash {
+
+	// Owning fd handle: just the int, move-only, closes on destruction.
+	class UniqueFd {
+	protected:
+		int fd_ = -1;
+
+	public:
+		UniqueFd() noexcept = default;
+
+		explicit UniqueFd(int __fd) noexcept : fd_(__fd) {
+
+		}
+
+		UniqueFd(const UniqueFd&) = delete;
+		UniqueFd& operator=(const UniqueFd&) = delete;
+
+		UniqueFd(UniqueFd&& o) noexcept : fd_(o.release()) {
+
+		}
+
+		UniqueFd& operator=(UniqueFd&& o) noexcept {
+			if (this != &o)
+				reset(o.release());
+
+			return *this;
+		}
+
+		~UniqueFd() {
+			reset();
+		}
+
+		int fd() const noexcept {
+			return fd_;
+		}
+
+		explicit operator bool() const noexcept {
+			return fd_ >= 0;
+		}
+
+		// Gives up ownership without closing
+		int release() noexcept {
+			int ret = fd_;
+			fd_ = -1;
+			return ret;
+		}
+
+		void reset(int __fd = -1) noexcept {
+			if (fd_ >= 0)
+				::close(fd_);
+
+			fd_ = __fd;
+		}
+	};
+
+	// Non-owning reference to a fd. Never closes anything.
+	class FdView {
+	protected:
+		int fd_ = -1;
+
+	public:
+		FdView() noexcept = default;
+
+		FdView(int __fd) noexcept : fd_(__fd) {
+
+		}
+
+		FdView(const UniqueFd& __fd) noexcept : fd_(__fd.fd()) {
+
+		}
+
+		FdView(const File& __file) noexcept : fd_(__file.fd()) {
+
+		}
+
+		int fd() const noexcept {
+			return fd_;
+		}
+
+		explicit operator bool() const noexcept {
+			return fd_ >= 0;
+		}
+	};
+
+	// Shared ownership with a plain, non-atomic refcount. Opt-in, only for fds that never leave one thread
+	// (e.g. a loop's own connections). File's refcount is a std::shared_ptr, which is atomic.
+	class SharedFd {
+	protected:
+		struct Block {
+			int fd;
+			uint32_t refs;
+		};
+
+		Block *block = nullptr;
+
+		void __release() noexcept {
+			if (block && !--block->refs) {
+				::close(block->fd);
+				delete block;
+			}
+
+			block = nullptr;
+		}
+
+	public:
+		SharedFd() noexcept = default;
+
+		explicit SharedFd(int __fd) : block(__fd >= 0 ? new Block{__fd, 1} : nullptr) {
+
+		}
+
+		explicit SharedFd(UniqueFd&& __fd) : SharedFd(__fd.fd()) {
+			__fd.release();
+		}
+
+		SharedFd(const SharedFd& o) noexcept : block(o.block) {
+			if (block)
+				block->refs++;
+		}
+
+		SharedFd(SharedFd&& o) noexcept : block(std::exchange(o.block, nullptr)) {
+
+		}
+
+		SharedFd& operator=(const SharedFd& o) noexcept {
+			if (block != o.block) {
+				__release();
+				block = o.block;
+				if (block)
+					block->refs++;
+			}
+
+			return *this;
+		}
+
+		SharedFd& operator=(SharedFd&& o) noexcept {
+			if (this != &o) {
+				__release();
+				block = std::exchange(o.block, nullptr);
+			}
+
+			return *this;
+		}
+
+		~SharedFd() {
+			__release();
+		}
+
+		int fd() const noexcept {
+			return block ? block->fd : -1;
+		}
+
+		uint32_t use_count() const noexcept {
+			return block ? block->refs : 0;
+		}
+
+		explicit operator bool() const noexcept {
+			return block;
+		}
+
+		operator FdView() const noexcept {
+			return fd();
+		}
+	};
+
+}
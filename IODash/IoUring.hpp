@@ -0,0 +1,347 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#pragma once
+
+#include <system_error>
+
+#include <cinttypes>
+#include <cstring>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+namespace IODash {
+
+#ifdef __linux__
+
+	// Minimal io_uring ring, talks to the kernel directly. No liburing needed.
+	class IoUring {
+	protected:
+		int fd_ = -1;
+		io_uring_params params_{};
+
+		void *sq_ring = MAP_FAILED, *cq_ring = MAP_FAILED;
+		size_t sq_ring_size = 0, cq_ring_size = 0;
+
+		io_uring_sqe *sqes = (io_uring_sqe *)MAP_FAILED;
+		size_t sqes_size = 0;
+
+		unsigned *sq_head = nullptr, *sq_tail = nullptr, *sq_mask = nullptr, *sq_array = nullptr;
+		unsigned *cq_head = nullptr, *cq_tail = nullptr, *cq_mask = nullptr;
+		io_uring_cqe *cqes = nullptr;
+
+		unsigned sqe_tail = 0, sqe_head = 0;
+
+		template<typename T>
+		static T *__offset(void *__base, uint32_t __off) {
+			return (T *)((uint8_t *)__base + __off);
+		}
+
+		void __unmap() noexcept {
+			if (sqes != MAP_FAILED)
+				munmap(sqes, sqes_size);
+			if (cq_ring != MAP_FAILED && cq_ring != sq_ring)
+				munmap(cq_ring, cq_ring_size);
+			if (sq_ring != MAP_FAILED)
+				munmap(sq_ring, sq_ring_size);
+
+			sqes = (io_uring_sqe *)MAP_FAILED;
+			sq_ring = cq_ring = MAP_FAILED;
+		}
+
+		// Publish locally queued SQEs to the kernel visible tail
+		unsigned __flush_sq() noexcept {
+			unsigned to_submit = sqe_tail - sqe_head;
+
+			if (to_submit) {
+				unsigned tail = *sq_tail;
+				for (; sqe_head != sqe_tail; sqe_head++, tail++)
+					sq_array[tail & *sq_mask] = sqe_head & *sq_mask;
+
+				__atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+			}
+
+			return to_submit;
+		}
+
+	public:
+		IoUring(unsigned __entries = 256, unsigned __flags = 0) {
+			params_.flags = __flags;
+
+			fd_ = (int)syscall(__NR_io_uring_setup, __entries, &params_);
+			if (fd_ < 0)
+				throw std::system_error(errno, std::system_category(), "io_uring_setup");
+
+			sq_ring_size = params_.sq_off.array + params_.sq_entries * sizeof(unsigned);
+			cq_ring_size = params_.cq_off.cqes + params_.cq_entries * sizeof(io_uring_cqe);
+
+			if (params_.features & IORING_FEAT_SINGLE_MMAP) {
+				if (cq_ring_size > sq_ring_size)
+					sq_ring_size = cq_ring_size;
+				cq_ring_size = sq_ring_size;
+			}
+
+			sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQ_RING);
+			if (sq_ring == MAP_FAILED) {
+				int err = errno;
+				::close(fd_);
+				throw std::system_error(err, std::system_category(), "mmap IORING_OFF_SQ_RING");
+			}
+
+			if (params_.features & IORING_FEAT_SINGLE_MMAP) {
+				cq_ring = sq_ring;
+			} else {
+				cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_CQ_RING);
+				if (cq_ring == MAP_FAILED) {
+					int err = errno;
+					__unmap();
+					::close(fd_);
+					throw std::system_error(err, std::system_category(), "mmap IORING_OFF_CQ_RING");
+				}
+			}
+
+			sqes_size = params_.sq_entries * sizeof(io_uring_sqe);
+			sqes = (io_uring_sqe *)mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd_, IORING_OFF_SQES);
+			if (sqes == MAP_FAILED) {
+				int err = errno;
+				__unmap();
+				::close(fd_);
+				throw std::system_error(err, std::system_category(), "mmap IORING_OFF_SQES");
+			}
+
+			sq_head = __offset<unsigned>(sq_ring, params_.sq_off.head);
+			sq_tail = __offset<unsigned>(sq_ring, params_.sq_off.tail);
+			sq_mask = __offset<unsigned>(sq_ring, params_.sq_off.ring_mask);
+			sq_array = __offset<unsigned>(sq_ring, params_.sq_off.array);
+
+			cq_head = __offset<unsigned>(cq_ring, params_.cq_off.head);
+			cq_tail = __offset<unsigned>(cq_ring, params_.cq_off.tail);
+			cq_mask = __offset<unsigned>(cq_ring, params_.cq_off.ring_mask);
+			cqes = __offset<io_uring_cqe>(cq_ring, params_.cq_off.cqes);
+
+			sqe_head = sqe_tail = *sq_tail;
+		}
+
+		IoUring(const IoUring&) = delete;
+		IoUring& operator=(const IoUring&) = delete;
+
+		~IoUring() {
+			__unmap();
+			if (fd_ >= 0)
+				::close(fd_);
+		}
+
+		int fd() const noexcept {
+			return fd_;
+		}
+
+		const io_uring_params& params() const noexcept {
+			return params_;
+		}
+
+		unsigned pending() const noexcept {
+			return sqe_tail - sqe_head;
+		}
+
+		// Returns a zeroed SQE. Submits queued entries first if the SQ is full.
+		io_uring_sqe *get_sqe() {
+			std::error_code ec;
+			io_uring_sqe *sqe = get_sqe(ec);
+			if (!sqe)
+				throw std::system_error(ec, "io_uring SQ full");
+
+			return sqe;
+		}
+
+		// nullptr and EBUSY if the SQ is still full after submitting
+		io_uring_sqe *get_sqe(std::error_code& __ec) noexcept {
+			unsigned head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+
+			if (sqe_tail - head >= params_.sq_entries) {
+				submit();
+				head = __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+				if (sqe_tail - head >= params_.sq_entries) {
+					__ec.assign(EBUSY, std::system_category());
+					return nullptr;
+				}
+			}
+
+			__ec.clear();
+
+			io_uring_sqe *sqe = &sqes[sqe_tail & *sq_mask];
+			sqe_tail++;
+			memset(sqe, 0, sizeof(io_uring_sqe));
+			return sqe;
+		}
+
+		// Submits queued SQEs and waits for at least __wait_nr CQEs, or until __timeout_ms passes (-1 = forever).
+		// Returns the number of SQEs consumed, or -errno.
+		int submit_and_wait(unsigned __wait_nr = 0, int __timeout_ms = -1) noexcept {
+			unsigned to_submit = __flush_sq();
+			unsigned flags = __wait_nr ? IORING_ENTER_GETEVENTS : 0;
+
+			__kernel_timespec ts;
+			io_uring_getevents_arg arg{};
+			void *argp = nullptr;
+			size_t argsz = 0;
+
+			if (__wait_nr && __timeout_ms >= 0) {
+				ts.tv_sec = __timeout_ms / 1000;
+				ts.tv_nsec = (__timeout_ms % 1000) * 1000000LL;
+				arg.ts = (uint64_t)(uintptr_t)&ts;
+				argp = &arg;
+				argsz = sizeof(arg);
+				flags |= IORING_ENTER_EXT_ARG;
+			}
+
+			int rc;
+			do {
+				rc = (int)syscall(__NR_io_uring_enter, fd_, to_submit, __wait_nr, flags, argp, argsz);
+			} while (rc < 0 && errno == EINTR && !__wait_nr);
+
+			return rc < 0 ? -errno : rc;
+		}
+
+		int submit() noexcept {
+			if (!pending())
+				return 0;
+			return submit_and_wait(0);
+		}
+
+		// Calls __func(const io_uring_cqe&) for every available CQE, then releases them to the kernel.
+		template<typename F>
+		unsigned for_each_cqe(F&& __func) {
+			unsigned head = *cq_head;
+			unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+			unsigned count = 0;
+
+			while (head != tail) {
+				io_uring_cqe cqe = cqes[head & *cq_mask];
+				head++;
+				count++;
+				__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+				__func(cqe);
+				tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+			}
+
+			return count;
+		}
+
+		int register_(unsigned __opcode, void *__arg, unsigned __nr_args) noexcept {
+			int rc = (int)syscall(__NR_io_uring_register, fd_, __opcode, __arg, __nr_args);
+			return rc < 0 ? -errno : rc;
+		}
+	};
+
+	// Kernel-provided buffer ring (Linux 5.19+). The kernel picks a buffer only when data actually arrives,
+	// so idle connections hold no receive memory. Buffer storage is reserved lazily by the MM.
+	class IoUringBufferRing {
+	protected:
+		IoUring &ring_;
+		io_uring_buf_ring *br = (io_uring_buf_ring *)MAP_FAILED;
+		size_t br_size = 0;
+		uint8_t *storage = (uint8_t *)MAP_FAILED;
+		size_t storage_size = 0;
+
+		unsigned entries_, buf_size_;
+		uint16_t bgid_, tail_ = 0;
+		bool registered = false;
+
+		void __release() noexcept {
+			if (registered) {
+				io_uring_buf_reg reg{};
+				reg.bgid = bgid_;
+				ring_.register_(IORING_UNREGISTER_PBUF_RING, &reg, 1);
+			}
+			if (br != MAP_FAILED)
+				munmap(br, br_size);
+			if (storage != MAP_FAILED)
+				munmap(storage, storage_size);
+		}
+
+	public:
+		// __entries must be a power of 2 no larger than 32768
+		IoUringBufferRing(IoUring& __ring, uint16_t __bgid, unsigned __entries, unsigned __buf_size) :
+			ring_(__ring), entries_(__entries), buf_size_(__buf_size), bgid_(__bgid) {
+
+			if (!__entries || (__entries & (__entries - 1)) || __entries > 32768)
+				throw std::system_error(EINVAL, std::system_category(), "io_uring buffer ring size");
+
+			br_size = __entries * sizeof(io_uring_buf);
+			br = (io_uring_buf_ring *)mmap(nullptr, br_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (br == MAP_FAILED)
+				throw std::system_error(errno, std::system_category(), "mmap buffer ring");
+
+			storage_size = (size_t)__entries * __buf_size;
+			storage = (uint8_t *)mmap(nullptr, storage_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+			if (storage == MAP_FAILED) {
+				int err = errno;
+				__release();
+				throw std::system_error(err, std::system_category(), "mmap buffer storage");
+			}
+
+			io_uring_buf_reg reg{};
+			reg.ring_addr = (uint64_t)(uintptr_t)br;
+			reg.ring_entries = __entries;
+			reg.bgid = __bgid;
+
+			int rc = ring_.register_(IORING_REGISTER_PBUF_RING, &reg, 1);
+			if (rc < 0) {
+				__release();
+				throw std::system_error(-rc, std::system_category(), "IORING_REGISTER_PBUF_RING");
+			}
+			registered = true;
+
+			for (unsigned i=0; i<__entries; i++)
+				recycle(i);
+		}
+
+		IoUringBufferRing(const IoUringBufferRing&) = delete;
+		IoUringBufferRing& operator=(const IoUringBufferRing&) = delete;
+
+		~IoUringBufferRing() {
+			__release();
+		}
+
+		uint16_t group() const noexcept {
+			return bgid_;
+		}
+
+		unsigned buffer_size() const noexcept {
+			return buf_size_;
+		}
+
+		uint8_t *buffer(uint16_t __bid) noexcept {
+			return storage + (size_t)__bid * buf_size_;
+		}
+
+		// Hands a buffer back to the kernel
+		void recycle(uint16_t __bid) noexcept {
+			// Not br->bufs: in C++ the kernel's flex array wrapper puts it at offset 1
+			io_uring_buf &b = reinterpret_cast<io_uring_buf *>(br)[tail_ & (entries_ - 1)];
+			b.addr = (uint64_t)(uintptr_t)buffer(__bid);
+			b.len = buf_size_;
+			b.bid = __bid;
+			tail_++;
+			__atomic_store_n(&br->tail, tail_, __ATOMIC_RELEASE);
+		}
+	};
+
+#endif
+
+}
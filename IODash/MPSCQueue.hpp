@@ -0,0 +1,81 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <optional>
+
+namespace IODash {
+
+	// Lock-free multi-producer single-consumer queue (Vyukov). push() from any thread, pop() from one.
+	template<typename T>
+	class MPSCQueue {
+	protected:
+		struct Node {
+			std::atomic<Node *> next{nullptr};
+			std::optional<T> value;
+		};
+
+		std::atomic<Node *> head;
+		Node *tail;
+
+	public:
+		MPSCQueue() {
+			tail = new Node;
+			head.store(tail, std::memory_order_relaxed);
+		}
+
+		MPSCQueue(const MPSCQueue&) = delete;
+		MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+		~MPSCQueue() {
+			while (tail) {
+				Node *next = tail->next.load(std::memory_order_relaxed);
+				delete tail;
+				tail = next;
+			}
+		}
+
+		void push(T&& __value) {
+			Node *n = new Node;
+			n->value.emplace(std::move(__value));
+
+			Node *prev = head.exchange(n, std::memory_order_acq_rel);
+			prev->next.store(n, std::memory_order_release);
+		}
+
+		void push(const T& __value) {
+			push(T(__value));
+		}
+
+		// Consumer only. May miss an element whose push() is still in progress.
+		bool pop(T& __out) {
+			Node *next = tail->next.load(std::memory_order_acquire);
+
+			if (!next)
+				return false;
+
+			__out = std::move(*next->value);
+			next->value.reset();
+
+			delete tail;
+			tail = next;
+			return true;
+		}
+
+		bool empty() const {
+			return !tail->next.load(std::memory_order_acquire);
+		}
+	};
+
+}
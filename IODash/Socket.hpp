@@ -13,13 +13,22 @@
 #pragma once
 
 #include <vector>
+#include <string_view>
 #include <system_error>
 
 #include <unistd.h>
 #include <fcntl.h>
 
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+#ifdef __linux__
+#include <linux/errqueue.h>
+#endif
+
 #include "SocketAddress.hpp"
 #include "File.hpp"
+#include "FileDescriptor.hpp"
 
 namespace IODash {
 
@@ -27,6 +36,134 @@ namespace IODash {
 		Any = 0, Stream = SOCK_STREAM, Datagram = SOCK_DGRAM, SeqPacket = SOCK_SEQPACKET
 	};
 
+	template<AddressFamily AF, SocketType ST> class Socket;
+
+	// Slots for a batch of datagrams, each a buffer and a peer address, for Socket::recv_batch()/send_batch().
+	// recvmmsg()/sendmmsg() move a whole batch with one syscall. Received datagrams are valid until the next batch.
+	template<AddressFamily AF>
+	class DatagramBatch {
+	public:
+#ifdef __linux__
+		using Message = mmsghdr;
+#else
+		struct Message {
+			msghdr msg_hdr;
+			unsigned int msg_len;
+		};
+#endif
+
+	protected:
+		template<AddressFamily, SocketType> friend class Socket;
+
+		size_t slot_size_;
+		std::vector<uint8_t> storage_;
+		std::vector<SocketAddress<AF>> addresses_;
+		std::vector<iovec> iovs_;
+		std::vector<Message> msgs_;
+		// Datagrams received, or queued for sending and how many of those went out already
+		size_t count_ = 0, sent_ = 0;
+
+		void __set(size_t __idx, void *__buf, size_t __len) noexcept {
+			iovs_[__idx] = {__buf, __len};
+
+			auto &h = msgs_[__idx].msg_hdr;
+			h = {};
+			h.msg_name = addresses_[__idx].raw();
+			h.msg_namelen = addresses_[__idx].size();
+			h.msg_iov = &iovs_[__idx];
+			h.msg_iovlen = 1;
+			msgs_[__idx].msg_len = 0;
+		}
+
+		void __prepare_recv() noexcept {
+			for (size_t i=0; i<msgs_.size(); i++)
+				__set(i, storage_.data() + i * slot_size_, slot_size_);
+
+			count_ = sent_ = 0;
+		}
+
+	public:
+		// __slot_size: receive buffer per datagram, longer ones are truncated
+		DatagramBatch(size_t __capacity = 64, size_t __slot_size = 2048) :
+			slot_size_(__slot_size), storage_(__capacity * __slot_size), addresses_(__capacity), iovs_(__capacity), msgs_(__capacity) {
+
+		}
+
+		// Holds pointers into itself
+		DatagramBatch(const DatagramBatch&) = delete;
+		DatagramBatch& operator=(const DatagramBatch&) = delete;
+
+		size_t capacity() const noexcept {
+			return msgs_.size();
+		}
+
+		size_t slot_size() const noexcept {
+			return slot_size_;
+		}
+
+		// Datagrams received, or queued
+		size_t size() const noexcept {
+			return count_;
+		}
+
+		// Queued and not sent yet
+		size_t pending() const noexcept {
+			return count_ - sent_;
+		}
+
+		void clear() noexcept {
+			count_ = sent_ = 0;
+		}
+
+		const uint8_t *data(size_t __idx) const noexcept {
+			return (const uint8_t *)iovs_[__idx].iov_base;
+		}
+
+		size_t length(size_t __idx) const noexcept {
+			return msgs_[__idx].msg_len;
+		}
+
+		std::string_view view(size_t __idx) const noexcept {
+			return {(const char *)data(__idx), length(__idx)};
+		}
+
+		const SocketAddress<AF>& address(size_t __idx) const noexcept {
+			return addresses_[__idx];
+		}
+
+		// Didn't fit in its slot
+		bool truncated(size_t __idx) const noexcept {
+			return msgs_[__idx].msg_hdr.msg_flags & MSG_TRUNC;
+		}
+
+		// Queues a datagram sent straight from __buf, which must stay valid until send_batch() is done with it.
+		// False if the batch is full.
+		bool push(const SocketAddress<AF>& __addr, const void *__buf, size_t __len) noexcept {
+			if (count_ == msgs_.size())
+				return false;
+
+			addresses_[count_] = __addr;
+			__set(count_, (void *)__buf, __len);
+			count_++;
+			return true;
+		}
+
+		// Same, but copied into the batch's own slot. False if full or longer than a slot.
+		bool push_copy(const SocketAddress<AF>& __addr, const void *__buf, size_t __len) noexcept {
+			if (count_ == msgs_.size() || __len > slot_size_)
+				return false;
+
+			uint8_t *slot = storage_.data() + count_ * slot_size_;
+			memcpy(slot, __buf, __len);
+			return push(__addr, slot, __len);
+		}
+	};
+
+	// Coroutine awaitables, defined in Coroutine.hpp (C++20)
+	template<typename EL, typename S> class RecvAwaiter;
+	template<typename EL, typename S> class SendAwaiter;
+	template<typename EL, typename S> class AcceptAwaiter;
+
 	template<AddressFamily AF, SocketType ST>
 	class Socket : public File {
 	private:
@@ -43,48 +180,102 @@ namespace IODash {
 		using File::set_nonblocking;
 
 		SocketAddress<AF> local_address() {
+			std::error_code ec;
+			SocketAddress<AF> ret = local_address(ec);
+			if (ec)
+				throw std::system_error(ec, "failed to get local address");
+
+			return ret;
+		}
+
+		SocketAddress<AF> local_address(std::error_code& __ec) noexcept {
 			SocketAddress<AF> ret;
 			socklen_t sz = ret.size();
-			if (getsockname(fd_, ret.raw(), &sz))
-				throw std::system_error(errno, std::system_category(), "failed to get local address");
-
+			__errno_to(__ec, getsockname(fd_, ret.raw(), &sz));
 			return ret;
 		}
 
 		SocketAddress<AF> remote_address() {
+			std::error_code ec;
+			SocketAddress<AF> ret = remote_address(ec);
+			if (ec)
+				throw std::system_error(ec, "failed to get remote address");
+
+			return ret;
+		}
+
+		SocketAddress<AF> remote_address(std::error_code& __ec) noexcept {
 			SocketAddress<AF> ret;
 			socklen_t sz = ret.size();
-			if (getpeername(fd_, ret.raw(), &sz))
-				throw std::system_error(errno, std::system_category(), "failed to get remote address");
-
+			__errno_to(__ec, getpeername(fd_, ret.raw(), &sz));
 			return ret;
 		}
 
 		void create() {
+			std::error_code ec;
+			create(ec);
+			if (ec)
+				throw std::system_error(ec, "failed to create socket");
+		}
+
+		void create(std::error_code& __ec) noexcept {
 			close();
 
 			fd_ = socket((int)AF, (int)ST, 0);
 
-			if (fd_ < 0)
-				throw std::system_error(errno, std::system_category(), "failed to create socket");
+			if (fd_ < 0) {
+				__ec.assign(errno, std::system_category());
+				return;
+			}
 
-			refcounter.reset((int *)nullptr);
+			__adopt(__ec);
 		}
 
 		void set_reuseaddr(bool __enable = true) {
+			std::error_code ec;
+			set_reuseaddr(__enable, ec);
+			if (ec)
+				throw std::system_error(ec, "failed to setsockopt");
+		}
+
+		void set_reuseaddr(bool __enable, std::error_code& __ec) noexcept {
 			int enable = __enable ? 1 : 0;
-			if (::setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)))
-				throw std::system_error(errno, std::system_category(), "failed to setsockopt");
+			__errno_to(__ec, ::setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable)));
+		}
+
+		// Lets several sockets bind the same address, the kernel load balances incoming connections among them
+		void set_reuseport(bool __enable = true) {
+			std::error_code ec;
+			set_reuseport(__enable, ec);
+			if (ec)
+				throw std::system_error(ec, "failed to setsockopt");
+		}
+
+		void set_reuseport(bool __enable, std::error_code& __ec) noexcept {
+			int enable = __enable ? 1 : 0;
+			__errno_to(__ec, ::setsockopt(fd_, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)));
 		}
 
 		void listen(int __backlog = 256) {
-			if (::listen(fd_, __backlog))
-				throw std::system_error(errno, std::system_category(), "failed to listen on socket");
+			std::error_code ec;
+			listen(__backlog, ec);
+			if (ec)
+				throw std::system_error(ec, "failed to listen on socket");
+		}
+
+		void listen(int __backlog, std::error_code& __ec) noexcept {
+			__errno_to(__ec, ::listen(fd_, __backlog));
 		}
 
 		void bind(const SocketAddress<AF>& __addr) {
-			if (::bind(fd_, __addr.raw(), __addr.size()))
-				throw std::system_error(errno, std::system_category(), "failed to bind socket");
+			std::error_code ec;
+			bind(__addr, ec);
+			if (ec)
+				throw std::system_error(ec, "failed to bind socket");
+		}
+
+		void bind(const SocketAddress<AF>& __addr, std::error_code& __ec) noexcept {
+			__errno_to(__ec, ::bind(fd_, __addr.raw(), __addr.size()));
 		}
 
 		bool connect(const SocketAddress<AF>& __addr) {
@@ -93,9 +284,42 @@ namespace IODash {
 			return rc;
 		}
 
+		// Returns true if connected right away. On a non-blocking socket, false with __ec clear means the connect
+		// is in progress: wait for Out, then check connect_error(). See async_connect().
+		bool connect(const SocketAddress<AF>& __addr, std::error_code& __ec) noexcept {
+			__ec.clear();
+
+			if (::connect(fd_, __addr.raw(), __addr.size()) == 0)
+				return true;
+
+			// EINTR: the connect goes on asynchronously, same as EINPROGRESS
+			if (errno != EINPROGRESS && errno != EINTR)
+				__ec.assign(errno, std::system_category());
+
+			return false;
+		}
+
+		// Outcome of a non-blocking connect once the socket is writable (SO_ERROR, which it clears)
+		std::error_code connect_error() const noexcept {
+			int err = 0;
+			socklen_t len = sizeof(err);
+
+			if (::getsockopt(fd_, SOL_SOCKET, SO_ERROR, &err, &len))
+				err = errno;
+
+			return {err, std::system_category()};
+		}
+
 		void shutdown(int __how = SHUT_RDWR) {
-			if (::shutdown(fd_, __how))
-				throw std::system_error(errno, std::system_category(), "failed to shutdown socket");
+			std::error_code ec;
+			shutdown(__how, ec);
+			if (ec)
+				throw std::system_error(ec, "failed to shutdown socket");
+		}
+
+		// E.g. ENOTCONN when the peer already reset the connection, which is routine under churn
+		void shutdown(int __how, std::error_code& __ec) noexcept {
+			__errno_to(__ec, ::shutdown(fd_, __how));
 		}
 
 		Socket<AF, ST> accept() {
@@ -103,6 +327,16 @@ namespace IODash {
 			return {newfd};
 		}
 
+		// Without File's refcount, for EventLoop::add(UniqueFd&&). Invalid with errno set on failure.
+		// __flags are accept4() flags (SOCK_NONBLOCK etc.), ignored where accept4() doesn't exist.
+		UniqueFd accept_fd(int __flags = 0) noexcept {
+#ifdef __linux__
+			return UniqueFd(::accept4(fd_, nullptr, nullptr, __flags));
+#else
+			return UniqueFd(::accept(fd_, nullptr, nullptr));
+#endif
+		}
+
 		int setsockopt(int __level, int __optname, const void *__optval, socklen_t __optlen) {
 			return ::setsockopt(fd_, __level, __optname, __optval, __optlen);
 		}
@@ -127,6 +361,340 @@ namespace IODash {
 			size_t sz = __addr.size();
 			return ::recvfrom(fd_, __buf, __len, __flags, __addr.raw(), &sz);
 		}
+
+		ssize_t sendmsg(const msghdr *__msg, int __flags = 0) {
+			return ::sendmsg(fd_, __msg, __flags);
+		}
+
+		ssize_t recvmsg(msghdr *__msg, int __flags = 0) {
+			return ::recvmsg(fd_, __msg, __flags);
+		}
+
+		// Gathered send() through sendmsg(), so flags like MSG_NOSIGNAL work unlike with writev()
+		ssize_t sendv(const iovec *__iov, int __iovcnt, int __flags = 0) {
+			msghdr msg{};
+			msg.msg_iov = (iovec *)__iov;
+			msg.msg_iovlen = __iovcnt;
+			return ::sendmsg(fd_, &msg, __flags);
+		}
+
+		// One datagram from several buffers
+		ssize_t sendv(const SocketAddress<AF>& __addr, const iovec *__iov, int __iovcnt, int __flags = 0) {
+			msghdr msg{};
+			msg.msg_name = (void *)__addr.raw();
+			msg.msg_namelen = __addr.size();
+			msg.msg_iov = (iovec *)__iov;
+			msg.msg_iovlen = __iovcnt;
+			return ::sendmsg(fd_, &msg, __flags);
+		}
+
+		ssize_t recvv(const iovec *__iov, int __iovcnt, int __flags = 0) {
+			msghdr msg{};
+			msg.msg_iov = (iovec *)__iov;
+			msg.msg_iovlen = __iovcnt;
+			return ::recvmsg(fd_, &msg, __flags);
+		}
+
+		// Like File::writev_all() with send flags. __iov is updated in place: on failure its non-empty entries are
+		// what's left, e.g. to continue on EAGAIN once the socket is writable.
+		ssize_t sendv_all(iovec *__iov, int __iovcnt, int __flags = MSG_NOSIGNAL) {
+			size_t sent = 0;
+
+			while (__iovcnt) {
+				ssize_t rc = sendv(__iov, __iov_batch(__iovcnt), __flags);
+				if (rc > 0) {
+					sent += rc;
+					__advance_iov(__iov, __iovcnt, rc);
+				} else if (rc == 0) {
+					return sent;
+				} else if (errno != EINTR) {
+					return -1;
+				}
+			}
+
+			return sent;
+		}
+
+		// Receives as many datagrams as fit in __batch with one recvmmsg(), replacing its contents. Returns how many,
+		// or -1 with errno set (EAGAIN if there were none). Doesn't block unless __flags says otherwise.
+		int recv_batch(DatagramBatch<AF>& __batch, int __flags = MSG_DONTWAIT) {
+			__batch.__prepare_recv();
+
+#ifdef __linux__
+			int rc = ::recvmmsg(fd_, __batch.msgs_.data(), __batch.msgs_.size(), __flags, nullptr);
+#else
+			int rc = 0;
+			for (; rc < (int)__batch.msgs_.size(); rc++) {
+				ssize_t len = ::recvmsg(fd_, &__batch.msgs_[rc].msg_hdr, rc ? __flags | MSG_DONTWAIT : __flags);
+				if (len < 0)
+					break;
+				__batch.msgs_[rc].msg_len = len;
+			}
+			if (!rc)
+				rc = -1;
+#endif
+
+			if (rc > 0)
+				__batch.count_ = rc;
+
+			return rc;
+		}
+
+		// Sends what's queued in __batch and wasn't sent yet with one sendmmsg(). Returns how many went out, the batch
+		// is cleared once all did. -1 with errno set if none did, e.g. EAGAIN: call again when writable.
+		int send_batch(DatagramBatch<AF>& __batch, int __flags = 0) {
+			if (!__batch.pending())
+				return 0;
+
+#ifdef __linux__
+			int rc = ::sendmmsg(fd_, __batch.msgs_.data() + __batch.sent_, __batch.pending(), __flags);
+#else
+			int rc = 0;
+			for (; rc < (int)__batch.pending(); rc++) {
+				if (::sendmsg(fd_, &__batch.msgs_[__batch.sent_ + rc].msg_hdr, __flags) < 0)
+					break;
+			}
+			if (!rc)
+				rc = -1;
+#endif
+
+			if (rc > 0) {
+				__batch.sent_ += rc;
+				if (!__batch.pending())
+					__batch.clear();
+			}
+
+			return rc;
+		}
+
+#ifdef UDP_SEGMENT
+		// UDP segmentation offload (Linux 4.18+): one send of a large buffer leaves as datagrams of __segment_size
+		// bytes (the last one may be shorter), so the stack is traversed once per buffer instead of once per datagram.
+		// Sets the default for every send, 0 turns it off. See send_segmented() for a single send.
+		void set_gso_segment(uint16_t __segment_size, std::error_code& __ec) noexcept {
+			int val = __segment_size;
+			__errno_to(__ec, ::setsockopt(fd_, SOL_UDP, UDP_SEGMENT, &val, sizeof(val)));
+		}
+
+		void set_gso_segment(uint16_t __segment_size) {
+			std::error_code ec;
+			set_gso_segment(__segment_size, ec);
+			if (ec)
+				throw std::system_error(ec, "failed to set UDP_SEGMENT");
+		}
+
+		// Sends __buf as datagrams of __segment_size bytes, to __addr or the connected peer if nullptr.
+		// Buffers over the kernel's limit (64 segments, 64K) are split into several sends.
+		// Returns the bytes sent, or -1 with errno set if nothing was. EINVAL: __segment_size is 0 or over the 64K limit.
+		ssize_t send_segmented(const SocketAddress<AF> *__addr, const void *__buf, size_t __len, uint16_t __segment_size, int __flags = 0) {
+			// 64K minus IPv6 and UDP headers
+			constexpr size_t max_payload = 65535 - 40 - 8;
+
+			if (!__segment_size || __segment_size > max_payload) {
+				errno = EINVAL;
+				return -1;
+			}
+
+			// And UDP_MAX_SEGMENTS
+			size_t per_send = std::min<size_t>(max_payload, (size_t)__segment_size * 64) / __segment_size * __segment_size;
+			size_t sent = 0;
+
+			alignas(cmsghdr) char control[CMSG_SPACE(sizeof(uint16_t))] = {};
+
+			while (sent < __len) {
+				size_t n = std::min(per_send, __len - sent);
+				iovec iov{(uint8_t *)__buf + sent, n};
+
+				msghdr msg{};
+				msg.msg_iov = &iov;
+				msg.msg_iovlen = 1;
+				if (__addr) {
+					msg.msg_name = (void *)__addr->raw();
+					msg.msg_namelen = __addr->size();
+				}
+
+				// A single datagram needs no segmentation, and the kernel rejects segment sizes above its length on some versions
+				if (n > __segment_size) {
+					msg.msg_control = control;
+					msg.msg_controllen = sizeof(control);
+
+					cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+					cm->cmsg_level = SOL_UDP;
+					cm->cmsg_type = UDP_SEGMENT;
+					cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+					memcpy(CMSG_DATA(cm), &__segment_size, sizeof(uint16_t));
+				}
+
+				ssize_t rc = ::sendmsg(fd_, &msg, __flags);
+				if (rc < 0) {
+					if (errno == EINTR)
+						continue;
+					return sent ? (ssize_t)sent : -1;
+				}
+
+				sent += rc;
+			}
+
+			return sent;
+		}
+#endif
+
+#ifdef UDP_GRO
+		// UDP receive offload (Linux 5.0+): consecutive datagrams of one flow may arrive coalesced in one
+		// recv_coalesced() call, see there. Plain recv() on such a socket would see them glued together.
+		void set_gro(bool __enable, std::error_code& __ec) noexcept {
+			int val = __enable;
+			__errno_to(__ec, ::setsockopt(fd_, SOL_UDP, UDP_GRO, &val, sizeof(val)));
+		}
+
+		void set_gro(bool __enable = true) {
+			std::error_code ec;
+			set_gro(__enable, ec);
+			if (ec)
+				throw std::system_error(ec, "failed to set UDP_GRO");
+		}
+
+		// Receives one or several coalesced datagrams into __buf, which should hold 64K to get the most of GRO.
+		// __segment_size is set to the size of each datagram, all equal but the last, which may be shorter.
+		// Split them with for_each_segment(). Returns the total length, or -1 with errno set.
+		ssize_t recv_coalesced(void *__buf, size_t __len, size_t& __segment_size, SocketAddress<AF> *__from = nullptr, int __flags = 0) {
+			iovec iov{__buf, __len};
+			alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+
+			msghdr msg{};
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			msg.msg_control = control;
+			msg.msg_controllen = sizeof(control);
+			if (__from) {
+				msg.msg_name = __from->raw();
+				msg.msg_namelen = __from->size();
+			}
+
+			ssize_t rc = ::recvmsg(fd_, &msg, __flags);
+			if (rc < 0)
+				return rc;
+
+			__segment_size = rc;
+
+			for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+				if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+					int gso_size;
+					memcpy(&gso_size, CMSG_DATA(cm), sizeof(gso_size));
+					if (gso_size > 0)
+						__segment_size = gso_size;
+				}
+			}
+
+			return rc;
+		}
+#endif
+
+		// Calls __func(const uint8_t *data, size_t len) for each datagram of a coalesced receive
+		template<typename F>
+		static void for_each_segment(const void *__buf, size_t __len, size_t __segment_size, const F& __func) {
+			if (!__segment_size)
+				__segment_size = __len;
+
+			for (size_t pos = 0; pos < __len; pos += __segment_size)
+				__func((const uint8_t *)__buf + pos, std::min(__segment_size, __len - pos));
+		}
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+		// Allows send(..., MSG_ZEROCOPY) (Linux 4.14+, UDP since 5.0): the kernel pins and sends the user pages instead of
+		// copying them, and the buffer must not change until a completion on the error queue says it's done with it.
+		// Only pays off for large sends (~10K+). See EventLoop::send_zerocopy(), which tracks the completions.
+		void set_zerocopy(bool __enable, std::error_code& __ec) noexcept {
+			int enable = __enable ? 1 : 0;
+			__errno_to(__ec, ::setsockopt(fd_, SOL_SOCKET, SO_ZEROCOPY, &enable, sizeof(enable)));
+		}
+
+		void set_zerocopy(bool __enable = true) {
+			std::error_code ec;
+			set_zerocopy(__enable, ec);
+			if (ec)
+				throw std::system_error(ec, "failed to set SO_ZEROCOPY");
+		}
+
+		// Drains the zerocopy completions from the error queue. Every successful MSG_ZEROCOPY send gets the next
+		// 32-bit id, counting from 0; __func(uint32_t first, uint32_t last, bool copied) is called for each finished
+		// range of ids. copied: the kernel had to copy after all (e.g. loopback), zerocopy only costs extra there.
+		// Anything else queued (ICMP errors with IP_RECVERR...) is dequeued too, it goes to __other(const sock_extended_err&).
+		// Returns the number of ranges.
+		template<typename F, typename G>
+		size_t read_zerocopy_completions(const F& __func, const G& __other) {
+			size_t ret = 0;
+
+			while (true) {
+				alignas(cmsghdr) char control[CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in6))];
+
+				msghdr msg{};
+				msg.msg_control = control;
+				msg.msg_controllen = sizeof(control);
+
+				if (::recvmsg(fd_, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+					if (errno == EINTR)
+						continue;
+					return ret;
+				}
+
+				for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+					if (!((cm->cmsg_level == SOL_IP && cm->cmsg_type == IP_RECVERR) ||
+					      (cm->cmsg_level == SOL_IPV6 && cm->cmsg_type == IPV6_RECVERR)))
+						continue;
+
+					sock_extended_err ee;
+					memcpy(&ee, CMSG_DATA(cm), sizeof(ee));
+
+					if (ee.ee_errno || ee.ee_origin != SO_EE_ORIGIN_ZEROCOPY) {
+						__other(ee);
+						continue;
+					}
+
+					__func(ee.ee_info, ee.ee_data, (ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED) != 0);
+					ret++;
+				}
+			}
+		}
+#endif
+
+		// Non-blocking connect completed by __loop, see EventLoop::async_connect()
+		template<typename EL, typename F>
+		void async_connect(EL& __loop, const SocketAddress<AF>& __addr, uint64_t __timeout_ms, F&& __handler) const {
+			__loop.async_connect(*this, __addr, __timeout_ms, std::forward<F>(__handler));
+		}
+
+		// Completion-based I/O, see EventLoop<EventBackend::IoUring>
+		template<typename EL, typename F>
+		uint64_t async_accept(EL& __loop, const F& __handler) const {
+			return __loop.async_accept(*this, __handler);
+		}
+
+		template<typename EL, typename F>
+		uint64_t async_recv(EL& __loop, const F& __handler) const {
+			return __loop.async_recv(*this, __handler);
+		}
+
+		template<typename EL, typename F>
+		uint64_t async_send(EL& __loop, const void *__buf, size_t __len, const F& __handler) const {
+			return __loop.async_send(*this, __buf, __len, __handler);
+		}
+
+		// co_await socket.async_recv(loop, buf, len) and friends, see Coroutine.hpp
+		template<typename EL>
+		RecvAwaiter<EL, Socket> async_recv(EL& __loop, void *__buf, size_t __len) {
+			return {__loop, *this, __buf, __len};
+		}
+
+		template<typename EL>
+		SendAwaiter<EL, Socket> async_send(EL& __loop, const void *__buf, size_t __len) {
+			return {__loop, *this, __buf, __len};
+		}
+
+		template<typename EL>
+		AcceptAwaiter<EL, Socket> async_accept(EL& __loop) {
+			return {__loop, *this};
+		}
 	};
 }
 
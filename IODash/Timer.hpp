@@ -27,10 +27,15 @@ namespace IODash {
 
 #ifdef __linux__
 
+	// Coroutine awaitable, defined in Coroutine.hpp (C++20)
+	template<typename EL> class TimerAwaiter;
+
 	class Timer : public File {
 	private:
 		using File::read;
 		using File::write;
+		using File::async_read;
+		using File::async_write;
 
 	public:
 		Timer(int __clockid = CLOCK_MONOTONIC, int __flags = 0) {
@@ -86,6 +91,12 @@ namespace IODash {
 				return {};
 		}
 
+		// co_await timer.async_wait(loop), see Coroutine.hpp
+		template<typename EL>
+		TimerAwaiter<EL> async_wait(EL& __loop) {
+			return {__loop, *this};
+		}
+
 	};
 
 #endif
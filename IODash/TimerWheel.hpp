@@ -0,0 +1,305 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#pragma once
+
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+
+#include <cstdint>
+
+namespace IODash {
+
+	// Hierarchical timing wheel with 1 ms ticks: 4 levels of 64 slots, covering ~4.6 hours directly.
+	// Farther deadlines are parked in the top level and cascaded again. Schedule and cancel are O(1),
+	// nodes come from a free list so a busy wheel doesn't allocate. Not thread safe.
+	// Callbacks are invoked as __func(Args...) with the arguments given to advance().
+	template<typename... Args>
+	class TimerWheel {
+	public:
+		using Callback = std::function<void(Args...)>;
+
+	protected:
+		static constexpr unsigned levels = 4;
+		static constexpr unsigned slot_bits = 6;
+		static constexpr unsigned slots = 1U << slot_bits;
+		static constexpr uint64_t slot_mask = slots - 1;
+		static constexpr uint32_t nil = UINT32_MAX;
+		// Pseudo level of the nodes being fired, so cancel() still works on them
+		static constexpr uint8_t level_expiring = levels;
+
+		struct Node {
+			Callback callback;
+			uint64_t expire = 0;
+			uint32_t prev = nil, next = nil;
+			uint32_t generation = 0;
+			uint8_t level = 0, slot = 0;
+			bool active = false;
+		};
+
+		std::vector<Node> nodes;
+		uint32_t free_head = nil;
+
+		uint32_t heads[levels][slots];
+		uint64_t occupied[levels] = {};
+		uint32_t expiring_head = nil;
+
+		// Next tick to process, in ms of the steady clock
+		uint64_t current;
+		size_t count_ = 0;
+
+		static uint64_t __now() noexcept {
+			return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		}
+
+		uint32_t& __head(const Node& __n) noexcept {
+			return __n.level == level_expiring ? expiring_head : heads[__n.level][__n.slot];
+		}
+
+		void __link(uint32_t __idx, uint8_t __level, uint8_t __slot) noexcept {
+			Node &n = nodes[__idx];
+			n.level = __level;
+			n.slot = __slot;
+
+			uint32_t &head = __head(n);
+			n.prev = nil;
+			n.next = head;
+			if (head != nil)
+				nodes[head].prev = __idx;
+			head = __idx;
+
+			if (__level != level_expiring)
+				occupied[__level] |= 1ULL << __slot;
+		}
+
+		void __unlink(uint32_t __idx) noexcept {
+			Node &n = nodes[__idx];
+
+			if (n.prev != nil)
+				nodes[n.prev].next = n.next;
+			else
+				__head(n) = n.next;
+
+			if (n.next != nil)
+				nodes[n.next].prev = n.prev;
+
+			if (n.level != level_expiring && heads[n.level][n.slot] == nil)
+				occupied[n.level] &= ~(1ULL << n.slot);
+		}
+
+		void __insert(uint32_t __idx) noexcept {
+			Node &n = nodes[__idx];
+
+			if (n.expire < current)
+				n.expire = current;
+
+			uint64_t delta = n.expire - current;
+			uint64_t expire = n.expire;
+
+			unsigned level = 0;
+			while (level < levels - 1 && delta >= (1ULL << (slot_bits * (level + 1))))
+				level++;
+
+			// Beyond the wheel's range: park it in the farthest top level slot, it'll be cascaded again
+			if (delta >= (1ULL << (slot_bits * levels)))
+				expire = current + (1ULL << (slot_bits * levels)) - 1;
+
+			__link(__idx, level, (expire >> (slot_bits * level)) & slot_mask);
+		}
+
+		void __free(uint32_t __idx) noexcept {
+			Node &n = nodes[__idx];
+			n.active = false;
+			n.callback = nullptr;
+			n.next = free_head;
+			free_head = __idx;
+			count_--;
+		}
+
+		void __cascade(unsigned __level, unsigned __slot) noexcept {
+			uint32_t &head = heads[__level][__slot];
+
+			while (head != nil) {
+				uint32_t idx = head;
+				__unlink(idx);
+				__insert(idx);
+			}
+		}
+
+		static uint64_t __id(uint32_t __idx, uint32_t __generation) noexcept {
+			return ((uint64_t)__generation << 32) | __idx;
+		}
+
+		Node *__lookup(uint64_t __id) noexcept {
+			uint32_t idx = (uint32_t)__id;
+
+			if (idx >= nodes.size() || !nodes[idx].active || nodes[idx].generation != (uint32_t)(__id >> 32))
+				return nullptr;
+
+			return &nodes[idx];
+		}
+
+	public:
+		TimerWheel() {
+			for (auto &it : heads)
+				for (auto &jt : it)
+					jt = nil;
+
+			current = __now();
+		}
+
+		// Number of pending timers
+		size_t size() const noexcept {
+			return count_;
+		}
+
+		// Calls __func after __delay_ms. Returns an id for cancel()/reschedule(), never 0.
+		uint64_t schedule(uint64_t __delay_ms, Callback __func) {
+			uint32_t idx;
+
+			if (free_head != nil) {
+				idx = free_head;
+				free_head = nodes[idx].next;
+			} else {
+				idx = nodes.size();
+				nodes.emplace_back();
+			}
+
+			Node &n = nodes[idx];
+			n.generation++;
+			if (!n.generation)
+				n.generation = 1;
+			n.callback = std::move(__func);
+			n.expire = __now() + __delay_ms;
+			n.active = true;
+			count_++;
+
+			__insert(idx);
+			return __id(idx, n.generation);
+		}
+
+		// Returns false if the timer already fired or was cancelled
+		bool cancel(uint64_t __id) noexcept {
+			Node *n = __lookup(__id);
+
+			if (!n)
+				return false;
+
+			uint32_t idx = (uint32_t)__id;
+			__unlink(idx);
+			__free(idx);
+			return true;
+		}
+
+		// Moves a pending timer to __delay_ms from now, e.g. an idle timeout after activity
+		bool reschedule(uint64_t __id, uint64_t __delay_ms) noexcept {
+			Node *n = __lookup(__id);
+
+			if (!n)
+				return false;
+
+			uint32_t idx = (uint32_t)__id;
+			__unlink(idx);
+			n->expire = __now() + __delay_ms;
+			__insert(idx);
+			return true;
+		}
+
+		// Milliseconds until the next timer may fire: -1 if there's none, possibly earlier than
+		// the actual deadline when it sits in an upper level (advance() just cascades then).
+		int timeout_ms() const noexcept {
+			if (!count_)
+				return -1;
+
+			uint64_t next = UINT64_MAX;
+
+			for (unsigned level=0; level<levels; level++) {
+				if (!occupied[level])
+					continue;
+
+				// Level 0 slots are due when reached, upper level slots are cascaded when their start is reached.
+				// pos is the first slot whose start hasn't been processed yet.
+				unsigned shift = slot_bits * level;
+				uint64_t pos = (current + (1ULL << shift) - 1) >> shift;
+
+				unsigned rot = pos & slot_mask;
+				uint64_t bits = occupied[level];
+				bits = rot ? (bits >> rot) | (bits << (slots - rot)) : bits;
+
+				uint64_t at = (pos + __builtin_ctzll(bits)) << shift;
+				if (at < next)
+					next = at;
+			}
+
+			uint64_t now = __now();
+			if (next <= now)
+				return 0;
+
+			uint64_t ret = next - now;
+			return ret > INT32_MAX ? INT32_MAX : (int)ret;
+		}
+
+		// Fires every timer that is due. Returns how many fired.
+		size_t advance(Args... __args) {
+			uint64_t now = __now();
+			size_t fired = 0;
+
+			while (current <= now) {
+				if (!count_) {
+					current = now + 1;
+					break;
+				}
+
+				uint64_t t = current;
+
+				// Nothing to fire or cascade before the next level 0 wrap
+				if ((t & slot_mask) && !occupied[0]) {
+					current = std::min((t | slot_mask) + 1, now + 1);
+					continue;
+				}
+
+				for (unsigned level=1; level<levels; level++) {
+					unsigned shift = slot_bits * level;
+					if (t & ((1ULL << shift) - 1))
+						break;
+					__cascade(level, (t >> shift) & slot_mask);
+				}
+
+				// Timers scheduled by the callbacks below land at t + 1 or later
+				current = t + 1;
+
+				uint32_t &head = heads[0][t & slot_mask];
+				while (head != nil) {
+					uint32_t idx = head;
+					__unlink(idx);
+					__link(idx, level_expiring, 0);
+				}
+
+				while (expiring_head != nil) {
+					uint32_t idx = expiring_head;
+					__unlink(idx);
+
+					Callback cb = std::move(nodes[idx].callback);
+					__free(idx);
+
+					cb(__args...);
+					fired++;
+				}
+			}
+
+			return fired;
+		}
+	};
+
+}
@@ -0,0 +1,143 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+#include <cstring>
+
+using namespace IODash;
+
+static std::string temp_path() {
+	char path[] = "/tmp/IODash_AsyncFileIO_XXXXXX";
+	int fd = mkstemp(path);
+	CHECK(fd >= 0);
+	::close(fd);
+	return path;
+}
+
+// Write, sync, read back (from disk and from the cache), past EOF, and an error, each started from the previous one
+template<EventBackend B>
+static void test_chain() {
+	std::string path = temp_path();
+	File f, dir;
+	f.open(path, O_RDWR);
+	dir.open("/tmp", O_RDONLY | O_DIRECTORY);
+
+	std::vector<char> data(1 << 20), rd(data.size() + 100);
+	for (size_t i=0; i<data.size(); i++)
+		data[i] = (char)(i * 7);
+
+	EventLoop<B> loop;
+	int steps = 0;
+	bool returned = false, inner_returned = false;
+
+	f.async_pwrite(loop, data.data(), data.size(), 0, [&](auto& l, size_t n, std::error_code ec){
+		CHECK(returned);
+		CHECK(!ec && n == data.size());
+		steps++;
+
+		f.async_fsync(l, [&](auto& l, std::error_code ec){
+			CHECK(!ec);
+			steps++;
+
+			posix_fadvise(f.fd(), 0, 0, POSIX_FADV_DONTNEED);
+
+			f.async_pread(l, rd.data(), rd.size(), 0, [&](auto& l, size_t n, std::error_code ec){
+				CHECK(!ec && n == data.size());
+				CHECK(!memcmp(rd.data(), data.data(), n));
+				steps++;
+
+				// Cached by now, and still not called before async_pread() returns
+				f.async_pread(l, rd.data(), 10, 5, [&](auto& l, size_t n, std::error_code ec){
+					CHECK(inner_returned);
+					CHECK(!ec && n == 10 && !memcmp(rd.data(), data.data() + 5, 10));
+					steps++;
+
+					f.async_pread(l, rd.data(), 10, 1 << 21, [&](auto& l, size_t n, std::error_code ec){
+						CHECK(!ec && n == 0);
+						steps++;
+
+						dir.async_pread(l, rd.data(), 10, 0, [&](auto& l, size_t, std::error_code ec){
+							CHECK(ec == std::error_code(EISDIR, std::system_category()));
+							steps++;
+							l.stop();
+						});
+					});
+				});
+				inner_returned = true;
+			});
+		}, true);
+	});
+	returned = true;
+
+	loop.add_timer(5000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(steps == 6);
+	::unlink(path.c_str());
+}
+
+// Many in flight at once, each completing with its own range
+template<EventBackend B>
+static void test_concurrent() {
+	std::string path = temp_path();
+	File f;
+	f.open(path, O_RDWR);
+
+	const size_t n = 64, len = 4096;
+	std::vector<std::vector<char>> blocks(n, std::vector<char>(len));
+	for (size_t i=0; i<n; i++)
+		memset(blocks[i].data(), 'a' + (i % 26), len);
+
+	EventLoop<B> loop;
+	loop.set_blocking_threads(2);
+	size_t written = 0, verified = 0;
+
+	for (size_t i=0; i<n; i++) {
+		f.async_pwrite(loop, blocks[i].data(), len, i * len, [&, i](auto& l, size_t done, std::error_code ec){
+			CHECK(!ec && done == len);
+
+			if (++written < n)
+				return;
+
+			for (size_t j=0; j<n; j++) {
+				auto buf = std::make_shared<std::vector<char>>(len);
+				f.async_pread(l, buf->data(), len, j * len, [&, j, buf](auto& l, size_t done, std::error_code ec){
+					CHECK(!ec && done == len);
+					CHECK(*buf == blocks[j]);
+
+					if (++verified == n)
+						l.stop();
+				});
+			}
+		});
+	}
+
+	loop.add_timer(5000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(verified == n);
+	::unlink(path.c_str());
+}
+
+int main() {
+	test_chain<EventBackend::Poll>();
+	test_chain<EventBackend::EPoll>();
+	test_chain<EventBackend::IoUring>();
+
+	test_concurrent<EventBackend::Poll>();
+	test_concurrent<EventBackend::EPoll>();
+	test_concurrent<EventBackend::IoUring>();
+
+	puts("ok");
+}
@@ -0,0 +1,143 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+#include <cstring>
+
+using namespace IODash;
+
+using Udp = Socket<AddressFamily::IPv4, SocketType::Datagram>;
+
+static std::pair<Udp, Udp> bound_pair() {
+	Udp rx, tx;
+
+	rx.create();
+	rx.bind({"127.0.0.1:0"});
+	int big = 4 << 20;
+	rx.setsockopt(SOL_SOCKET, SO_RCVBUF, &big, sizeof(big));
+
+	tx.create();
+	tx.bind({"127.0.0.1:0"});
+
+	return {rx, tx};
+}
+
+// Queueing limits, one sendmmsg() and one recvmmsg() for a whole batch, truncation
+static void test_batch() {
+	auto [rx, tx] = bound_pair();
+	auto addr = rx.local_address();
+
+	DatagramBatch<AddressFamily::IPv4> sb(8, 16);
+	char longer[32] = "this is longer than a slot";
+
+	CHECK(!sb.push_copy(addr, longer, sizeof(longer)));
+	CHECK(sb.push(addr, longer, sizeof(longer)));
+
+	for (int i=1; i<8; i++) {
+		std::string s = "dgram " + std::to_string(i);
+		CHECK(sb.push_copy(addr, s.data(), s.size()));
+	}
+
+	CHECK(!sb.push_copy(addr, "full", 4));
+	CHECK(sb.size() == 8 && sb.pending() == 8);
+
+	CHECK(tx.send_batch(sb) == 8);
+	CHECK(sb.size() == 0 && sb.pending() == 0);
+	CHECK(tx.send_batch(sb) == 0);
+
+	DatagramBatch<AddressFamily::IPv4> rb(16, 16);
+	CHECK(rx.recv_batch(rb) == 8);
+	CHECK(rb.size() == 8);
+
+	CHECK(rb.truncated(0) && rb.view(0) == std::string_view(longer, 16));
+	for (size_t i=1; i<8; i++) {
+		CHECK(!rb.truncated(i));
+		CHECK(rb.view(i) == "dgram " + std::to_string(i));
+		CHECK(rb.address(i).port() == tx.local_address().port());
+	}
+
+	// Nothing left
+	CHECK(rx.recv_batch(rb) == -1 && errno == EAGAIN);
+}
+
+// The loop drains the socket a batch at a time, every datagram arrives once
+template<EventBackend B>
+static void test_reader() {
+	auto [rx, tx] = bound_pair();
+	auto addr = rx.local_address();
+	uint16_t tx_port = tx.local_address().port();
+
+	const size_t n = 5000;
+	std::vector<uint64_t> vals(n);
+	uint64_t expect = 0;
+	for (size_t i=0; i<n; i++) {
+		vals[i] = i * 3 + 1;
+		expect += vals[i];
+	}
+
+	EventLoop<B> loop;
+	DatagramBatch<AddressFamily::IPv4> rb(32, 256), sb(64);
+	size_t got = 0, batches = 0, sent = 0;
+	uint64_t sum = 0;
+
+	loop.add_batch_reader(rx, rb, [&](auto& l, auto&, auto& b){
+		batches++;
+		CHECK(b.size() <= b.capacity());
+
+		for (size_t i=0; i<b.size(); i++) {
+			CHECK(b.length(i) == 8);
+			CHECK(b.address(i).port() == tx_port);
+
+			uint64_t v;
+			memcpy(&v, b.data(i), 8);
+			sum += v;
+			got++;
+		}
+
+		if (got == n)
+			l.stop();
+	});
+
+	// Sent in rounds, so reads and writes interleave
+	std::function<void(EventLoop<EventBackend::Any>&)> pump = [&](auto& l){
+		size_t end = std::min(sent + 1000, n);
+
+		while (sent < end) {
+			while (sent < end && sb.push(addr, &vals[sent], 8))
+				sent++;
+			while (sb.pending())
+				CHECK(tx.send_batch(sb) > 0);
+		}
+
+		if (sent < n)
+			l.add_timer(1, pump);
+	};
+
+	loop.add_timer(0, pump);
+	loop.add_timer(5000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(got == n && sum == expect);
+	CHECK(batches < n);
+}
+
+int main() {
+	test_batch();
+
+	test_reader<EventBackend::Poll>();
+	test_reader<EventBackend::EPoll>();
+	test_reader<EventBackend::IoUring>();
+
+	puts("ok");
+}
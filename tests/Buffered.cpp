@@ -0,0 +1,199 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+using namespace IODash;
+
+static File reopen(const std::string& __path) {
+	File f;
+	f.open(__path, O_RDONLY);
+	return f;
+}
+
+// Writes lines of every length, mixed line endings, one bigger than the buffer and an unterminated tail
+static std::string write_csv(const std::string& __path) {
+	File f;
+	f.open(__path, O_RDWR | O_TRUNC);
+	std::string expect;
+
+	BufferedWriter w(f, 100);
+
+	for (int i=0; i<20000; i++) {
+		std::string line = "row" + std::to_string(i) + ",v" + std::string(i % 50, 'x') + (i % 3 ? "\r\n" : "\n");
+		CHECK(w.write(line));
+		expect += line;
+	}
+
+	std::string big = std::string(1000, 'B') + "\n";
+	CHECK(w.write(big));
+	expect += big;
+
+	CHECK(w.write("tail-no-newline"));
+	CHECK(w.putc('!'));
+	expect += "tail-no-newline!";
+
+	CHECK(w.buffered() > 0);
+	CHECK(w.flush());
+	CHECK(w.buffered() == 0);
+
+	return expect;
+}
+
+static void test_lines(const std::string& __path) {
+	File f = reopen(__path);
+	BufferedReader r(f, 64);
+	r.set_read_ahead(1 << 20);
+
+	int n = 0;
+	std::string last;
+
+	while (auto l = r.read_line()) {
+		if (n < 20000)
+			CHECK(*l == "row" + std::to_string(n) + ",v" + std::string(n % 50, 'x'));
+		else if (n == 20000)
+			CHECK(*l == std::string(1000, 'B'));
+
+		last = std::string(*l);
+		n++;
+	}
+
+	CHECK(n == 20002 && last == "tail-no-newline!");
+}
+
+// getc() and read() interleaved give back the exact bytes
+static void test_mixed(const std::string& __path, const std::string& __expect) {
+	File f = reopen(__path);
+	BufferedReader r(f, 16);
+	std::string all;
+	char tmp[7];
+
+	while (true) {
+		int c = r.getc();
+		if (c <= 0)
+			break;
+		all.push_back((char)c);
+
+		ssize_t k = r.read(tmp, sizeof(tmp));
+		if (k <= 0)
+			break;
+		all.append(tmp, k);
+	}
+
+	CHECK(all == __expect);
+
+	File f2 = reopen(__path);
+	BufferedReader fields(f2);
+	auto fld = fields.read_until(',');
+	CHECK(fld && *fld == "row0");
+	CHECK(fields.peek().substr(0, 2) == "v\n");
+}
+
+// A partial record on a non-blocking pipe is kept until the rest arrives
+static void test_nonblocking() {
+	int p[2];
+	CHECK(pipe2(p, O_NONBLOCK) == 0);
+	File in(p[0]), out(p[1]);
+	BufferedReader r(in, 8);
+
+	out.write("abc", 3);
+	CHECK(!r.read_line());
+
+	out.write("def\nxy", 6);
+	auto l = r.read_line();
+	CHECK(l && *l == "abcdef");
+	CHECK(!r.read_line());
+
+	out.close();
+	l = r.read_line();
+	CHECK(l && *l == "xy");
+	CHECK(!r.read_line());
+}
+
+// A full non-blocking pipe fails the flush with EAGAIN, what's left stays buffered
+static void test_writer_eagain() {
+	int p[2];
+	CHECK(pipe2(p, O_NONBLOCK) == 0);
+	File in(p[0]), out(p[1]);
+	BufferedWriter w(out, 1 << 20);
+
+	std::string chunk(1 << 18, 'w');
+	for (int i=0; i<4; i++)
+		CHECK(w.write(chunk));
+
+	CHECK(!w.flush() && errno == EAGAIN);
+	size_t left = w.buffered();
+	CHECK(left > 0 && left < (1 << 20));
+
+	size_t drained = 0;
+	char buf[65536];
+	while (w.buffered()) {
+		ssize_t n;
+		while ((n = in.read(buf, sizeof(buf))) > 0)
+			drained += n;
+		w.flush();
+	}
+
+	ssize_t n;
+	while ((n = in.read(buf, sizeof(buf))) > 0)
+		drained += n;
+
+	CHECK(drained == 1 << 20);
+}
+
+static BufferedWriter make_writer(const File& __file, const std::string& __first) {
+	BufferedWriter w(__file, 1024);
+	CHECK(w.write(__first));
+	return w;
+}
+
+// Moving a writer takes its pending data along, assigning over one flushes what it had
+static void test_writer_move(const std::string& __path) {
+	File f;
+	f.open(__path, O_RDWR | O_TRUNC);
+
+	BufferedWriter a = make_writer(f, "one,");
+	CHECK(a.buffered() == 4);
+
+	BufferedWriter b(std::move(a));
+	CHECK(b.buffered() == 4 && a.buffered() == 0);
+	CHECK(b.write("two,"));
+
+	BufferedWriter c = make_writer(f, "zero,");
+	c = std::move(b);
+	CHECK(c.buffered() == 8 && b.buffered() == 0);
+
+	// c's own "zero," was written out by the assignment, the rest is still pending
+	File r = reopen(__path);
+	char buf[64] = {};
+	CHECK(r.read_all(buf, sizeof(buf)) == 5 && !strcmp(buf, "zero,"));
+
+	CHECK(c.flush());
+	CHECK(r.read_all(buf, sizeof(buf)) == 8 && !memcmp(buf, "one,two,", 8));
+}
+
+int main() {
+	char path[] = "/tmp/IODash_Buffered_XXXXXX";
+	::close(mkstemp(path));
+
+	std::string expect = write_csv(path);
+	test_lines(path);
+	test_mixed(path, expect);
+	test_nonblocking();
+	test_writer_eagain();
+	test_writer_move(path);
+
+	::unlink(path);
+
+	puts("ok");
+}
@@ -0,0 +1,129 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+
+using namespace IODash;
+
+// Jobs submitted from several threads, and from jobs, all run; the destructor waits for them
+static void test_jobs() {
+	std::atomic<int> ran{0};
+
+	{
+		ComputePool pool(4);
+		std::vector<std::thread> threads;
+
+		for (int t=0; t<4; t++) {
+			threads.emplace_back([&]{
+				for (int i=0; i<1000; i++) {
+					pool.submit([&]{
+						ran++;
+						pool.submit([&]{ ran++; });
+					});
+				}
+			});
+		}
+
+		for (auto &it : threads)
+			it.join();
+	}
+
+	CHECK(ran == 8000);
+}
+
+// Results come back on the loop's thread. A throwing job hands its exception to the completion, the loop lives on.
+static void test_completions() {
+	EventLoop<EventBackend::EPoll> loop;
+	ComputePool pool(4);
+	constexpr int jobs = 1000;
+	int done = 0, errors = 0;
+	long sum = 0;
+
+	for (int i=0; i<jobs; i++) {
+		pool.submit(loop, [i]{
+			if (i % 100 == 0)
+				throw std::runtime_error("job");
+			return i;
+		}, [&](auto& l, int r, std::exception_ptr e){
+			if (e) {
+				errors++;
+				CHECK(r == 0);
+			} else {
+				sum += r;
+			}
+
+			if (++done == jobs)
+				l.stop();
+		});
+	}
+
+	loop.add_timer(5000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(errors == jobs / 100);
+
+	long expected = 0;
+	for (int i=0; i<jobs; i++) {
+		if (i % 100)
+			expected += i;
+	}
+	CHECK(sum == expected);
+
+	bool got = false;
+	pool.submit(loop, []{ throw 1; }, [&](auto& l, std::exception_ptr e){
+		got = e != nullptr;
+		l.stop();
+	});
+	loop.run();
+
+	CHECK(got);
+}
+
+// A completion for a watched object is dropped if it was deleted meanwhile
+static void test_target() {
+	EventLoop<EventBackend::EPoll, int> loop;
+	ComputePool pool(2);
+	auto a = socket_pair<SocketType::Stream>();
+	auto b = socket_pair<SocketType::Stream>();
+	int kept = 0, dropped = 0;
+
+	loop.add(a.first, EventType::In, 1);
+	loop.add(b.first, EventType::In, 2);
+
+	pool.submit(loop, a.first, []{ return 10; }, [&](auto&, File&, int& ud, int r, std::exception_ptr e){
+		CHECK(!e && ud == 1 && r == 10);
+		kept++;
+	});
+	pool.submit(loop, b.first, []{ return 20; }, [&](auto&, File&, int&, int, std::exception_ptr){
+		dropped++;
+	});
+	loop.del(b.first);
+
+	loop.add_timer(200, [](auto& l){ l.stop(); });
+	loop.run();
+
+	CHECK(kept == 1);
+	CHECK(dropped == 0);
+}
+
+int main() {
+	test_jobs();
+	test_completions();
+	test_target();
+
+	puts("ok");
+}
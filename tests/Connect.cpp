@@ -0,0 +1,171 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+#include <chrono>
+#include <netinet/in.h>
+
+using namespace IODash;
+
+using Tcp = Socket<AddressFamily::IPv4, SocketType::Stream>;
+using Any = SocketAddress<AddressFamily::Any>;
+
+static uint64_t now_ms() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool is(const std::error_code& __ec, int __errno) {
+	return __ec == std::error_code(__errno, std::system_category());
+}
+
+// Nothing listens there
+static SocketAddress<AddressFamily::IPv4> dead_address() {
+	Tcp s;
+	s.create();
+	s.bind({"127.0.0.1:0"});
+	return s.local_address();
+}
+
+// A listener whose backlog is full: SYNs to it are dropped, connects hang until they time out
+struct Blackhole {
+	Tcp listener;
+	std::vector<Tcp> fill;
+
+	Blackhole() : fill(4) {
+		listener.create();
+		listener.bind({"127.0.0.1:0"});
+		listener.listen(0);
+
+		for (auto &it : fill) {
+			it.create();
+			it.set_nonblocking();
+			std::error_code ec;
+			it.connect(listener.local_address(), ec);
+		}
+
+		usleep(50000);
+	}
+};
+
+template<EventBackend B>
+static void test_async_connect(Blackhole& __hole) {
+	Tcp ls;
+	ls.create();
+	ls.bind({"127.0.0.1:0"});
+	ls.listen();
+
+	EventLoop<B> loop;
+	int done = 0;
+
+	Tcp ok;
+	ok.create();
+	ok.async_connect(loop, ls.local_address(), 1000, [&](auto&, std::error_code ec){
+		CHECK(!ec);
+		CHECK(ok.remote_address().port() == ls.local_address().port());
+		done++;
+	});
+	CHECK(done == 0);
+
+	Tcp refused;
+	refused.create();
+	loop.async_connect(refused, dead_address(), 1000, [&](auto&, std::error_code ec){
+		CHECK(is(ec, ECONNREFUSED));
+		done++;
+	});
+
+	Tcp hangs;
+	hangs.create();
+	uint64_t start = now_ms();
+	loop.async_connect(hangs, __hole.listener.local_address(), 200, [&](auto&, std::error_code ec){
+		CHECK(is(ec, ETIMEDOUT));
+		CHECK(now_ms() - start >= 190);
+		done++;
+	});
+
+	// A watched socket gets its registration back
+	Tcp watched;
+	watched.create();
+	loop.add(watched, EventType::In, 7);
+	uint64_t token = loop.token(watched);
+	loop.async_connect(watched, ls.local_address(), 1000, [&](auto& l, std::error_code ec){
+		CHECK(!ec);
+		CHECK(l.token(watched) == token);
+		done++;
+	});
+
+	loop.add_timer(1000, [](auto& l){ l.stop(); });
+	loop.run();
+
+	CHECK(done == 4);
+	CHECK(loop.watched_count() == 1);
+}
+
+template<EventBackend B>
+static void test_dial(Blackhole& __hole) {
+	Tcp ls;
+	ls.create();
+	ls.bind({"127.0.0.1:0"});
+	ls.listen();
+	auto live = ls.local_address();
+	auto dead = dead_address();
+
+	EventLoop<B> loop;
+	int done = 0;
+
+	// The first attempt hangs, the second fails right away, the third wins after one stagger
+	uint64_t start = now_ms();
+	loop.dial({Any(__hole.listener.local_address()), Any(dead), Any(live)}, 3000, [&](auto&, UniqueFd fd, const Any& addr, std::error_code ec){
+		CHECK(!ec && fd);
+		CHECK(ntohs(((const sockaddr_in *)addr.raw())->sin_port) == live.port());
+		CHECK(fcntl(fd.fd(), F_GETFL) & O_NONBLOCK);
+		CHECK(now_ms() - start < 1000);
+		done++;
+	}, 100);
+
+	loop.dial({Any(dead)}, 3000, [&](auto&, UniqueFd fd, const Any&, std::error_code ec){
+		CHECK(is(ec, ECONNREFUSED) && !fd);
+		done++;
+	});
+
+	loop.dial({}, 3000, [&](auto&, UniqueFd fd, const Any&, std::error_code ec){
+		CHECK(ec && !fd);
+		done++;
+	});
+
+	loop.dial({Any(__hole.listener.local_address())}, 200, [&](auto&, UniqueFd fd, const Any&, std::error_code ec){
+		CHECK(is(ec, ETIMEDOUT) && !fd);
+		done++;
+	});
+
+	loop.add_timer(1000, [](auto& l){ l.stop(); });
+	loop.run();
+
+	CHECK(done == 4);
+	// The losers are closed and forgotten
+	CHECK(loop.watched_count() == 0);
+}
+
+int main() {
+	Blackhole hole;
+
+	test_async_connect<EventBackend::Poll>(hole);
+	test_async_connect<EventBackend::EPoll>(hole);
+	test_async_connect<EventBackend::IoUring>(hole);
+
+	test_dial<EventBackend::Poll>(hole);
+	test_dial<EventBackend::EPoll>(hole);
+	test_dial<EventBackend::IoUring>(hole);
+
+	puts("ok");
+}
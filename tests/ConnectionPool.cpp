@@ -0,0 +1,168 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+using namespace IODash;
+
+using Tcp = Socket<AddressFamily::IPv4, SocketType::Stream>;
+
+static bool is(const std::error_code& __ec, int __errno) {
+	return __ec == std::error_code(__errno, std::system_category());
+}
+
+// Prewarming, reuse, waiting at the cap, eviction when the peer closes, idle timeout
+template<EventBackend B>
+static void test_lifecycle() {
+	using EL = EventLoop<B>;
+	using Pool = ConnectionPool<EL, AddressFamily::IPv4>;
+
+	Tcp ls;
+	ls.create();
+	ls.bind({"127.0.0.1:0"});
+	ls.listen();
+	ls.set_nonblocking();
+	auto addr = ls.local_address();
+
+	EL loop;
+	std::vector<Tcp> accepted;
+
+	loop.add(ls, EventType::In, 0, [&](auto&, File&, EventType, int&){
+		while (true) {
+			int fd = ::accept(ls.fd(), nullptr, nullptr);
+			if (fd < 0)
+				break;
+			accepted.emplace_back(fd);
+		}
+	});
+
+	typename Pool::Options opt;
+	opt.max_per_destination = 2;
+	opt.idle_timeout_ms = 300;
+	opt.wait_timeout_ms = 200;
+	Pool pool(loop, opt);
+
+	// Capped
+	pool.prewarm(addr, 5);
+	CHECK(pool.open_count(addr) == 2);
+
+	int step = 0;
+	Tcp held1, held2, held3;
+
+	loop.add_timer(50, [&](auto&){
+		CHECK(pool.idle_count(addr) == 2);
+
+		// Idle ones are handed out right away
+		pool.acquire(addr, [&](EL&, Tcp s, std::error_code ec){ CHECK(!ec); held1 = s; step++; });
+		pool.acquire(addr, [&](EL&, Tcp s, std::error_code ec){ CHECK(!ec); held2 = s; step++; });
+		CHECK(step == 2 && pool.idle_count(addr) == 0);
+
+		// At the cap: the first waiter gets the next release, the second times out
+		pool.acquire(addr, [&](EL&, Tcp s, std::error_code ec){ CHECK(!ec && s.fd() == held1.fd()); held3 = s; step++; });
+		pool.acquire(addr, [&](EL&, Tcp, std::error_code ec){ CHECK(is(ec, ETIMEDOUT)); step++; });
+
+		pool.release(addr, held1);
+		held1 = Tcp();
+		CHECK(step == 3 && pool.idle_count(addr) == 0);
+	});
+
+	loop.add_timer(300, [&](auto&){
+		CHECK(step == 4);
+
+		pool.release(addr, held3);
+		held3 = Tcp();
+		CHECK(pool.idle_count(addr) == 1);
+
+		// The peer closes the idle one
+		for (auto &it : accepted)
+			it.close();
+		accepted.clear();
+	});
+
+	loop.add_timer(400, [&](auto&){
+		CHECK(pool.idle_count(addr) == 0 && pool.open_count(addr) == 1);
+
+		// Not reusable: closed
+		pool.release(addr, held2, false);
+		held2 = Tcp();
+		CHECK(pool.open_count(addr) == 0);
+
+		pool.acquire(addr, [&](EL&, Tcp s, std::error_code ec){
+			CHECK(!ec);
+			step++;
+			pool.release(addr, s);
+		});
+	});
+
+	loop.add_timer(500, [&](auto&){ CHECK(step == 5 && pool.idle_count(addr) == 1); });
+
+	loop.add_timer(900, [&](auto& l){
+		CHECK(pool.idle_count(addr) == 0 && pool.open_count(addr) == 0);
+		l.stop();
+	});
+
+	loop.run();
+
+	// Only the listener is left
+	CHECK(loop.watched_count() == 1);
+}
+
+template<EventBackend B>
+static void test_failures() {
+	using EL = EventLoop<B>;
+	using Pool = ConnectionPool<EL, AddressFamily::IPv4>;
+
+	Tcp s;
+	s.create();
+	s.bind({"127.0.0.1:0"});
+	auto dead = s.local_address();
+
+	EL loop;
+	int called = 0;
+
+	{
+		Pool pool(loop);
+
+		pool.acquire(dead, [&](EL& l, Tcp c, std::error_code ec){
+			CHECK(is(ec, ECONNREFUSED) && c.fd() < 0);
+			CHECK(pool.open_count(dead) == 0);
+			called++;
+			l.stop();
+		});
+
+		loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+		loop.run();
+		CHECK(called == 1);
+
+		// Destroyed with connects in flight: their completions are dropped
+		pool.prewarm(dead, 3);
+	}
+
+	loop.add_timer(50, [](auto& l){ l.stop(); });
+	loop.run();
+
+	CHECK(called == 1);
+	CHECK(loop.watched_count() == 0);
+}
+
+int main() {
+	test_lifecycle<EventBackend::Poll>();
+	test_lifecycle<EventBackend::EPoll>();
+	test_lifecycle<EventBackend::IoUring>();
+
+	test_failures<EventBackend::Poll>();
+	test_failures<EventBackend::EPoll>();
+	test_failures<EventBackend::IoUring>();
+
+	puts("ok");
+}
@@ -0,0 +1,161 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+#include <string>
+
+using namespace IODash;
+
+#if __cplusplus < 202002L || !__has_include(<coroutine>)
+#error "Needs C++20 coroutines"
+#endif
+
+template<EventBackend EB>
+using Loop = EventLoop<EB>;
+
+template<EventBackend EB>
+Task echo(Loop<EB>& loop, Socket<AddressFamily::Unix, SocketType::Stream>& socket) {
+	char buf[64];
+	ssize_t rc;
+
+	while ((rc = co_await socket.async_recv(loop, buf, sizeof(buf))) > 0)
+		co_await socket.async_send(loop, buf, rc);
+
+	CHECK(rc == 0);
+	loop.del(socket);
+	loop.stop();
+}
+
+template<EventBackend EB>
+Task client(Loop<EB>& loop, Socket<AddressFamily::Unix, SocketType::Stream>& socket, std::string& reply) {
+	co_await async_send(loop, socket, "hello", 5);
+
+	char buf[64];
+	while (reply.size() < 5) {
+		ssize_t rc = co_await async_recv(loop, socket, buf, sizeof(buf));
+		CHECK(rc > 0);
+		reply.append(buf, rc);
+	}
+
+	socket.shutdown(SHUT_WR);
+}
+
+template<EventBackend EB>
+Task pipe_reader(Loop<EB>& loop, File& rd, std::string& got, bool& done) {
+	char buf[16];
+	ssize_t rc;
+
+	while ((rc = co_await rd.async_read(loop, buf, sizeof(buf))) > 0)
+		got.append(buf, rc);
+
+	done = true;
+}
+
+template<EventBackend EB>
+Task pipe_writer(Loop<EB>& loop, File& wr) {
+	co_await async_sleep(loop, 10);
+	CHECK(co_await async_write(loop, wr, "abc", 3) == 3);
+
+	Timer t;
+	t.set_nonblocking();
+	t.set_timeout(0.01);
+	CHECK(co_await t.async_wait(loop) == 1);
+
+	CHECK(co_await wr.async_write(loop, "def", 3) == 3);
+	wr.close();
+}
+
+template<EventBackend EB>
+void test_echo() {
+	Loop<EB> loop;
+	auto sp = socket_pair<SocketType::Stream>();
+	std::string reply;
+
+	echo(loop, sp.second);
+	client(loop, sp.first, reply);
+
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(reply == "hello");
+}
+
+// The per-fd handler pointed into a finished coroutine's frame: it must be gone once the awaiter completes
+template<EventBackend EB>
+void test_handler_cleared() {
+	Loop<EB> loop;
+	auto sp = socket_pair<SocketType::Stream>();
+	std::string reply;
+	int fallback = 0;
+
+	loop.on_event(EventType::In, [&](auto& l, File&, EventType, auto&){
+		fallback++;
+		l.stop();
+	});
+
+	[](Loop<EB>& __loop, Socket<AddressFamily::Unix, SocketType::Stream>& __s) -> Task {
+		char c;
+		CHECK(co_await __s.async_recv(__loop, &c, 1) == 1);
+	}(loop, sp.second);
+
+	sp.first.write("x", 1);
+	loop.add_timer(50, [&](auto& l){
+		// The coroutine is done, the next event goes to the loop wide handler
+		sp.first.write("y", 1);
+		l.rearm(sp.second);
+	});
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(fallback == 1);
+}
+
+template<EventBackend EB>
+void test_file() {
+	Loop<EB> loop;
+
+	int fds[2];
+	CHECK(::pipe2(fds, O_NONBLOCK | O_CLOEXEC) == 0);
+	File rd(fds[0]), wr(fds[1]);
+
+	std::string got;
+	bool done = false;
+
+	pipe_reader(loop, rd, got, done);
+	pipe_writer(loop, wr);
+
+	loop.on_post_events([&](auto& l){
+		if (done)
+			l.stop();
+	});
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(got == "abcdef");
+}
+
+template<EventBackend EB>
+void test_all() {
+	test_echo<EB>();
+	test_handler_cleared<EB>();
+	test_file<EB>();
+}
+
+int main() {
+	test_all<EventBackend::Poll>();
+	test_all<EventBackend::EPoll>();
+	test_all<EventBackend::IoUring>();
+
+	puts("ok");
+}
@@ -0,0 +1,170 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+using namespace IODash;
+
+// Counts what the loop asks the backend to do
+class CountingLoop : public EventLoop<EventBackend::EPoll> {
+public:
+	size_t calls = 0;
+
+protected:
+	std::error_code __lower_add(int __fd, EventType __events, uint64_t __token) override {
+		calls++;
+		return EventLoop<EventBackend::EPoll>::__lower_add(__fd, __events, __token);
+	}
+
+	std::error_code __lower_mod(int __fd, EventType __events, uint64_t __token) override {
+		calls++;
+		return EventLoop<EventBackend::EPoll>::__lower_mod(__fd, __events, __token);
+	}
+
+	std::error_code __lower_del(int __fd, uint64_t __token) override {
+		calls++;
+		return EventLoop<EventBackend::EPoll>::__lower_del(__fd, __token);
+	}
+};
+
+// Each request is read, then Out is enabled to send the response and disabled again once it's sent.
+// Half of the responses go out right away, the rest on the next Out event.
+static size_t flip_calls(bool __deferred) {
+	CountingLoop loop;
+	std::vector<std::pair<Socket<AddressFamily::Unix, SocketType::Stream>, Socket<AddressFamily::Unix, SocketType::Stream>>> pairs;
+	size_t rounds = 0, requests = 0;
+
+	loop.set_deferred_changes(__deferred);
+
+	for (size_t i=0; i<16; i++)
+		pairs.push_back(socket_pair<SocketType::Stream>());
+
+	for (size_t i=0; i<pairs.size(); i++) {
+		loop.add(pairs[i].first, EventType::In, {}, [&, i](auto& l, File& f, EventType ev, auto&){
+			if (ev & EventType::In) {
+				char c;
+				CHECK(f.read(&c, 1) == 1);
+				requests++;
+
+				l.modify(f, EventType::In | EventType::Out);
+				if (i % 2)
+					return;
+			}
+
+			CHECK(f.write("y", 1) == 1);
+			l.modify(f, EventType::In);
+		});
+	}
+
+	loop.on_post_events([&](auto& l){
+		if (++rounds == 10) {
+			l.stop();
+			return;
+		}
+
+		for (auto &it : pairs)
+			it.second.write("x", 1);
+	});
+
+	for (auto &it : pairs)
+		it.second.write("x", 1);
+
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(requests >= pairs.size() * 9);
+	return loop.calls;
+}
+
+// An add the backend refuses is reported to on_change_error() at the flush, and the object is dropped
+static void test_refused() {
+	EventLoop<EventBackend::EPoll, int> loop;
+	File regular;
+	int reported = 0;
+
+	regular.open("/proc/self/stat", O_RDONLY);
+	loop.set_deferred_changes();
+
+	loop.on_change_error([&](auto&, File& f, int& ud, std::error_code ec){
+		CHECK(f.fd() == regular.fd());
+		CHECK(ud == 42);
+		CHECK(ec == std::error_code(EPERM, std::system_category()));
+		reported++;
+	});
+
+	loop.post([&](auto& l){
+		// Only recorded here, no exception
+		l.add(regular, EventType::In, 42);
+		CHECK(l.watched_count() == 1);
+
+		l.add_timer(20, [&](auto& l2){
+			CHECK(l2.watched_count() == 0);
+			CHECK(!l2.token(regular));
+			l2.stop();
+		});
+	});
+
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(reported == 1);
+}
+
+// del() and add() of the same fd in one iteration ends up as a fresh registration
+template<EventBackend B>
+static void test_readd(bool __deferred) {
+	EventLoop<B> loop;
+	auto [a, b] = socket_pair<SocketType::Stream>();
+	int fires = 0;
+
+	loop.set_deferred_changes(__deferred);
+
+	typename EventLoop<B>::Handler handler = [&](auto& l, File& f, EventType, auto&){
+		if (++fires == 1) {
+			// Level triggered and nothing read: the new registration fires again
+			uint64_t old = l.token(f);
+			l.del(a);
+			l.add(a, EventType::In, {}, handler);
+			CHECK(l.token(a) && l.token(a) != old);
+			return;
+		}
+
+		char c;
+		CHECK(f.read(&c, 1) == 1);
+		l.stop();
+	};
+
+	loop.add(a, EventType::In, {}, handler);
+	b.write("x", 1);
+
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(fires == 2);
+}
+
+int main() {
+	size_t immediate = flip_calls(false), deferred = flip_calls(true);
+	printf("backend calls: %zu immediate, %zu deferred\n", immediate, deferred);
+	CHECK(deferred < immediate);
+
+	test_refused();
+
+	for (bool deferred : {false, true}) {
+		test_readd<EventBackend::Poll>(deferred);
+		test_readd<EventBackend::EPoll>(deferred);
+		test_readd<EventBackend::IoUring>(deferred);
+	}
+
+	puts("ok");
+}
@@ -0,0 +1,144 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+#include <cstring>
+
+using namespace IODash;
+
+static void test_pool() {
+	AlignedBufferPool pool(8192, 4096);
+	void *first;
+
+	{
+		auto a = pool.acquire(), b = pool.acquire();
+		CHECK(a && b && a.size() == 8192);
+		CHECK(!((uintptr_t)a.data() % 4096) && !((uintptr_t)b.data() % 4096));
+		first = a.data();
+	}
+
+	// Recycled, the last released first
+	auto c = pool.acquire();
+	CHECK(c.data() == first);
+}
+
+// Unaligned appends, reads, overwrites and extending writes, checked against a plain read of the file
+static void test_file(const std::string& __path) {
+	std::string expect;
+
+	{
+		DirectFile d;
+		d.open(__path, O_RDWR | O_CREAT | O_TRUNC);
+
+		auto &a = d.alignment();
+		CHECK(a.memory && a.offset && a.chunk && !(a.chunk % a.offset));
+
+		for (int i=0; i<50000; i++) {
+			std::string rec = "record " + std::to_string(i) + std::string(i % 97, '.') + "\n";
+			CHECK(d.append(rec.data(), rec.size()) == (ssize_t)rec.size());
+			expect += rec;
+		}
+
+		CHECK(d.flush());
+		CHECK((size_t)d.stat().st_size == expect.size());
+
+		// Written out on close
+		std::string more = "more data after flush\n";
+		d.append(more.data(), more.size());
+		expect += more;
+	}
+
+	{
+		DirectFile d;
+		d.open(__path, O_RDWR);
+		CHECK((size_t)d.stat().st_size == expect.size());
+
+		std::string back(expect.size() + 50, 0);
+		ssize_t n = d.read_at(back.data() + 1, expect.size() + 20, 0);
+		CHECK(n == (ssize_t)expect.size() && back.substr(1, n) == expect);
+
+		n = d.read_at(back.data(), 100, 12345);
+		CHECK(n == 100 && back.substr(0, 100) == expect.substr(12345, 100));
+
+		// Unaligned in the middle
+		std::string patch(10000, 'P');
+		CHECK(d.write_at(patch.data() + 3, 9997, 777) == 9997);
+		expect.replace(777, 9997, patch.substr(3));
+
+		// Unaligned past the end: the hole reads as zeros, the padding is cut off
+		CHECK(d.write_at("TAIL", 4, expect.size() + 10) == 4);
+		expect.append(10, '\0');
+		expect += "TAIL";
+		CHECK((size_t)d.stat().st_size == expect.size());
+
+		// Aligned, straight from a pool buffer
+		size_t block = d.alignment().offset;
+		auto buf = d.buffer();
+		memset(buf.data(), 'A', block);
+		CHECK(d.write_at(buf.data(), block, 0) == (ssize_t)block);
+		expect.replace(0, block, std::string(block, 'A'));
+	}
+
+	{
+		DirectFile d;
+		d.open(__path, O_RDWR);
+		d.append("appended\n", 9);
+		expect += "appended\n";
+
+		std::error_code ec;
+		d.close(ec);
+		CHECK(!ec && d.fd() == -1);
+	}
+
+	// A flush that fails is reported by close(std::error_code&), the fd is closed anyway
+	{
+		DirectFile d;
+		d.open(__path, O_RDONLY);
+		d.append("lost", 4);
+
+		std::error_code ec;
+		d.close(ec);
+		CHECK(ec == std::error_code(EBADF, std::system_category()) && d.fd() == -1);
+	}
+
+	File f;
+	f.open(__path, O_RDONLY);
+	std::string all(expect.size() + 10, 0);
+	ssize_t n = f.read_all(all.data(), all.size());
+	CHECK(n == (ssize_t)expect.size() && all.substr(0, n) == expect);
+}
+
+int main() {
+	test_pool();
+
+	// In the working directory: /tmp is often a tmpfs, which has no O_DIRECT
+	char path[] = "IODash_DirectIO_XXXXXX";
+	::close(mkstemp(path));
+
+	DirectFile probe;
+	std::error_code ec;
+	probe.open(path, O_RDWR, 0644, ec);
+
+	if (ec == std::error_code(EINVAL, std::system_category())) {
+		puts("O_DIRECT not supported here, skipped");
+	} else {
+		CHECK(!ec);
+		probe.close();
+		test_file(path);
+	}
+
+	::unlink(path);
+
+	puts("ok");
+}
@@ -0,0 +1,158 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+using namespace IODash;
+
+static bool is(const std::error_code& __ec, int __errno) {
+	return __ec == std::error_code(__errno, std::system_category());
+}
+
+template<typename F>
+static int thrown(const F& __func) {
+	try {
+		__func();
+	} catch (std::system_error& e) {
+		return e.code().value();
+	}
+
+	return 0;
+}
+
+template<EventBackend B>
+static void test_loop() {
+	EventLoop<B> loop;
+	auto [a, b] = socket_pair<SocketType::Stream>();
+	std::error_code ec;
+
+	loop.modify(a, EventType::In, ec);
+	CHECK(is(ec, ENOENT));
+	loop.rearm(a, ec);
+	CHECK(is(ec, ENOENT));
+	CHECK(thrown([&]{ loop.modify(a, EventType::In); }) == ENOENT);
+
+	// Deleting something that isn't watched is no error
+	loop.del(a, ec);
+	CHECK(!ec);
+
+	loop.add(a, EventType::In, {}, ec);
+	CHECK(!ec);
+	loop.add(a, EventType::Out, {}, ec);
+	CHECK(is(ec, EEXIST));
+	CHECK(thrown([&]{ loop.add(a, EventType::Out); }) == EEXIST);
+	CHECK(loop.watched_count() == 1);
+
+	loop.modify(a, EventType::In | EventType::Out, ec);
+	CHECK(!ec);
+	loop.del(a, ec);
+	CHECK(!ec);
+	CHECK(loop.watched_count() == 0);
+}
+
+// Once the epoll instance exists the kernel's refusal comes back through the error_code, nothing is watched
+static void test_epoll_refused() {
+	EventLoop<EventBackend::EPoll> loop;
+	File regular;
+	std::error_code ec;
+
+	regular.open("/proc/self/stat", O_RDONLY);
+
+	loop.post([&](auto& l){
+		l.add(regular, EventType::In, {}, ec);
+		l.stop();
+	});
+
+	loop.run();
+
+	CHECK(is(ec, EPERM));
+	CHECK(loop.watched_count() == 0);
+	CHECK(!loop.token(regular));
+}
+
+static void test_file() {
+	File f;
+	std::error_code ec;
+
+	f.open("/nonexistent/IODash", O_RDONLY, ec);
+	CHECK(is(ec, ENOENT));
+	CHECK(thrown([&]{ f.open("/nonexistent/IODash", O_RDONLY); }) == ENOENT);
+
+	f.open("/proc/self/stat", O_RDONLY, ec);
+	CHECK(!ec);
+	f.stat(ec);
+	CHECK(!ec);
+}
+
+static void test_socket() {
+	Socket<AddressFamily::IPv4, SocketType::Stream> first, second, unconnected;
+	std::error_code ec;
+
+	// Not created yet
+	first.bind({"127.0.0.1:0"}, ec);
+	CHECK(is(ec, EBADF));
+
+	for (auto *it : {&first, &second, &unconnected}) {
+		it->create(ec);
+		CHECK(!ec);
+	}
+
+	first.bind({"127.0.0.1:0"}, ec);
+	CHECK(!ec);
+	first.listen(16, ec);
+	CHECK(!ec);
+
+	second.bind(first.local_address(), ec);
+	CHECK(is(ec, EADDRINUSE));
+	CHECK(thrown([&]{ second.bind(first.local_address()); }) == EADDRINUSE);
+
+	// What a reset peer used to throw from
+	unconnected.shutdown(SHUT_RDWR, ec);
+	CHECK(is(ec, ENOTCONN));
+
+	unconnected.remote_address(ec);
+	CHECK(is(ec, ENOTCONN));
+
+	unconnected.set_nonblocking(true, ec);
+	CHECK(!ec);
+}
+
+// The std::error_code overloads that only wrap syscalls can't throw, not even std::bad_alloc
+static void test_noexcept() {
+	Socket<AddressFamily::IPv4, SocketType::Stream> s;
+	SocketAddress<AddressFamily::IPv4> addr;
+	File f;
+	MappedFile m;
+	std::string path;
+	std::error_code ec;
+
+	CHECK(noexcept(s.create(ec)));
+	CHECK(noexcept(s.bind(addr, ec)));
+	CHECK(noexcept(f.open(path, 0, ec)));
+	CHECK(noexcept(f.stat(ec)));
+	CHECK(noexcept(m.map(f, false, 0, ec)));
+	CHECK(noexcept(m.open(path, false, 0, ec)));
+}
+
+int main() {
+	test_loop<EventBackend::Poll>();
+	test_loop<EventBackend::EPoll>();
+	test_loop<EventBackend::IoUring>();
+
+	test_epoll_refused();
+	test_file();
+	test_socket();
+	test_noexcept();
+
+	puts("ok");
+}
@@ -0,0 +1,106 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+
+using namespace IODash;
+
+using S = Socket<AddressFamily::IPv4, SocketType::Stream>;
+
+// Every connection is accepted by one of the sharded listeners
+static void test_listen() {
+	// Reserves a port the listeners can share, it doesn't listen itself
+	S reserve;
+	reserve.create();
+	reserve.set_reuseaddr();
+	reserve.set_reuseport();
+	reserve.bind({"127.0.0.1:0"});
+	auto addr = reserve.local_address();
+
+	EventLoopGroup<EventBackend::EPoll> group(4);
+	std::atomic<int> accepted{0};
+
+	group.listen<AddressFamily::IPv4>(addr, [&](auto& loop, auto& listener, size_t){
+		loop.add(listener, EventType::In, {}, [&](auto&, File& f, EventType, int&){
+			auto c = socket_cast<AddressFamily::IPv4, SocketType::Stream>(f).accept();
+			if (c)
+				accepted++;
+		});
+	});
+
+	group.set_cpu_affinity();
+	group.start();
+
+	std::vector<S> clients(64);
+	for (auto &c : clients) {
+		c.create();
+		CHECK(c.connect(addr));
+	}
+
+	for (int i=0; i<2000 && accepted < (int)clients.size(); i++)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+	group.stop();
+	group.join();
+
+	CHECK(accepted == (int)clients.size());
+}
+
+// A stop() right after start() isn't lost, even if the threads haven't entered run() yet
+static void test_early_stop() {
+	for (int i=0; i<50; i++) {
+		EventLoopGroup<EventBackend::EPoll> group(4);
+		group.start();
+		group.stop();
+		group.join();
+	}
+}
+
+// Work posted to each loop runs on its thread, an exception is rethrown by join()
+static void test_post_and_errors() {
+	EventLoopGroup<EventBackend::Poll> group(3);
+	std::atomic<int> ran{0};
+
+	for (size_t i=0; i<group.size(); i++) {
+		group[i].post([&, i](auto& l){
+			ran++;
+			if (i == 1)
+				throw std::runtime_error("loop 1");
+			l.stop();
+		});
+	}
+
+	group.start();
+
+	bool thrown = false;
+	try {
+		group.join();
+	} catch (std::runtime_error&) {
+		thrown = true;
+	}
+
+	CHECK(thrown);
+	CHECK(ran == 3);
+}
+
+int main() {
+	test_listen();
+	test_early_stop();
+	test_post_and_errors();
+
+	puts("ok");
+}
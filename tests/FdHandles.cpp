@@ -0,0 +1,217 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+#include <sys/socket.h>
+
+using namespace IODash;
+
+static bool is_open(int __fd) {
+	return fcntl(__fd, F_GETFD) != -1;
+}
+
+static std::pair<int, int> raw_pair() {
+	int fds[2];
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+	return {fds[0], fds[1]};
+}
+
+static void test_handles() {
+	auto [x, y] = raw_pair();
+
+	{
+		UniqueFd u(x);
+		UniqueFd moved(std::move(u));
+		CHECK(!u && moved.fd() == x);
+
+		int released = moved.release();
+		CHECK(released == x && !moved);
+	}
+	CHECK(is_open(x));
+
+	{
+		UniqueFd u(x);
+		u.reset(y);
+		CHECK(!is_open(x));
+	}
+	CHECK(!is_open(y));
+
+	auto [p, q] = raw_pair();
+	::close(q);
+
+	{
+		SharedFd a(UniqueFd{p});
+		{
+			SharedFd b = a, c;
+			c = b;
+			CHECK(a.use_count() == 3 && c.fd() == p);
+
+			SharedFd d(std::move(c));
+			CHECK(!c && a.use_count() == 3);
+		}
+		CHECK(a.use_count() == 1);
+		CHECK(is_open(p));
+
+		FdView v = a;
+		CHECK(v.fd() == p);
+	}
+	CHECK(!is_open(p));
+}
+
+template<EventBackend B>
+static void test_loop(bool __deferred) {
+	auto [x, peer] = raw_pair();
+	auto [v, vpeer] = raw_pair();
+	int reads = 0;
+
+	{
+		EventLoop<B> loop;
+		loop.set_deferred_changes(__deferred);
+
+		UniqueFd owned(x);
+		loop.add(std::move(owned), EventType::In, {}, [&](auto& l, File& f, EventType, auto&){
+			char c;
+			CHECK(::read(f.fd(), &c, 1) == 1);
+			reads++;
+			l.del(f);
+			l.stop();
+		});
+		CHECK(!owned);
+
+		// Refused: the caller keeps it
+		UniqueFd again(x);
+		std::error_code ec;
+		loop.add(std::move(again), EventType::In, {}, ec);
+		CHECK(ec && again.fd() == x);
+		again.release();
+
+		// Not owned: del() leaves it open
+		loop.add(FdView(v), EventType::In);
+
+		CHECK(::write(peer, "x", 1) == 1);
+		loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+		loop.run();
+
+		CHECK(reads == 1);
+
+		// A deferred del() closes at the flush, so the fd number can't be reused before the backend forgets it
+		if (__deferred) {
+			CHECK(is_open(x));
+			loop.set_deferred_changes(false);
+		}
+		CHECK(!is_open(x));
+
+		loop.del(FdView(v));
+		CHECK(loop.watched_count() == 0);
+		CHECK(is_open(v));
+
+		// Still watched at destruction
+		auto [last, last_peer] = raw_pair();
+		loop.add(UniqueFd(last), EventType::In);
+		::close(last_peer);
+		x = last;
+	}
+
+	CHECK(!is_open(x));
+	CHECK(is_open(v));
+
+	::close(peer);
+	::close(v);
+	::close(vpeer);
+}
+
+// A File added as an lvalue is shared, as an rvalue it's handed over. Either way the loop holds it until del(),
+// and a handler's File& is the loop's reference.
+template<EventBackend B>
+static void test_files() {
+	EventLoop<B> loop;
+	auto [x, xpeer] = raw_pair();
+	auto [y, ypeer] = raw_pair();
+	File kept;
+
+	{
+		File fx(x);
+		loop.add(fx, EventType::In, 0, [&](auto& l, File& f, EventType, int&){
+			kept = f;
+			l.del(f);
+		});
+
+		File fy(y);
+		loop.add(std::move(fy), EventType::In);
+		CHECK(fy.fd() == -1);
+	}
+
+	CHECK(is_open(x) && is_open(y));
+
+	CHECK(::write(xpeer, "x", 1) == 1);
+	loop.add_timer(50, [](auto& l){ l.stop(); });
+	loop.run();
+
+	CHECK(loop.watched_count() == 1 && kept.fd() == x && is_open(x));
+	kept.close();
+	CHECK(!is_open(x));
+
+	loop.del(FdView(y));
+	CHECK(!is_open(y));
+
+	::close(xpeer);
+	::close(ypeer);
+}
+
+static void test_accept_fd() {
+	EventLoop<EventBackend::EPoll> loop;
+	Socket<AddressFamily::IPv4, SocketType::Stream> listener, client;
+	int accepted = -1;
+
+	listener.create();
+	listener.bind({"127.0.0.1:0"});
+	listener.listen(4);
+
+	client.create();
+	client.connect(listener.local_address());
+
+	loop.add(listener, EventType::In, {}, [&](auto& l, File&, EventType, auto&){
+		UniqueFd c = listener.accept_fd(SOCK_NONBLOCK);
+		CHECK(c);
+		accepted = c.fd();
+		CHECK(fcntl(accepted, F_GETFL) & O_NONBLOCK);
+		l.add(std::move(c), EventType::In);
+		l.stop();
+	});
+
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(accepted >= 0 && is_open(accepted));
+	loop.del(FdView(accepted));
+	CHECK(!is_open(accepted));
+}
+
+int main() {
+	test_handles();
+
+	for (bool deferred : {false, true}) {
+		test_loop<EventBackend::Poll>(deferred);
+		test_loop<EventBackend::EPoll>(deferred);
+		test_loop<EventBackend::IoUring>(deferred);
+	}
+
+	test_files<EventBackend::Poll>();
+	test_files<EventBackend::EPoll>();
+	test_files<EventBackend::IoUring>();
+
+	test_accept_fd();
+
+	puts("ok");
+}
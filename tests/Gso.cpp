@@ -0,0 +1,130 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+using namespace IODash;
+
+using Udp = Socket<AddressFamily::IPv4, SocketType::Datagram>;
+
+static std::string pattern(size_t __len) {
+	std::string ret(__len, 0);
+	for (size_t i=0; i<__len; i++)
+		ret[i] = (char)(i * 13 + i / 251);
+	return ret;
+}
+
+// Plain receives, one datagram each
+static std::vector<std::string> drain(Udp& __rx) {
+	std::vector<std::string> ret;
+	char buf[65536];
+	ssize_t n;
+
+	while ((n = ::recv(__rx.fd(), buf, sizeof(buf), MSG_DONTWAIT)) >= 0)
+		ret.emplace_back(buf, n);
+
+	return ret;
+}
+
+static void test_invalid() {
+	Udp s;
+	s.create();
+	SocketAddress<AddressFamily::IPv4> a("127.0.0.1:9");
+	static char buf[70000];
+
+	errno = 0;
+	CHECK(s.send_segmented(&a, buf, 100, 0) == -1 && errno == EINVAL);
+	errno = 0;
+	CHECK(s.send_segmented(&a, buf, sizeof(buf), 65488) == -1 && errno == EINVAL);
+}
+
+// Split into datagrams of the segment size, the last one shorter. Over 64 segments takes several sends.
+static void test_segmented() {
+	Udp rx, tx;
+	rx.create();
+	rx.bind({"127.0.0.1:0"});
+	int big = 4 << 20;
+	rx.setsockopt(SOL_SOCKET, SO_RCVBUF, &big, sizeof(big));
+	tx.create();
+
+	auto addr = rx.local_address();
+
+	std::string data = pattern(2500);
+	CHECK(tx.send_segmented(&addr, data.data(), data.size(), 1000) == 2500);
+
+	auto got = drain(rx);
+	CHECK(got.size() == 3);
+	CHECK(got[0] == data.substr(0, 1000) && got[1] == data.substr(1000, 1000) && got[2] == data.substr(2000));
+
+	data = pattern(100 * 100);
+	CHECK(tx.send_segmented(&addr, data.data(), data.size(), 100) == (ssize_t)data.size());
+
+	got = drain(rx);
+	CHECK(got.size() == 100);
+	for (size_t i=0; i<got.size(); i++)
+		CHECK(got[i] == data.substr(i * 100, 100));
+
+	// A single datagram is sent as is
+	CHECK(tx.send_segmented(&addr, data.data(), 10, 100) == 10);
+	got = drain(rx);
+	CHECK(got.size() == 1 && got[0] == data.substr(0, 10));
+
+	// As the socket's default
+	tx.set_gso_segment(500);
+	CHECK(::sendto(tx.fd(), data.data(), 1200, 0, addr.raw(), addr.size()) == 1200);
+	got = drain(rx);
+	CHECK(got.size() == 3 && got[2].size() == 200);
+}
+
+// Whether or not the kernel coalesces them, the segments split back into the datagrams sent
+static void test_gro() {
+	Udp rx, tx;
+	rx.create();
+	rx.bind({"127.0.0.1:0"});
+	rx.set_gro();
+	tx.create();
+
+	auto addr = rx.local_address();
+	std::string data = pattern(40 * 1200 + 300);
+	CHECK(tx.send_segmented(&addr, data.data(), data.size(), 1200) == (ssize_t)data.size());
+
+	std::string joined;
+	size_t datagrams = 0;
+	static uint8_t buf[65536];
+
+	while (joined.size() < data.size()) {
+		size_t segment_size = 0;
+		SocketAddress<AddressFamily::IPv4> from;
+		ssize_t n = rx.recv_coalesced(buf, sizeof(buf), segment_size, &from, MSG_DONTWAIT);
+		CHECK(n > 0);
+		CHECK(segment_size > 0 && segment_size <= (size_t)n);
+		CHECK(from.port() == tx.local_address().port());
+
+		Udp::for_each_segment(buf, n, segment_size, [&](const uint8_t *__data, size_t __len){
+			CHECK(__len == 1200 || (__len == 300 && datagrams == 40));
+			joined.append((const char *)__data, __len);
+			datagrams++;
+		});
+	}
+
+	CHECK(datagrams == 41);
+	CHECK(joined == data);
+}
+
+int main() {
+	test_invalid();
+	test_segmented();
+	test_gro();
+
+	puts("ok");
+}
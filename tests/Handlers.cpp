@@ -0,0 +1,154 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+#include <stdexcept>
+
+using namespace IODash;
+
+// A per-fd handler takes precedence over the loop wide ones, nullptr falls back to them
+template<EventBackend EB>
+void test_precedence() {
+	EventLoop<EB> loop;
+	auto sp = socket_pair<SocketType::Stream>();
+	int own = 0, shared = 0;
+
+	loop.on_event(EventType::In, [&](auto& l, File& f, EventType, int&){
+		shared++;
+		l.del(f);
+		l.stop();
+	});
+
+	loop.add(sp.first, EventType::In, 0, [&](auto& l, File& f, EventType, int&){
+		own++;
+		l.on_event(f, nullptr);
+	});
+
+	sp.second.write("x", 1);
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(own == 1);
+	CHECK(shared == 1);
+}
+
+// Replacing the running handler from inside it takes effect for the next event
+template<EventBackend EB>
+void test_replace() {
+	EventLoop<EB> loop;
+	auto sp = socket_pair<SocketType::Stream>();
+	int first = 0, second = 0;
+
+	loop.add(sp.first, EventType::In, 0, [&](auto& l, File& f, EventType, int&){
+		first++;
+		l.on_event(f, [&](auto& l, File& f, EventType, int&){
+			second++;
+			l.del(f);
+			l.stop();
+		});
+	});
+
+	sp.second.write("x", 1);
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(first == 1);
+	CHECK(second == 1);
+}
+
+// An exception leaves run(), the handler stays in place and the loop keeps working
+template<EventBackend EB>
+void test_throw() {
+	EventLoop<EB> loop;
+	auto sp = socket_pair<SocketType::Stream>();
+	int calls = 0;
+
+	loop.add(sp.first, EventType::In, 0, [&](auto& l, File& f, EventType, int&){
+		if (++calls == 1)
+			throw std::runtime_error("handler");
+
+		char c;
+		CHECK(f.read(&c, 1) == 1);
+		l.stop();
+	});
+
+	sp.second.write("x", 1);
+
+	bool thrown = false;
+	try {
+		loop.run();
+	} catch (std::runtime_error&) {
+		thrown = true;
+	}
+	CHECK(thrown);
+
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(calls == 2);
+}
+
+// Compile-time dispatch: one handler type for the whole loop, no std::function involved
+struct Counter {
+	int *count;
+
+	Counter() : count(nullptr) {
+
+	}
+
+	explicit Counter(int *__count) : count(__count) {
+
+	}
+
+	template<typename EL>
+	void operator()(EL& __loop, File& __file, EventType __ev, int& __ud) {
+		CHECK(__ev & EventType::In);
+		CHECK(__ud == 5);
+		(*count)++;
+		__loop.del(__file);
+		__loop.stop();
+	}
+};
+
+template<EventBackend EB>
+void test_static() {
+	EventLoop<EB, int, Counter> loop;
+	auto sp = socket_pair<SocketType::Stream>();
+	int count = 0;
+
+	loop.set_handler(Counter(&count));
+	loop.add(sp.first, EventType::In, 5);
+
+	sp.second.write("x", 1);
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(count == 1);
+}
+
+template<EventBackend EB>
+void test_all() {
+	test_precedence<EB>();
+	test_replace<EB>();
+	test_throw<EB>();
+	test_static<EB>();
+}
+
+int main() {
+	test_all<EventBackend::Poll>();
+	test_all<EventBackend::EPoll>();
+	test_all<EventBackend::IoUring>();
+
+	puts("ok");
+}
@@ -0,0 +1,150 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+using namespace IODash;
+
+using Loop = EventLoop<EventBackend::IoUring>;
+
+// Level-triggered: an unread In keeps firing, once per iteration
+static void test_level() {
+	Loop loop;
+	auto sp = socket_pair<SocketType::Stream>();
+	int fired = 0;
+
+	loop.add(sp.first, EventType::In, 0, [&](auto& l, File&, EventType ev, int&){
+		CHECK(ev == EventType::In);
+		if (++fired == 3)
+			l.stop();
+	});
+
+	sp.second.write("x", 1);
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(fired == 3);
+}
+
+// modify() switches the events of a live poll, del() ends it
+static void test_modify_del() {
+	Loop loop;
+	auto sp = socket_pair<SocketType::Stream>();
+	int in = 0, out = 0;
+
+	loop.add(sp.first, EventType::In, 0, [&](auto& l, File& f, EventType ev, int&){
+		if (ev & EventType::In) {
+			char c;
+			CHECK(f.read(&c, 1) == 1);
+			in++;
+			l.modify(f, EventType::Out);
+		} else if (ev & EventType::Out) {
+			out++;
+			l.del(f);
+		}
+	});
+
+	sp.second.write("x", 1);
+	loop.add_timer(100, [&](auto& l){
+		// Deleted: this must not be seen
+		sp.second.write("y", 1);
+		l.add_timer(50, [](auto& l){ l.stop(); });
+	});
+	loop.run();
+
+	CHECK(in == 1);
+	CHECK(out == 1);
+	CHECK(!loop.token(sp.first));
+}
+
+// Objects added before the ring exists are armed when it's created, the rest right away
+static void test_many() {
+	Loop loop;
+	std::vector<std::pair<Socket<AddressFamily::Unix, SocketType::Stream>, Socket<AddressFamily::Unix, SocketType::Stream>>> pairs;
+	size_t got = 0;
+
+	auto handler = [&](auto& l, File& f, EventType, int&){
+		char c;
+		CHECK(f.read(&c, 1) == 1);
+		if (++got == pairs.size())
+			l.stop();
+	};
+
+	for (int i=0; i<64; i++) {
+		pairs.push_back(socket_pair<SocketType::Stream>());
+		if (i < 32)
+			loop.add(pairs.back().first, EventType::In, 0, handler);
+	}
+
+	loop.post([&](auto& l){
+		for (size_t i=32; i<pairs.size(); i++)
+			l.add(pairs[i].first, EventType::In, 0, handler);
+
+		for (auto &it : pairs)
+			it.second.write("x", 1);
+	});
+
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(got == pairs.size());
+	CHECK(loop.watched_count() == pairs.size());
+}
+
+// Removes a poll behind the loop's back, as the kernel may cancel it
+class CancellingLoop : public Loop {
+public:
+	void cancel_poll(const File& __file) {
+		auto *sqe = ring->get_sqe();
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+		sqe->fd = -1;
+		sqe->addr = __poll_ud(__file.fd(), token(__file));
+		sqe->user_data = ud_internal;
+	}
+};
+
+// A poll that completes with an error is added again: the fd keeps getting events and can still be modified
+static void test_cancelled_poll() {
+	CancellingLoop loop;
+	auto sp = socket_pair<SocketType::Stream>();
+	int in = 0, out = 0;
+
+	loop.add(sp.first, EventType::In, 0, [&](auto& l, File& f, EventType ev, int&){
+		if (ev & EventType::In) {
+			char c;
+			CHECK(f.read(&c, 1) == 1);
+			in++;
+			l.modify(f, EventType::Out);
+		} else if (ev & EventType::Out) {
+			out++;
+			l.stop();
+		}
+	});
+
+	loop.post([&](auto&){ loop.cancel_poll(sp.first); });
+	loop.add_timer(50, [&](auto&){ sp.second.write("x", 1); });
+
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(in == 1 && out == 1);
+}
+
+int main() {
+	test_level();
+	test_modify_del();
+	test_many();
+	test_cancelled_poll();
+
+	puts("ok");
+}
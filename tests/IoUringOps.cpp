@@ -0,0 +1,178 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+#include <thread>
+#include <string>
+
+using namespace IODash;
+
+using S = Socket<AddressFamily::IPv4, SocketType::Stream>;
+
+// Multishot accept and recv, with fewer and smaller buffers than the clients send: the recv is restarted when
+// the ring runs dry. Echoes are sent with async_send(), started from completion handlers.
+static void test_echo() {
+	S ls;
+	ls.create();
+	ls.set_reuseaddr();
+	ls.bind({"127.0.0.1:0"});
+	ls.listen();
+
+	// 8 buffers of 64 bytes
+	EventLoop<EventBackend::IoUring> loop(256, 8, 64);
+	int closed = 0;
+	constexpr int clients = 20;
+
+	ls.async_accept(loop, [&](auto& l, S& c, std::error_code ec){
+		CHECK(!ec);
+
+		S cc = c;
+		cc.async_recv(l, [&, cc](auto& l, const uint8_t *data, size_t len, std::error_code ec) mutable {
+			CHECK(!ec);
+
+			if (!len) {
+				if (++closed == clients)
+					l.stop();
+				return;
+			}
+
+			auto *copy = new std::string((const char *)data, len);
+			cc.async_send(l, copy->data(), copy->size(), [copy](auto&, size_t sent, std::error_code ec){
+				CHECK(!ec);
+				CHECK(sent == copy->size());
+				delete copy;
+			});
+		});
+	});
+
+	auto addr = ls.local_address();
+
+	std::thread t([&]{
+		for (int i=0; i<clients; i++) {
+			S c;
+			c.create();
+			CHECK(c.connect(addr));
+
+			std::string msg(300, 'a' + i % 26), got;
+			CHECK(c.send(msg.data(), msg.size()) == (ssize_t)msg.size());
+
+			char buf[512];
+			while (got.size() < msg.size()) {
+				auto rc = c.recv(buf, sizeof(buf));
+				CHECK(rc > 0);
+				got.append(buf, rc);
+			}
+
+			CHECK(got == msg);
+		}
+	});
+
+	loop.add_timer(5000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+	t.join();
+
+	CHECK(closed == clients);
+}
+
+// A cancelled op's handler runs one last time with ECANCELED, and never again
+static void test_cancel() {
+	EventLoop<EventBackend::IoUring> loop;
+	auto sp = socket_pair<SocketType::Stream>();
+	int calls = 0;
+	std::error_code last;
+
+	uint64_t op = sp.first.async_recv(loop, [&](auto&, const uint8_t *, size_t, std::error_code ec){
+		calls++;
+		last = ec;
+	});
+
+	loop.post([&](auto&){
+		loop.cancel(op);
+	});
+	loop.add_timer(100, [&](auto& l){
+		sp.second.write("x", 1);
+		l.add_timer(50, [](auto& l){ l.stop(); });
+	});
+	loop.run();
+
+	CHECK(calls == 1);
+	CHECK(last == std::errc::operation_canceled);
+}
+
+// A handler that throws still hands its buffer back: with two buffers, a third chunk only arrives if both of
+// the earlier ones were recycled
+static void test_throwing_handler() {
+	EventLoop<EventBackend::IoUring> loop(64, 2, 64);
+	auto sp = socket_pair<SocketType::Stream>();
+	int calls = 0, thrown = 0;
+
+	sp.first.async_recv(loop, [&](auto& l, const uint8_t *, size_t len, std::error_code ec){
+		CHECK(!ec && len == 1);
+		if (++calls == 3)
+			l.stop();
+		else
+			throw std::runtime_error("handler");
+	});
+
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+
+	for (int i=0; i<3; i++) {
+		loop.add_timer(20, [&](auto&){ sp.second.write("x", 1); });
+		try {
+			loop.run();
+		} catch (std::runtime_error&) {
+			thrown++;
+		}
+	}
+
+	CHECK(thrown == 2);
+	CHECK(calls == 3);
+}
+
+// More sockets with data than buffers: the recvs that find the ring empty wait for buffers to come back and
+// still get everything
+static void test_starved() {
+	EventLoop<EventBackend::IoUring> loop(64, 2, 64);
+	constexpr int n = 8;
+	std::vector<std::pair<Socket<AddressFamily::Unix, SocketType::Stream>, Socket<AddressFamily::Unix, SocketType::Stream>>> pairs;
+	int got = 0;
+
+	for (int i=0; i<n; i++) {
+		pairs.emplace_back(socket_pair<SocketType::Stream>());
+		pairs.back().second.write("xyz", 3);
+	}
+
+	for (auto &p : pairs) {
+		p.first.async_recv(loop, [&](auto& l, const uint8_t *, size_t len, std::error_code ec){
+			CHECK(!ec);
+			got += len;
+			if (got == n * 3)
+				l.stop();
+		});
+	}
+
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(got == n * 3);
+}
+
+int main() {
+	test_echo();
+	test_cancel();
+	test_throwing_handler();
+	test_starved();
+
+	puts("ok");
+}
@@ -0,0 +1,135 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+#include <cstring>
+
+using namespace IODash;
+
+static std::string temp_path() {
+	char path[] = "/tmp/IODash_MappedFile_XXXXXX";
+	int fd = mkstemp(path);
+	CHECK(fd >= 0);
+	::close(fd);
+	return path;
+}
+
+static int open_fds() {
+	int ret = 0;
+	for (int i=0; i<1024; i++)
+		if (fcntl(i, F_GETFD) != -1)
+			ret++;
+	return ret;
+}
+
+static void test_read_only(const std::string& __path) {
+	{
+		File f;
+		f.open(__path, O_RDWR | O_TRUNC);
+		f.write("hello world", 11);
+	}
+
+	MappedFile m;
+	m.open(__path, false, MAP_POPULATE);
+
+	CHECK(m && m.size() == 11);
+	CHECK(m.view() == "hello world");
+	CHECK(m.view(6) == "world");
+	CHECK(m.view(0, 5) == "hello");
+	CHECK(m.view(20).empty());
+
+	m.advise(MADV_SEQUENTIAL);
+	m.advise(MADV_WILLNEED, 3, 5);
+
+	MappedFile m2 = std::move(m);
+	CHECK(!m && m2.view() == "hello world");
+
+	std::error_code ec;
+	m2.resize(100, ec);
+	CHECK(ec == std::error_code(EBADF, std::system_category()));
+
+	bool threw = false;
+	try {
+		m2.resize(100);
+	} catch (std::system_error&) {
+		threw = true;
+	}
+	CHECK(threw);
+}
+
+// Appending grows the file and remaps it, the content survives every move
+static void test_append(const std::string& __path) {
+	{
+		MappedFile w;
+		w.open(__path, true);
+
+		for (int i=0; i<100000; i++)
+			CHECK(w.append("0123456789", 10) == 11 + (size_t)i * 10);
+
+		CHECK(w.size() == 11 + 1000000);
+		CHECK(w.view(0, 11) == "hello world");
+		CHECK(w.view(11, 10) == "0123456789");
+		CHECK(w.view(w.size() - 10) == "0123456789");
+		w.sync();
+	}
+
+	File f;
+	f.open(__path);
+	CHECK(f.stat().st_size == 1000011);
+}
+
+// Empty files can't be mmap()ed, they're mapped on the first resize()
+static void test_empty(const std::string& __path) {
+	File f;
+	f.open(__path, O_RDWR | O_TRUNC);
+
+	MappedFile e;
+	e.map(f, true);
+	CHECK(e.size() == 0 && e.view().empty());
+
+	e.append("x", 1);
+	CHECK(e.view() == "x");
+}
+
+static void test_memfd() {
+	MappedFile m;
+	m.create_memfd("IODash", 1 << 22);
+	m.use_hugepages();
+
+	CHECK(m.size() == 1 << 22);
+	memset(m.data(), 1, m.size());
+
+	// Shared: the same pages through the fd
+	uint8_t c;
+	CHECK(::pread(m.file().fd(), &c, 1, 12345) == 1 && c == 1);
+
+	m.resize(10);
+	CHECK(m.size() == 10 && m.data()[9] == 1);
+}
+
+int main() {
+	std::string path = temp_path();
+	int before = open_fds();
+
+	test_read_only(path);
+	test_append(path);
+	test_empty(path);
+	test_memfd();
+
+	// Nothing leaked by the moves and remaps
+	CHECK(open_fds() == before);
+	::unlink(path.c_str());
+
+	puts("ok");
+}
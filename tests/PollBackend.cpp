@@ -0,0 +1,129 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+using namespace IODash;
+
+using Pair = std::pair<Socket<AddressFamily::Unix, SocketType::Stream>, Socket<AddressFamily::Unix, SocketType::Stream>>;
+
+// Objects deleted and added while the pollfd array is being scanned: every event still reaches the right object
+static void test_churn() {
+	EventLoop<EventBackend::Poll, size_t> loop;
+	std::vector<Pair> pairs;
+	std::vector<int> fired;
+	size_t rounds = 0;
+
+	for (size_t i=0; i<64; i++) {
+		pairs.push_back(socket_pair<SocketType::Stream>());
+		fired.push_back(0);
+	}
+
+	auto handler = [&](auto& l, File& f, EventType, size_t& idx){
+		CHECK(f.fd() == pairs[idx].first.fd());
+
+		char c;
+		CHECK(f.read(&c, 1) == 1);
+		fired[idx]++;
+
+		// Every third one goes away, together with its neighbour, and is replaced by a new one
+		if (idx % 3 == 0) {
+			l.del(f);
+			if (idx + 1 < pairs.size() && l.token(pairs[idx + 1].first))
+				l.del(pairs[idx + 1].first);
+		}
+	};
+
+	for (size_t i=0; i<pairs.size(); i++)
+		loop.add(pairs[i].first, EventType::In, i, handler);
+
+	loop.on_post_events([&](auto& l){
+		if (++rounds == 3) {
+			l.stop();
+			return;
+		}
+
+		size_t n = pairs.size();
+		for (size_t i=0; i<n; i++) {
+			if (i % 3 == 0 && !l.token(pairs[i].first)) {
+				pairs.push_back(socket_pair<SocketType::Stream>());
+				fired.push_back(0);
+				l.add(pairs.back().first, EventType::In, pairs.size() - 1, handler);
+			}
+		}
+
+		for (auto &it : pairs)
+			it.second.write("x", 1);
+	});
+
+	for (auto &it : pairs)
+		it.second.write("x", 1);
+
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	// Whatever is still watched got an event every round it was there for
+	size_t watched = 0;
+	loop.for_each_watched([&](File& f, EventType, size_t& idx){
+		CHECK(f.fd() == pairs[idx].first.fd());
+		CHECK(fired[idx] >= 1);
+		watched++;
+	});
+
+	CHECK(watched == loop.watched_count());
+	CHECK(rounds == 3);
+}
+
+// A handler modifying an object further down the pollfd array: that one's events from the same poll() are
+// still delivered in this iteration
+static void test_modify_unscanned() {
+	EventLoop<EventBackend::Poll> loop;
+	auto a = socket_pair<SocketType::Stream>();
+	auto b = socket_pair<SocketType::Stream>();
+	int iteration = 0, a_iteration = -1, b_iteration = -1;
+
+	loop.add(a.first, EventType::In, 0, [&](auto& l, File& f, EventType, int&){
+		char c;
+		CHECK(f.read(&c, 1) == 1);
+		a_iteration = iteration;
+		l.modify(b.first, EventType::In | EventType::Hangup);
+	});
+
+	loop.add(b.first, EventType::In, 0, [&](auto&, File& f, EventType ev, int&){
+		CHECK(ev & EventType::In);
+		char c;
+		CHECK(f.read(&c, 1) == 1);
+		b_iteration = iteration;
+	});
+
+	loop.on_post_events([&](auto& l){
+		iteration++;
+		if (b_iteration >= 0)
+			l.stop();
+	});
+
+	a.second.write("x", 1);
+	b.second.write("x", 1);
+
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(a_iteration == 0 && b_iteration == 0);
+}
+
+int main() {
+	test_churn();
+	test_modify_unscanned();
+
+	puts("ok");
+}
@@ -0,0 +1,89 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+#include <chrono>
+#include <thread>
+
+using namespace IODash;
+
+// Everything posted runs on the loop's thread, in order per producer
+template<EventBackend EB>
+void test_producers() {
+	EventLoop<EB> loop;
+	constexpr int producers = 4, per_producer = 10000;
+
+	std::vector<int> last(producers, -1);
+	int total = 0;
+	std::thread::id loop_thread;
+
+	loop.post([&](auto&){
+		loop_thread = std::this_thread::get_id();
+	});
+
+	std::vector<std::thread> threads;
+	for (int p=0; p<producers; p++) {
+		threads.emplace_back([&, p]{
+			for (int i=0; i<per_producer; i++) {
+				loop.post([&, p, i](auto& l){
+					CHECK(std::this_thread::get_id() == loop_thread);
+					CHECK(last[p] == i - 1);
+					last[p] = i;
+
+					if (++total == producers * per_producer)
+						l.stop();
+				});
+			}
+		});
+	}
+
+	loop.run();
+
+	for (auto &it : threads)
+		it.join();
+
+	CHECK(total == producers * per_producer);
+}
+
+// stop() from another thread wakes a loop waiting with nothing to do
+template<EventBackend EB>
+void test_stop_wakeup() {
+	EventLoop<EB> loop;
+
+	std::thread t([&]{
+		std::this_thread::sleep_for(std::chrono::milliseconds(50));
+		loop.stop();
+	});
+
+	auto start = std::chrono::steady_clock::now();
+	loop.run();
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	t.join();
+
+	CHECK(elapsed < std::chrono::milliseconds(500));
+}
+
+template<EventBackend EB>
+void test_all() {
+	test_producers<EB>();
+	test_stop_wakeup<EB>();
+}
+
+int main() {
+	test_all<EventBackend::Poll>();
+	test_all<EventBackend::EPoll>();
+	test_all<EventBackend::IoUring>();
+
+	puts("ok");
+}
@@ -0,0 +1,133 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+#include <unistd.h>
+
+using namespace IODash;
+
+template<EventBackend EB>
+void test_tokens() {
+	EventLoop<EB, int> loop;
+	auto sp = socket_pair<SocketType::Stream>();
+
+	CHECK(!loop.token(sp.first));
+
+	loop.add(sp.first, EventType::In, 42);
+	uint64_t t1 = loop.token(sp.first);
+	CHECK(t1);
+	CHECK(loop.watched_count() == 1);
+
+	bool called = loop.with_token(t1, [](File&, int& __ud){
+		CHECK(__ud == 42);
+	});
+	CHECK(called);
+
+	// Same fd, new registration: the old token is stale
+	loop.del(sp.first);
+	CHECK(!loop.token(sp.first));
+	CHECK(loop.watched_count() == 0);
+
+	loop.add(sp.first, EventType::In, 7);
+	uint64_t t2 = loop.token(sp.first);
+	CHECK(t2 && t2 != t1);
+	CHECK(!loop.with_token(t1, [](File&, int&){ CHECK(!"stale token"); }));
+
+	size_t n = 0;
+	loop.for_each_watched([&](File& __f, EventType __ev, int& __ud){
+		CHECK(__f.fd() == sp.first.fd());
+		CHECK(__ev == EventType::In);
+		CHECK(__ud == 7);
+		n++;
+	});
+	CHECK(n == 1);
+}
+
+// The table grows to whatever fd number shows up
+template<EventBackend EB>
+void test_high_fd() {
+	EventLoop<EB> loop;
+	auto sp = socket_pair<SocketType::Stream>();
+
+	int high = ::dup2(sp.first.fd(), 3000);
+	if (high < 0) {
+		puts("dup2 to fd 3000 failed, skipped");
+		return;
+	}
+
+	File f(high);
+	bool fired = false;
+
+	loop.add(f, EventType::In, 0, [&](auto& l, File& __f, EventType, int&){
+		CHECK(__f.fd() == high);
+		fired = true;
+		l.stop();
+	});
+
+	sp.second.write("x", 1);
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(fired);
+	loop.del(f);
+}
+
+// A handler deleting another object that is ready in the same iteration: that one must not be called
+template<EventBackend EB>
+void test_del_other() {
+	EventLoop<EB> loop;
+	auto a = socket_pair<SocketType::Stream>();
+	auto b = socket_pair<SocketType::Stream>();
+	int calls = 0;
+
+	auto handler = [&](auto& l, File& __f, EventType, int&){
+		calls++;
+		l.del(__f.fd() == a.first.fd() ? b.first : a.first);
+		l.del(__f);
+	};
+
+	loop.add(a.first, EventType::In, 0, handler);
+	loop.add(b.first, EventType::In, 0, handler);
+
+	a.second.write("x", 1);
+	b.second.write("x", 1);
+
+	loop.add_timer(100, [](auto& l){ l.stop(); });
+	loop.run();
+
+	CHECK(calls == 1);
+	CHECK(loop.watched_count() == 0);
+}
+
+// Everything an event doesn't need is kept out of the slot
+template<EventBackend EB>
+void test_slot_size() {
+	CHECK(sizeof(typename EventLoop<EB>::Slot) <= 64);
+}
+
+template<EventBackend EB>
+void test_all() {
+	test_slot_size<EB>();
+	test_tokens<EB>();
+	test_high_fd<EB>();
+	test_del_other<EB>();
+}
+
+int main() {
+	test_all<EventBackend::Poll>();
+	test_all<EventBackend::EPoll>();
+	test_all<EventBackend::IoUring>();
+
+	puts("ok");
+}
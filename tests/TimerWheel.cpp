@@ -0,0 +1,165 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+#include <chrono>
+#include <algorithm>
+#include <thread>
+
+using namespace IODash;
+
+static uint64_t now_ms() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Sleeps as told by timeout_ms() and advances until __done
+template<typename W, typename F>
+static void drive(W& __wheel, std::vector<int>& __out, F __done) {
+	uint64_t deadline = now_ms() + 2000;
+
+	while (!__done()) {
+		CHECK(now_ms() < deadline);
+
+		int t = __wheel.timeout_ms();
+		CHECK(t >= 0);
+		std::this_thread::sleep_for(std::chrono::milliseconds(t));
+		__wheel.advance(__out);
+	}
+}
+
+// Timers fire in deadline order, including ones that were cascaded down from level 1
+static void test_ordering() {
+	TimerWheel<std::vector<int>&> wheel;
+	std::vector<int> fired;
+
+	const int delays[] = {130, 3, 70, 64, 0, 200, 65, 1, 129};
+	for (int d : delays)
+		wheel.schedule(d, [d](std::vector<int>& __out){ __out.push_back(d); });
+
+	CHECK(wheel.size() == std::size(delays));
+
+	drive(wheel, fired, [&]{ return fired.size() == std::size(delays); });
+
+	CHECK(std::is_sorted(fired.begin(), fired.end()));
+	CHECK(wheel.size() == 0);
+	CHECK(wheel.timeout_ms() == -1);
+}
+
+static void test_cancel_reschedule() {
+	TimerWheel<std::vector<int>&> wheel;
+	std::vector<int> fired;
+
+	uint64_t a = wheel.schedule(10, [](std::vector<int>& __out){ __out.push_back(1); });
+	uint64_t b = wheel.schedule(20, [](std::vector<int>& __out){ __out.push_back(2); });
+	uint64_t c = wheel.schedule(30, [](std::vector<int>& __out){ __out.push_back(3); });
+
+	CHECK(a && b && c);
+	CHECK(wheel.cancel(b));
+	CHECK(!wheel.cancel(b));
+	CHECK(wheel.reschedule(a, 100));
+	CHECK(wheel.size() == 2);
+
+	// The freed node is reused with a new generation: the old id stays dead
+	uint64_t d = wheel.schedule(5, [](std::vector<int>& __out){ __out.push_back(4); });
+	CHECK(d != b);
+	CHECK(!wheel.cancel(b));
+	CHECK(!wheel.reschedule(b, 1));
+
+	drive(wheel, fired, [&]{ return fired.size() == 3; });
+
+	CHECK((fired == std::vector<int>{4, 3, 1}));
+	CHECK(!wheel.cancel(a));
+	CHECK(!wheel.reschedule(c, 1));
+}
+
+// Deadlines on the upper levels and beyond the wheel's range stay pending, and the next timeout never overshoots them
+static void test_long_delays() {
+	TimerWheel<std::vector<int>&> wheel;
+	std::vector<int> fired;
+
+	const uint64_t delays[] = {5000, 300000, 20000000, 100000000000ULL};
+	std::vector<uint64_t> ids;
+
+	for (uint64_t d : delays) {
+		ids.push_back(wheel.schedule(d, [](std::vector<int>& __out){ __out.push_back(0); }));
+
+		int t = wheel.timeout_ms();
+		CHECK(t >= 0);
+		CHECK((uint64_t)t <= d);
+	}
+
+	wheel.advance(fired);
+	CHECK(fired.empty());
+	CHECK(wheel.size() == std::size(delays));
+
+	// A short one still comes first
+	wheel.schedule(10, [](std::vector<int>& __out){ __out.push_back(1); });
+	CHECK(wheel.timeout_ms() <= 10);
+	drive(wheel, fired, [&]{ return !fired.empty(); });
+	CHECK((fired == std::vector<int>{1}));
+
+	for (auto id : ids)
+		CHECK(wheel.cancel(id));
+
+	CHECK(wheel.size() == 0);
+	CHECK(wheel.timeout_ms() == -1);
+}
+
+// Callbacks cancelling timers due in the same tick, and scheduling new ones, through the loop
+template<EventBackend B>
+static void test_from_callbacks() {
+	EventLoop<B> loop;
+	std::vector<int> fired;
+	uint64_t second = 0;
+
+	loop.add_timer(20, [&](auto&){
+		fired.push_back(1);
+		CHECK(loop.cancel_timer(second));
+
+		// Delay 0 lands on a later tick, it doesn't keep this advance() going forever
+		loop.add_timer(0, [&](auto&){
+			fired.push_back(3);
+			loop.add_timer(30, [&](auto& l){
+				fired.push_back(4);
+				l.stop();
+			});
+		});
+	});
+
+	second = loop.add_timer(20, [&](auto&){ fired.push_back(2); });
+
+	// Pushed back by activity, like an idle timeout
+	uint64_t idle = loop.add_timer(10, [&](auto&){ fired.push_back(5); });
+	CHECK(loop.reset_timer(idle, 1000));
+
+	uint64_t start = now_ms();
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK((fired == std::vector<int>{1, 3, 4}));
+	CHECK(now_ms() - start >= 50);
+	CHECK(loop.cancel_timer(idle));
+}
+
+int main() {
+	test_ordering();
+	test_cancel_reschedule();
+	test_long_delays();
+
+	test_from_callbacks<EventBackend::Poll>();
+	test_from_callbacks<EventBackend::EPoll>();
+	test_from_callbacks<EventBackend::IoUring>();
+
+	puts("ok");
+}
@@ -0,0 +1,242 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+#include <sys/socket.h>
+
+using namespace IODash;
+
+static File temp_file(const std::string& __data) {
+	char path[] = "/tmp/IODash_Transfer_XXXXXX";
+	File f(mkstemp(path));
+	CHECK(f.fd() >= 0);
+	::unlink(path);
+
+	CHECK(f.write_all(__data.data(), __data.size()) == (ssize_t)__data.size());
+	return f;
+}
+
+static std::pair<File, File> nonblocking_pair() {
+	int sv[2];
+	CHECK(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, sv) == 0);
+	return {File(sv[0]), File(sv[1])};
+}
+
+// File to socket with sendfile(), socket to socket with splice(), while a slow reader keeps both waiting.
+// A watched destination keeps its registration and user data, an unwatched one is only watched meanwhile.
+template<EventBackend B>
+static void test_transfer(bool __watched) {
+	std::string data(8 << 20, 0);
+	for (size_t i=0; i<data.size(); i++)
+		data[i] = (char)(i * 31 + 7);
+
+	File src = temp_file(data);
+	auto [a, b] = nonblocking_pair();
+	auto [c, d] = nonblocking_pair();
+
+	EventLoop<B, int> loop;
+	std::string got;
+	bool done1 = false, done2 = false;
+
+	if (__watched)
+		loop.add(a, EventType::In, 42, [](auto&, File&, EventType, int&){});
+
+	loop.add(d, EventType::In, 0, [&](auto& l, File& f, EventType, int&){
+		char buf[4096];
+		ssize_t n = f.read(buf, sizeof(buf));
+		if (n > 0)
+			got.append(buf, n);
+		if (got.size() == data.size())
+			l.stop();
+	});
+
+	loop.transfer(src, 0, data.size(), a, [&](auto& l, size_t n, std::error_code ec){
+		CHECK(!ec && n == data.size());
+		CHECK(!!l.token(a) == __watched);
+		done1 = true;
+	});
+
+	loop.transfer(b, -1, data.size(), c, [&](auto& l, size_t n, std::error_code ec){
+		CHECK(!ec && n == data.size());
+		CHECK(!l.token(b) && !l.token(c));
+		done2 = true;
+	});
+
+	loop.add_timer(5000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(done1 && done2 && got == data);
+	CHECK(loop.watched_count() == (__watched ? 2U : 1U));
+
+	if (__watched) {
+		int ud = 0;
+		loop.with_token(loop.token(a), [&](File&, int& __ud){ ud = __ud; });
+		CHECK(ud == 42);
+	}
+
+	// The source ends before __len
+	int p[2];
+	CHECK(pipe(p) == 0);
+	CHECK(::write(p[1], "abc", 3) == 3);
+	::close(p[1]);
+	File pin(p[0]);
+	bool done3 = false;
+
+	loop.transfer(pin, -1, SIZE_MAX, c, [&](auto& l, size_t n, std::error_code ec){
+		CHECK(!ec && n == 3);
+		done3 = true;
+		l.stop();
+	});
+
+	loop.run();
+	CHECK(done3);
+}
+
+// The transfer waits on Out of a socket whose owner watches In, in each trigger mode: the owner keeps getting In
+// without ever seeing Out, and gets its registration back afterwards
+template<EventBackend B>
+static void test_shared_registration(EventType __mode) {
+	std::string data(256 << 10, 'q');
+	File src = temp_file(data);
+	auto [a, b] = nonblocking_pair();
+
+	int sndbuf = 4096;
+	CHECK(setsockopt(a.fd(), SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf)) == 0);
+
+	EventLoop<B> loop;
+	int user_in = 0;
+	bool done = false;
+	size_t drained = 0;
+
+	loop.add(a, EventType::In | __mode, 0, [&](auto&, File& f, EventType ev, int&){
+		CHECK(!(ev & EventType::Out));
+		if (ev & EventType::In) {
+			user_in++;
+			char buf[16];
+			while (f.read(buf, sizeof(buf)) > 0);
+		}
+	});
+
+	uint64_t token = loop.token(a);
+
+	loop.transfer(src, 0, data.size(), a, [&](auto&, size_t n, std::error_code ec){
+		CHECK(!ec && n == data.size());
+		done = true;
+	});
+
+	loop.add_timer(20, [&](auto&){ b.write("ping", 4); });
+
+	// Drained slowly, so the transfer has to wait on Out
+	loop.add_timer(100, [&](auto& l){
+		l.add(b, EventType::In, 0, [&](auto& l, File& f, EventType, int&){
+			char buf[2048];
+			ssize_t n = f.read(buf, sizeof(buf));
+			if (n > 0)
+				drained += n;
+			if (drained == data.size() && done)
+				l.stop();
+		});
+	});
+
+	loop.add_timer(3000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(done && drained == data.size());
+	if (!(__mode & EventType::OneShot))
+		CHECK(user_in >= 1);
+
+	CHECK(loop.token(a) == token);
+	loop.for_each_watched([&](File& f, EventType ev, int&){
+		if (f.fd() == a.fd())
+			CHECK(ev == (EventType::In | __mode));
+	});
+}
+
+// del()'ing the destination abandons the transfer without calling it back
+template<EventBackend B>
+static void test_abandon() {
+	File src = temp_file(std::string(1 << 20, 'x'));
+	auto [a, b] = nonblocking_pair();
+
+	EventLoop<B> loop;
+	bool called = false;
+
+	loop.add(a, EventType::In);
+	loop.transfer(src, 0, 1 << 20, a, [&](auto&, size_t, std::error_code){ called = true; });
+
+	loop.add_timer(20, [&](auto& l){
+		l.del(a);
+		l.add_timer(50, [](auto& l2){ l2.stop(); });
+	});
+
+	loop.run();
+
+	CHECK(!called);
+	CHECK(loop.watched_count() == 0);
+}
+
+// A destination whose peer is gone fails the transfer with EPIPE, without a SIGPIPE killing the process.
+// sendfile() from a file and splice() from a socket.
+template<EventBackend B>
+static void test_closed_peer() {
+	File src = temp_file(std::string(64 << 10, 'x'));
+	auto [c, d] = nonblocking_pair();
+	CHECK(d.write("yyyy", 4) == 4);
+
+	for (bool spliced : {false, true}) {
+		auto [a, b] = nonblocking_pair();
+		b.close();
+
+		EventLoop<B> loop;
+		std::error_code result;
+
+		loop.transfer(spliced ? c : src, spliced ? -1 : 0, spliced ? 4 : 64 << 10, a, [&](auto& l, size_t, std::error_code ec){
+			result = ec;
+			l.stop();
+		});
+
+		loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+		loop.run();
+
+		CHECK(result == std::errc::broken_pipe);
+	}
+
+	sigset_t pending;
+	sigpending(&pending);
+	CHECK(!sigismember(&pending, SIGPIPE));
+}
+
+int main() {
+	for (bool watched : {false, true}) {
+		test_transfer<EventBackend::Poll>(watched);
+		test_transfer<EventBackend::EPoll>(watched);
+		test_transfer<EventBackend::IoUring>(watched);
+	}
+
+	for (auto mode : {EventType::None, EventType::EdgeTriggered, EventType::OneShot}) {
+		test_shared_registration<EventBackend::Poll>(mode);
+		test_shared_registration<EventBackend::EPoll>(mode);
+		test_shared_registration<EventBackend::IoUring>(mode);
+	}
+
+	test_abandon<EventBackend::Poll>();
+	test_abandon<EventBackend::EPoll>();
+	test_abandon<EventBackend::IoUring>();
+
+	test_closed_peer<EventBackend::Poll>();
+	test_closed_peer<EventBackend::EPoll>();
+	test_closed_peer<EventBackend::IoUring>();
+
+	puts("ok");
+}
@@ -0,0 +1,159 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+using namespace IODash;
+
+// Fires once per write, unread data doesn't fire again (not on the poll backend, it falls back to level-triggered)
+template<EventBackend EB>
+void test_edge() {
+	EventLoop<EB> loop;
+	auto sp = socket_pair<SocketType::Stream>();
+	int fired = 0;
+
+	loop.add(sp.first, EventType::In | EventType::EdgeTriggered, 0, [&](auto&, File&, EventType ev, int&){
+		CHECK(ev & EventType::In);
+		fired++;
+	});
+
+	loop.add_timer(10, [&](auto&){ sp.second.write("a", 1); });
+	loop.add_timer(60, [&](auto&){ sp.second.write("b", 1); });
+	loop.add_timer(120, [](auto& l){ l.stop(); });
+	loop.run();
+
+	CHECK(fired == 2);
+}
+
+// Disabled after one event until rearm()
+template<EventBackend EB>
+void test_oneshot() {
+	EventLoop<EB> loop;
+	auto sp = socket_pair<SocketType::Stream>();
+	int fired = 0;
+
+	loop.add(sp.first, EventType::In | EventType::OneShot, 0, [&](auto&, File&, EventType, int&){
+		fired++;
+	});
+
+	sp.second.write("a", 1);
+	loop.add_timer(50, [&](auto& l){
+		CHECK(fired == 1);
+		l.rearm(sp.first);
+	});
+	loop.add_timer(100, [](auto& l){ l.stop(); });
+	loop.run();
+
+	CHECK(fired == 2);
+}
+
+// modify() from edge-triggered to level-triggered and back, with data left unread
+template<EventBackend EB>
+void test_switch() {
+	EventLoop<EB> loop;
+	auto sp = socket_pair<SocketType::Stream>();
+	int phase = 0, fired = 0;
+
+	loop.add(sp.first, EventType::In | EventType::EdgeTriggered, 0, [&](auto& l, File& f, EventType, int&){
+		fired++;
+		if (phase == 0) {
+			phase = 1;
+			fired = 0;
+			l.modify(f, EventType::In);
+		} else if (phase == 1 && fired == 5) {
+			l.stop();
+		}
+	});
+
+	sp.second.write("x", 1);
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(phase == 1 && fired == 5);
+
+	// Level to edge: once per write from now on
+	phase = 2;
+	fired = 0;
+	loop.modify(sp.first, EventType::In | EventType::EdgeTriggered);
+	loop.add_timer(50, [&](auto&){ sp.second.write("y", 1); });
+	loop.add_timer(100, [&](auto&){ sp.second.write("y", 1); });
+	loop.add_timer(150, [](auto& l){ l.stop(); });
+	loop.run();
+
+	// The modify() itself may report the data already there once
+	CHECK(fired >= 2 && fired <= 3);
+}
+
+// A default registration and a loop wide handler for All still see a peer's half-close, which only asking for
+// ReadHangup adds to the events
+template<EventBackend EB>
+void test_read_hangup() {
+	auto sp = socket_pair<SocketType::Stream>();
+	int fired = 0;
+
+	{
+		EventLoop<EB> loop;
+
+		loop.on_event(EventType::In | EventType::Out | EventType::Error | EventType::Hangup, [&](auto& l, File& f, EventType ev, int&){
+			CHECK(!(ev & EventType::ReadHangup));
+			if (ev & EventType::In) {
+				char c;
+				CHECK(f.read(&c, 1) == 0);
+				fired++;
+				l.del(f);
+				l.stop();
+			}
+		});
+
+		loop.add(sp.first);
+		sp.second.shutdown(SHUT_WR);
+
+		loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+		loop.run();
+
+		CHECK(fired == 1);
+	}
+
+	EventLoop<EB> loop;
+	auto sp2 = socket_pair<SocketType::Stream>();
+
+	loop.add(sp2.first, EventType::In | EventType::ReadHangup, 0, [&](auto& l, File&, EventType ev, int&){
+		CHECK(ev & EventType::ReadHangup);
+		fired++;
+		l.stop();
+	});
+
+	sp2.second.shutdown(SHUT_WR);
+
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(fired == 2);
+}
+
+int main() {
+	test_oneshot<EventBackend::Poll>();
+	test_read_hangup<EventBackend::Poll>();
+
+	test_edge<EventBackend::EPoll>();
+	test_oneshot<EventBackend::EPoll>();
+	test_switch<EventBackend::EPoll>();
+	test_read_hangup<EventBackend::EPoll>();
+
+	test_edge<EventBackend::IoUring>();
+	test_oneshot<EventBackend::IoUring>();
+	test_switch<EventBackend::IoUring>();
+	test_read_hangup<EventBackend::IoUring>();
+
+	puts("ok");
+}
@@ -0,0 +1,159 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+#include <cstring>
+#include <thread>
+#include <atomic>
+
+#include <signal.h>
+#include <pthread.h>
+
+using namespace IODash;
+
+// More entries than IOV_MAX, and positional reads/writes into the middle
+static void test_file() {
+	char path[] = "/tmp/IODash_VectoredIO_XXXXXX";
+	File f(mkstemp(path));
+	CHECK(f.fd() >= 0);
+	::unlink(path);
+
+	std::vector<std::string> parts;
+	std::vector<iovec> iov;
+	std::string all;
+
+	for (int i=0; i<3000; i++) {
+		parts.push_back(std::string(i % 17 + 1, 'a' + i % 26));
+		all += parts.back();
+	}
+
+	for (auto &it : parts)
+		iov.push_back({(void *)it.data(), it.size()});
+
+	CHECK(f.writev_all(iov.data(), iov.size()) == (ssize_t)all.size());
+
+	std::string back(all.size(), 0);
+	CHECK(f.pread(back.data(), back.size(), 0) == (ssize_t)all.size());
+	CHECK(back == all);
+
+	char a[5], b[7];
+	iovec r[2] = {{a, 5}, {b, 7}};
+	CHECK(f.preadv(r, 2, 3) == 12);
+	CHECK(!memcmp(a, all.data() + 3, 5) && !memcmp(b, all.data() + 8, 7));
+
+	CHECK(f.pwrite("XY", 2, 1) == 2);
+	iovec w[2] = {{(void *)"12", 2}, {(void *)"345", 3}};
+	CHECK(f.pwritev(w, 2, 10) == 5);
+
+	CHECK(f.pread(back.data(), 15, 0) == 15);
+	CHECK(back.substr(0, 15) == all.substr(0, 1) + "XY" + all.substr(3, 7) + "12345");
+}
+
+// A gathered send larger than the socket buffer: on EAGAIN the array shows what's left, and resuming with it
+// delivers everything in order
+static void test_partial_send() {
+	auto [s0, s1] = socket_pair<SocketType::Stream>();
+	s0.set_nonblocking();
+
+	std::string big(1 << 20, 'z'), hdr = "HDR", trl = "TRL", got;
+	iovec v[3] = {{(void *)hdr.data(), hdr.size()}, {(void *)big.data(), big.size()}, {(void *)trl.data(), trl.size()}};
+	iovec *cur = v;
+	int cnt = 3, eagain = 0;
+
+	while (cnt) {
+		ssize_t rc = s0.sendv_all(cur, cnt);
+		if (rc < 0) {
+			CHECK(errno == EAGAIN);
+			eagain++;
+		}
+
+		while (cnt && !cur->iov_len) {
+			cur++;
+			cnt--;
+		}
+
+		char buf[65536];
+		iovec rv[2] = {{buf, 100}, {buf + 100, sizeof(buf) - 100}};
+		ssize_t n;
+		while ((n = s1.recvv(rv, 2, MSG_DONTWAIT)) > 0)
+			got.append(buf, n);
+	}
+
+	CHECK(eagain > 0);
+	CHECK(got == hdr + big + trl);
+}
+
+// Several buffers make one datagram
+static void test_datagram() {
+	Socket<AddressFamily::IPv4, SocketType::Datagram> rx, tx;
+	rx.create();
+	tx.create();
+	rx.bind({"127.0.0.1:0"});
+
+	iovec w[3] = {{(void *)"one ", 4}, {(void *)"two ", 4}, {(void *)"three", 5}};
+	CHECK(tx.sendv(rx.local_address(), w, 3) == 13);
+
+	char a[6], b[64];
+	iovec r[2] = {{a, 6}, {b, sizeof(b)}};
+	CHECK(rx.recvv(r, 2) == 13);
+	CHECK(!memcmp(a, "one tw", 6) && !memcmp(b, "o three", 7));
+}
+
+// write_all() on a blocking pipe, interrupted by signals without SA_RESTART: EINTR is retried
+static void test_eintr() {
+	struct sigaction sa{};
+	sa.sa_handler = [](int){};
+	sigaction(SIGUSR1, &sa, nullptr);
+
+	int p[2];
+	CHECK(pipe(p) == 0);
+	File rd(p[0]), wr(p[1]);
+
+	std::string data(1 << 20, 'w'), got(data.size(), 0);
+	std::atomic<bool> done{false}, release{false};
+	ssize_t written = 0;
+
+	// Stays alive until the signals stop, so pthread_kill() never sees a finished thread
+	std::thread writer([&]{
+		written = wr.write_all(data.data(), data.size());
+		wr.close();
+		done = true;
+		while (!release)
+			usleep(1000);
+	});
+
+	// Nothing is read yet: the pipe fills up, then every write() blocks with nothing written and fails with EINTR
+	for (int i=0; i<5; i++) {
+		usleep(2000);
+		pthread_kill(writer.native_handle(), SIGUSR1);
+	}
+
+	CHECK(rd.read_all(got.data(), got.size()) == (ssize_t)got.size());
+	release = true;
+	writer.join();
+
+	CHECK(done && written == (ssize_t)data.size());
+	CHECK(got == data);
+
+	signal(SIGUSR1, SIG_DFL);
+}
+
+int main() {
+	test_file();
+	test_eintr();
+	test_partial_send();
+	test_datagram();
+
+	puts("ok");
+}
@@ -0,0 +1,180 @@
+/*
+    This file is part of IODash.
+    Copyright (C) 2020 ReimuNotMoe
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the MIT License.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "IODash.hpp"
+#include "Check.hpp"
+
+#include <netinet/in.h>
+
+using namespace IODash;
+
+using Tcp = Socket<AddressFamily::IPv4, SocketType::Stream>;
+
+static std::pair<Tcp, Tcp> connected_pair() {
+	Tcp ls, c;
+
+	ls.create();
+	ls.bind({"127.0.0.1:0"});
+	ls.listen();
+
+	c.create();
+	c.connect(ls.local_address());
+
+	Tcp srv = ls.accept();
+	c.set_nonblocking();
+	srv.set_nonblocking();
+
+	return {c, srv};
+}
+
+// Every send is released exactly once after the peer got everything, the completions never reach the handler
+template<EventBackend B>
+static void test_release() {
+	auto [c, srv] = connected_pair();
+	EventLoop<B> loop;
+
+	std::vector<std::vector<uint8_t>> bufs(8, std::vector<uint8_t>(256 << 10, 7));
+	int released = 0, user_errors = 0, sends = 0;
+	size_t received = 0, total = 0;
+
+	auto check_done = [&](auto& l){
+		if (received == total && released == sends)
+			l.stop();
+	};
+
+	loop.add(c, EventType::In, 0, [&](auto&, File&, EventType ev, int&){
+		if (ev & EventType::Error)
+			user_errors++;
+	});
+
+	loop.add(srv, EventType::In, 0, [&](auto& l, File& f, EventType, int&){
+		static char buf[1 << 16];
+		ssize_t n;
+		while ((n = f.read(buf, sizeof(buf))) > 0)
+			received += n;
+		check_done(l);
+	});
+
+	for (auto &b : bufs) {
+		ssize_t rc = loop.send_zerocopy(c, b.data(), b.size(), [&](auto& l, bool, std::error_code ec){
+			CHECK(!ec);
+			released++;
+			check_done(l);
+		});
+
+		if (rc > 0) {
+			total += rc;
+			sends++;
+		}
+	}
+
+	CHECK(sends > 0);
+	CHECK(loop.zerocopy_pending(c) <= (size_t)sends);
+
+	loop.add_timer(3000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(received == total && released == sends);
+	CHECK(user_errors == 0);
+	CHECK(loop.zerocopy_pending(c) == 0);
+	CHECK(!loop.zerocopy_error(c));
+}
+
+// del() with sends the peer hasn't taken: each is still released once, ECANCELED if it wasn't completed
+template<EventBackend B>
+static void test_del_pending() {
+	auto [c, srv] = connected_pair();
+	EventLoop<B> loop;
+
+	loop.add(c, EventType::In);
+
+	std::vector<uint8_t> buf(1 << 20, 1);
+	int completed = 0, cancelled = 0, sends = 0;
+
+	for (int i=0; i<8; i++) {
+		ssize_t rc = loop.send_zerocopy(c, buf.data(), buf.size(), [&](auto&, bool, std::error_code ec){
+			if (ec) {
+				CHECK(ec == std::error_code(ECANCELED, std::system_category()));
+				cancelled++;
+			} else {
+				completed++;
+			}
+		});
+
+		if (rc > 0)
+			sends++;
+	}
+
+	loop.del(c);
+	// Not called from inside del()
+	CHECK(completed + cancelled == 0);
+
+	loop.add_timer(50, [](auto& l){ l.stop(); });
+	loop.run();
+
+	CHECK(completed + cancelled == sends);
+}
+
+// An ICMP error shares the error queue with the completions: it's kept for zerocopy_error(), and the handler
+// still gets the Error event
+template<EventBackend B>
+static void test_other_error() {
+	Socket<AddressFamily::IPv4, SocketType::Datagram> closed, s;
+	closed.create();
+	closed.bind({"127.0.0.1:0"});
+	auto addr = closed.local_address();
+	closed.close();
+
+	s.create();
+	int on = 1;
+	CHECK(s.setsockopt(SOL_IP, IP_RECVERR, &on, sizeof(on)) == 0);
+	s.connect(addr);
+	s.set_nonblocking();
+
+	EventLoop<B> loop;
+	std::error_code error;
+	int released = 0;
+
+	loop.add(s, EventType::In, 0, [&](auto& l, File& f, EventType ev, int&){
+		if (ev & EventType::Error) {
+			error = l.zerocopy_error(f);
+			if (error)
+				l.stop();
+		}
+	});
+
+	char buf[64] = {};
+	CHECK(loop.send_zerocopy(s, buf, sizeof(buf), [&](auto&, bool, std::error_code){ released++; }) == sizeof(buf));
+
+	loop.add_timer(2000, [](auto&){ CHECK(!"timed out"); });
+	loop.run();
+
+	CHECK(error == std::error_code(ECONNREFUSED, std::system_category()));
+	CHECK(!loop.zerocopy_error(s));
+	CHECK(released <= 1);
+}
+
+int main() {
+	test_release<EventBackend::Poll>();
+	test_release<EventBackend::EPoll>();
+	test_release<EventBackend::IoUring>();
+
+	test_del_pending<EventBackend::Poll>();
+	test_del_pending<EventBackend::EPoll>();
+	test_del_pending<EventBackend::IoUring>();
+
+	test_other_error<EventBackend::Poll>();
+	test_other_error<EventBackend::EPoll>();
+	test_other_error<EventBackend::IoUring>();
+
+	puts("ok");
+}